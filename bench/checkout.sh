@@ -0,0 +1,44 @@
+#!/bin/sh
+# Time a full checkout of a synthetic tree with 1, 2, 4, 8 and 16 workers
+# usage: bench/checkout.sh [FILES] [FILE_SIZE]
+# Run from the root of the repository after make
+
+FILES=${1:-5000}
+FILE_SIZE=${2:-16384}
+CGIT=$(pwd)/build/cgit
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+cd "$WORK" || exit 1
+$CGIT init > /dev/null
+echo base > base
+$CGIT add base > /dev/null
+$CGIT commit -m base > /dev/null
+BASE=$(cat .cgit/refs/heads/master)
+
+i=0
+while [ $i -lt "$FILES" ]
+do
+    dir=d$((i % 64))
+    mkdir -p $dir
+    head -c "$FILE_SIZE" /dev/urandom | base64 > $dir/f$i
+    i=$((i + 1))
+done
+$CGIT add . > /dev/null
+$CGIT commit -m full > /dev/null
+FULL=$(cat .cgit/refs/heads/master)
+BYTES=$(du -sb d* | awk '{ sum += $1 } END { print sum }')
+
+printf "%8s %10s %12s %10s\n" workers seconds files/s MB/s
+for workers in 1 2 4 8 16
+do
+    $CGIT reset "$BASE" > /dev/null
+    sync
+    start=$(date +%s%N)
+    CGIT_CHECKOUT_WORKERS=$workers $CGIT reset "$FULL" > /dev/null
+    end=$(date +%s%N)
+    awk -v ns=$((end - start)) -v files="$FILES" -v bytes="$BYTES" -v workers=$workers 'BEGIN {
+        s = ns / 1e9
+        printf "%8d %10.3f %12.0f %10.1f\n", workers, s, files / s, bytes / s / 1e6
+    }'
+done
@@ -0,0 +1,472 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../src/arena.h"
+#include "../src/commit.h"
+#include "../src/includes.h"
+#include "../src/objects.h"
+#include "../src/tree.h"
+#include "../src/types.h"
+
+// Micro-benchmarks of the object, tree and commit codecs, see make bench.
+//
+// Every input is generated from a fixed seed, so that two builds are measured
+// on the same data. A benchmark runs a pass over its whole data set, first
+// WARMUP times, then it is calibrated so that a sample lasts at least
+// SAMPLE_MIN_NS and RUNS samples are taken. Times are reported per operation:
+// the median, the 99th percentile (nearest rank) and the minimum over samples.
+//
+// usage: cgit-bench [--runs N] [--warmup N] [--filter SUBSTRING] [--json FILE]
+// The results are printed as a table, and written as JSON to FILE (- for stdout).
+
+#define SEED 0x2545f4914f6cdd1dULL
+#define DEFAULT_RUNS 51
+#define DEFAULT_WARMUP 5
+#define SAMPLE_MIN_NS 2000000
+
+#define TINY_BLOBS 1024
+#define LARGE_BLOB_SIZE (1024 * 1024)
+#define COMMIT_CHAIN_LENGTH 1000
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#ifdef __OPTIMIZE__
+#define BENCH_OPTIMIZED 1
+#else
+#define BENCH_OPTIMIZED 0
+#endif
+
+struct bench {
+    char *name;
+    void (*setup)(struct bench *bench);
+    void (*run)(struct bench *bench);
+    void (*teardown)(struct bench *bench);
+    // Tree sizes are given to the setup, other benchmarks ignore it
+    size_t param;
+
+    // Filled by the setup: operations in one pass and bytes they process
+    size_t ops;
+    size_t bytes;
+    object_t *objects;
+    size_t objects_size;
+    char **compressed;
+    uLongf *compressed_size;
+    tree_t tree;
+    struct arena arena;
+};
+
+struct result {
+    char *name;
+    size_t ops;
+    double bytes_per_op;
+    double median_ns;
+    double p99_ns;
+    double min_ns;
+};
+
+static uint64_t rng_state = SEED;
+// Written by every benchmark so that the compiler cannot drop the work
+static volatile unsigned char sink;
+
+static uint64_t next_random()
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The first NAME_WORDS words are used for file names
+#define NAME_WORDS 18
+static char *words[] = {
+    "static", "int", "return", "struct", "if", "else", "for", "while", "size_t",
+    "char", "void", "const", "tree", "entry", "object", "checksum", "index",
+    "result", "buffer", "=", "==", "!=", "+", "(", ")", "{", "}", ";", "0", "1",
+};
+
+/// @brief Fill content with lines of words, compressible like source code
+static void fill_text(char *content, size_t size)
+{
+    size_t i = 0;
+    size_t line = 0;
+    while (i < size)
+    {
+        char *word = words[next_random() % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        for (size_t k = 0; k < len && i < size; k++)
+            content[i++] = word[k];
+        line += len + 1;
+        if (i < size)
+            content[i++] = line > 60 ? '\n' : ' ';
+        if (line > 60)
+            line = 0;
+    }
+}
+
+static void fill_random(unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        data[i] = next_random();
+}
+
+static void new_blobs(struct bench *bench, size_t count, int tiny)
+{
+    bench->objects = calloc(count, sizeof(object_t));
+    bench->objects_size = count;
+    bench->ops = count;
+    bench->bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        // Tiny sizes are spread evenly over the powers of two, from 1 byte to 1KiB
+        size_t size = LARGE_BLOB_SIZE;
+        if (tiny)
+        {
+            size_t magnitude = (size_t)1 << (next_random() % 10);
+            size = magnitude + next_random() % magnitude;
+        }
+        bench->objects[i].object_type = BLOB;
+        bench->objects[i].size = size;
+        bench->objects[i].content = malloc(size);
+        fill_text(bench->objects[i].content, size);
+        bench->bytes += size;
+    }
+}
+
+static void compress_blobs(struct bench *bench)
+{
+    bench->compressed = calloc(bench->objects_size, sizeof(char *));
+    bench->compressed_size = calloc(bench->objects_size, sizeof(uLongf));
+    for (size_t i = 0; i < bench->objects_size; i++)
+    {
+        bench->compressed_size[i] = compressBound(bench->objects[i].size + HEADER_MAX_SIZE);
+        bench->compressed[i] = malloc(bench->compressed_size[i]);
+        compress_object(&bench->objects[i], bench->compressed[i], &bench->compressed_size[i]);
+    }
+}
+
+static void setup_tiny_blobs(struct bench *bench)
+{
+    new_blobs(bench, TINY_BLOBS, 1);
+}
+
+static void setup_large_blob(struct bench *bench)
+{
+    new_blobs(bench, 1, 0);
+}
+
+static void setup_tiny_compressed(struct bench *bench)
+{
+    setup_tiny_blobs(bench);
+    compress_blobs(bench);
+}
+
+static void setup_large_compressed(struct bench *bench)
+{
+    setup_large_blob(bench);
+    compress_blobs(bench);
+}
+
+static void free_objects(struct bench *bench)
+{
+    for (size_t i = 0; i < bench->objects_size; i++)
+    {
+        free_object(&bench->objects[i]);
+        if (bench->compressed != NULL)
+            free(bench->compressed[i]);
+    }
+    free(bench->objects);
+    free(bench->compressed);
+    free(bench->compressed_size);
+    free_arena(&bench->arena);
+}
+
+static void run_hash_object(struct bench *bench)
+{
+    unsigned char checksum[DIGEST_LENGTH];
+    for (size_t i = 0; i < bench->objects_size; i++)
+    {
+        hash_object(&bench->objects[i], checksum);
+        sink ^= checksum[0];
+    }
+}
+
+static void run_compress_object(struct bench *bench)
+{
+    for (size_t i = 0; i < bench->objects_size; i++)
+    {
+        uLongf size = compressBound(bench->objects[i].size + HEADER_MAX_SIZE);
+        compress_object(&bench->objects[i], bench->compressed[i], &size);
+        sink ^= bench->compressed[i][size - 1];
+    }
+}
+
+static void run_uncompress_object(struct bench *bench)
+{
+    for (size_t i = 0; i < bench->objects_size; i++)
+    {
+        object_t obj = {0};
+        uncompress_object(&obj, bench->compressed[i], bench->compressed_size[i]);
+        sink ^= obj.size;
+        free_object(&obj);
+    }
+}
+
+/// @brief A tree of param entries, a tenth of them directories, with names like a source tree
+static void setup_tree(struct bench *bench)
+{
+    for (size_t i = 0; i < bench->param; i++)
+    {
+        char name[64];
+        int is_dir = next_random() % 10 == 0;
+        char *word = words[next_random() % NAME_WORDS];
+        sprintf(name, is_dir ? "%s_%zu" : "%s_%zu.c", word, i);
+
+        unsigned char checksum[DIGEST_LENGTH];
+        fill_random(checksum, DIGEST_LENGTH);
+        append_entry_to_tree(&bench->tree, checksum, is_dir ? TREE : BLOB, name, is_dir ? DIRECTORY : REG_NONX_FILE);
+    }
+    sort_tree(&bench->tree);
+
+    bench->objects = calloc(1, sizeof(object_t));
+    bench->objects_size = 1;
+    tree_to_object(&bench->tree, &bench->objects[0]);
+    bench->ops = 1;
+    bench->bytes = bench->objects[0].size;
+}
+
+static void teardown_tree(struct bench *bench)
+{
+    free_tree(&bench->tree);
+    free_objects(bench);
+}
+
+static void run_tree_to_object(struct bench *bench)
+{
+    object_t obj = {0};
+    tree_to_object(&bench->tree, &obj);
+    sink ^= obj.content[obj.size - 1];
+    free_object(&obj);
+}
+
+static void run_tree_from_object(struct bench *bench)
+{
+    tree_t tree;
+    tree_from_object(&tree, &bench->objects[0], &bench->arena);
+    sink ^= tree.entries_size;
+    clear_arena(&bench->arena);
+}
+
+/// @brief A chain of commits, each one the parent of the next
+static void setup_commit_chain(struct bench *bench)
+{
+    bench->objects = calloc(COMMIT_CHAIN_LENGTH, sizeof(object_t));
+    bench->objects_size = COMMIT_CHAIN_LENGTH;
+    bench->ops = COMMIT_CHAIN_LENGTH;
+    bench->bytes = 0;
+
+    char parent[DIGEST_LENGTH * 2 + 1] = {0};
+    for (size_t i = 0; i < COMMIT_CHAIN_LENGTH; i++)
+    {
+        unsigned char raw_tree[DIGEST_LENGTH];
+        fill_random(raw_tree, DIGEST_LENGTH);
+        char tree[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(raw_tree, tree);
+
+        char ident[64];
+        sprintf(ident, "A U Thor <author@example.com> %zu +0000", 1700000000 + i * 600);
+        char message[256];
+        size_t message_len = 20 + next_random() % 200;
+        fill_text(message, message_len);
+        message[message_len] = '\0';
+
+        commit_t commit = {
+            .tree = tree,
+            .parent = i == 0 ? NULL : parent,
+            .author = ident,
+            .committer = ident,
+            .message = message,
+        };
+        commit_to_object(&commit, &bench->objects[i]);
+        hash_object_str(&bench->objects[i], parent);
+        bench->bytes += bench->objects[i].size;
+    }
+}
+
+static void run_commit_from_object(struct bench *bench)
+{
+    for (size_t i = 0; i < bench->objects_size; i++)
+    {
+        commit_t commit = {0};
+        commit_from_object(&commit, &bench->objects[i], &bench->arena);
+        sink ^= commit.tree[0];
+    }
+    clear_arena(&bench->arena);
+}
+
+static struct bench benches[] = {
+    {"hash_object/blob_tiny", setup_tiny_blobs, run_hash_object, free_objects},
+    {"hash_object/blob_1m", setup_large_blob, run_hash_object, free_objects},
+    {"compress_object/blob_tiny", setup_tiny_compressed, run_compress_object, free_objects},
+    {"compress_object/blob_1m", setup_large_compressed, run_compress_object, free_objects},
+    {"uncompress_object/blob_tiny", setup_tiny_compressed, run_uncompress_object, free_objects},
+    {"uncompress_object/blob_1m", setup_large_compressed, run_uncompress_object, free_objects},
+    {"tree_to_object/10", setup_tree, run_tree_to_object, teardown_tree, 10},
+    {"tree_to_object/100", setup_tree, run_tree_to_object, teardown_tree, 100},
+    {"tree_to_object/1k", setup_tree, run_tree_to_object, teardown_tree, 1000},
+    {"tree_to_object/10k", setup_tree, run_tree_to_object, teardown_tree, 10000},
+    {"tree_from_object/10", setup_tree, run_tree_from_object, teardown_tree, 10},
+    {"tree_from_object/100", setup_tree, run_tree_from_object, teardown_tree, 100},
+    {"tree_from_object/1k", setup_tree, run_tree_from_object, teardown_tree, 1000},
+    {"tree_from_object/10k", setup_tree, run_tree_from_object, teardown_tree, 10000},
+    {"commit_from_object/chain_1k", setup_commit_chain, run_commit_from_object, free_objects},
+};
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_bench(struct bench *bench, int runs, int warmup, struct result *result)
+{
+    // Each benchmark sees the same data whatever ran before it
+    rng_state = SEED;
+    bench->setup(bench);
+
+    uint64_t pass_ns = 1;
+    for (int i = 0; i < warmup; i++)
+    {
+        uint64_t start = now_ns();
+        bench->run(bench);
+        pass_ns = now_ns() - start;
+    }
+
+    size_t passes = pass_ns >= SAMPLE_MIN_NS ? 1 : SAMPLE_MIN_NS / (pass_ns == 0 ? 1 : pass_ns) + 1;
+    double *samples = malloc(runs * sizeof(double));
+    for (int i = 0; i < runs; i++)
+    {
+        uint64_t start = now_ns();
+        for (size_t k = 0; k < passes; k++)
+            bench->run(bench);
+        samples[i] = (double)(now_ns() - start) / (passes * bench->ops);
+    }
+    qsort(samples, runs, sizeof(double), compare_double);
+
+    result->name = bench->name;
+    result->ops = bench->ops;
+    result->bytes_per_op = (double)bench->bytes / bench->ops;
+    result->median_ns = samples[runs / 2];
+    result->p99_ns = samples[(int)ceil(runs * 0.99) - 1];
+    result->min_ns = samples[0];
+
+    free(samples);
+    bench->teardown(bench);
+}
+
+static void print_table(FILE *out, struct result *results, size_t count)
+{
+    fprintf(out, "%-30s %12s %12s %12s %10s\n", "benchmark", "median ns", "p99 ns", "min ns", "MB/s");
+    for (size_t i = 0; i < count; i++)
+    {
+        struct result *r = &results[i];
+        fprintf(out, "%-30s %12.1f %12.1f %12.1f %10.1f\n", r->name, r->median_ns, r->p99_ns, r->min_ns,
+               r->bytes_per_op * 1000 / r->median_ns);
+    }
+}
+
+static void write_json(FILE *out, struct result *results, size_t count, int runs, int warmup)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"suite\": \"codec\",\n");
+    fprintf(out, "  \"revision\": \"%s\",\n", BENCH_REVISION);
+    fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(out, "  \"optimized\": %s,\n", BENCH_OPTIMIZED ? "true" : "false");
+    fprintf(out, "  \"zlib\": \"%s\",\n", zlibVersion());
+    fprintf(out, "  \"runs\": %d,\n", runs);
+    fprintf(out, "  \"warmup\": %d,\n", warmup);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        struct result *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"ops\": %zu, \"bytes_per_op\": %.1f, "
+                     "\"median_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, \"mb_per_s\": %.1f}%s\n",
+                r->name, r->ops, r->bytes_per_op, r->median_ns, r->p99_ns, r->min_ns,
+                r->bytes_per_op * 1000 / r->median_ns, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    int runs = DEFAULT_RUNS;
+    int warmup = DEFAULT_WARMUP;
+    char *filter = NULL;
+    char *json = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json = argv[++i];
+        else
+        {
+            printf("usage: cgit-bench [--runs N] [--warmup N] [--filter SUBSTRING] [--json FILE]\n");
+            return 129;
+        }
+    }
+    if (runs < 1)
+        runs = 1;
+    if (warmup < 1)
+        warmup = 1;
+
+    size_t bench_count = sizeof(benches) / sizeof(benches[0]);
+    struct result *results = calloc(bench_count, sizeof(struct result));
+    size_t count = 0;
+    for (size_t i = 0; i < bench_count; i++)
+    {
+        if (filter != NULL && strstr(benches[i].name, filter) == NULL)
+            continue;
+        run_bench(&benches[i], runs, warmup, &results[count++]);
+    }
+
+    // The table goes to stderr when the JSON takes stdout
+    int json_stdout = json != NULL && strcmp(json, "-") == 0;
+    print_table(json_stdout ? stderr : stdout, results, count);
+    if (json_stdout)
+    {
+        write_json(stdout, results, count, runs, warmup);
+    } else if (json != NULL)
+    {
+        FILE *out = fopen(json, "w");
+        if (out == NULL)
+        {
+            printf("Cannot write %s\n", json);
+            free(results);
+            return 1;
+        }
+        write_json(out, results, count, runs, warmup);
+        fclose(out);
+    }
+
+    free(results);
+    return 0;
+}
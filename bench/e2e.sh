@@ -0,0 +1,139 @@
+#!/bin/sh
+# Time init, add, commit, log, diff, reset and checkout end to end on a
+# synthetic repository made by cgit-gen, and record for each command its wall
+# time, peak RSS, bytes written and number of system calls
+# usage: bench/e2e.sh [FILES] [COMMITS] [CHURN_PERCENT]
+# Run from the root of the repository after make e2e-tools, or through make e2e
+#
+# GEN_OPTIONS is given to cgit-gen on top of the above (e.g. "--depth 5
+# --max-size 1048576"). The repository is built under E2E_DIR, build/ by
+# default, so that it lives on local disk rather than in a tmpfs. System calls
+# are counted in a second, traced, run of the whole scenario, set SYSCALLS=0 to
+# skip it. The results are written as JSON to E2E_JSON, build/e2e.json by default.
+
+FILES=${1:-10000}
+COMMITS=${2:-20}
+CHURN=${3:-1}
+CGIT=$(pwd)/build/cgit
+GEN=$(pwd)/build/cgit-gen
+MEASURE=$(pwd)/build/cgit-measure
+E2E_DIR=${E2E_DIR:-$(pwd)/build}
+E2E_JSON=${E2E_JSON:-$(pwd)/build/e2e.json}
+SYSCALLS=${SYSCALLS:-1}
+REVISION=$(git rev-parse --short HEAD 2>/dev/null)
+GEN_ALL="--files $FILES --churn $CHURN $GEN_OPTIONS"
+
+for tool in "$CGIT" "$GEN" "$MEASURE"
+do
+    [ -x "$tool" ] || { echo "$tool is missing, run make e2e-tools"; exit 1; }
+done
+
+WORK=$(mktemp -d -p "$E2E_DIR" e2e.XXXXXX) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+# run LABEL COMMAND [ARGS], measured when the label is not empty
+run() {
+    name=$1
+    shift
+    if [ -z "$name" ]
+    then
+        "$@" > /dev/null || { echo "FAIL: $*"; exit 1; }
+    else
+        $MEASURE $TRACE --label "$name" --output "$RESULTS" -- "$@" > /dev/null || { echo "FAIL: $name"; exit 1; }
+    fi
+}
+
+# Checking out a directory whose files were all renamed must keep them: the
+# removal of the old files once emptied the directory of the new ones
+check_checkout() {
+    rm -rf "$WORK/check"
+    mkdir -p "$WORK/check/d" && cd "$WORK/check" || exit 1
+    echo b > d/b
+    run "" $CGIT init
+    run "" $CGIT add .
+    run "" $CGIT commit -m b
+    run "" $CGIT branch other
+    rm d/b
+    echo a > d/a
+    run "" $CGIT add .
+    run "" $CGIT remove d/b
+    run "" $CGIT commit -m a
+    for branch in master other master
+    do
+        run "" $CGIT checkout $branch
+        [ -z "$($CGIT status -s)" ] || { echo "FAIL: checkout $branch left changes"; exit 1; }
+    done
+    cd "$E2E_DIR" || exit 1
+}
+
+# scenario RESULTS [--syscalls]
+scenario() {
+    RESULTS=$1
+    TRACE=$2
+    rm -rf "$WORK/repo"
+    $GEN init $GEN_ALL "$WORK/repo" || exit 1
+    cd "$WORK/repo" || exit 1
+
+    run init $CGIT init
+    run add $CGIT add .
+    run commit $CGIT commit -m "step 0"
+    FIRST=$(cat .cgit/refs/heads/master)
+
+    step=1
+    while [ $step -lt "$COMMITS" ]
+    do
+        deleted=$($GEN churn $GEN_ALL --step $step "$WORK/repo") || exit 1
+        # add does not stage deletions
+        [ -n "$deleted" ] && run "" $CGIT remove $deleted
+        # Only the last step is measured, the others build the history
+        label=""
+        [ $step -eq $((COMMITS - 1)) ] && label=incremental
+        run "${label:+add_}$label" $CGIT add .
+        run "${label:+commit_}$label" $CGIT commit -m "step $step"
+        step=$((step + 1))
+    done
+    LAST=$(cat .cgit/refs/heads/master)
+    [ -z "$($CGIT status -s)" ] || { echo "FAIL: the history does not hold the working tree"; exit 1; }
+
+    run log $CGIT log
+    run diff $CGIT diff "$FIRST" "$LAST"
+    run "" $CGIT branch side
+    run reset $CGIT reset "$FIRST"
+    run checkout $CGIT checkout master
+    cd "$E2E_DIR" || exit 1
+}
+
+check_checkout
+scenario "$WORK/timed.jsonl"
+: > "$WORK/traced.jsonl"
+[ "$SYSCALLS" = 1 ] && scenario "$WORK/traced.jsonl" --syscalls
+
+# Take the system calls of the traced run, everything else of the timed one
+awk -v traced="$WORK/traced.jsonl" -v revision="$REVISION" \
+    -v files="$FILES" -v commits="$COMMITS" -v churn="$CHURN" -v options="$GEN_OPTIONS" '
+function field(line, name,    rest) {
+    rest = substr(line, index(line, "\"" name "\": ") + length(name) + 4)
+    sub(/[,}].*/, "", rest)
+    gsub(/"/, "", rest)
+    return rest
+}
+BEGIN {
+    while ((getline line < traced) > 0)
+        syscalls[field(line, "label")] = field(line, "syscalls")
+    printf "%-20s %10s %10s %12s %12s %10s\n", "command", "wall ms", "rss MB", "written MB", "disk MB", "syscalls" > "/dev/stderr"
+    printf "{\n  \"suite\": \"e2e\",\n  \"revision\": \"%s\",\n", revision
+    printf "  \"files\": %d,\n  \"commits\": %d,\n  \"churn\": %s,\n  \"gen_options\": \"%s\",\n", files, commits, churn, options
+    printf "  \"results\": [\n"
+}
+{
+    label = field($0, "label")
+    count = label in syscalls ? syscalls[label] : "null"
+    line = $0
+    sub(/"syscalls": null/, "\"syscalls\": " count, line)
+    printf "%s    %s", (NR > 1 ? ",\n" : ""), line
+    printf "%-20s %10.1f %10.1f %12.2f %12.2f %10s\n", label, field($0, "wall_ns") / 1e6, field($0, "maxrss_kb") / 1024,
+        field($0, "wchar") / 1e6, field($0, "write_bytes") / 1e6, count > "/dev/stderr"
+}
+END {
+    printf "\n  ]\n}\n"
+}' "$WORK/timed.jsonl" > "$E2E_JSON"
@@ -0,0 +1,86 @@
+#!/bin/sh
+# Run scripted edits on a synthetic tree and check that status gives the same
+# answer with and without the fsmonitor daemon, then time status both ways
+# usage: bench/fsmonitor.sh [DIRS] [FILES_PER_DIR]
+# Run from the root of the repository after make
+
+DIRS=${1:-100}
+FILES=${2:-100}
+CGIT=$(pwd)/build/cgit
+WORK=$(mktemp -d)
+trap '$CGIT fsmonitor stop > /dev/null 2>&1; rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/repo"
+cd "$WORK/repo" || exit 1
+$CGIT init > /dev/null
+d=0
+while [ $d -lt "$DIRS" ]
+do
+    mkdir -p d$d/sub
+    f=0
+    while [ $f -lt "$FILES" ]
+    do
+        echo "$d $f" > d$d/sub/f$f
+        f=$((f + 1))
+    done
+    d=$((d + 1))
+done
+echo "*.log" > .gitignore
+$CGIT add . > /dev/null
+$CGIT commit -m init > /dev/null
+$CGIT fsmonitor start || exit 1
+$CGIT status -s > /dev/null
+
+failed=0
+# Compare with a copy of the index that has no fsmonitor token
+check() {
+    with=$($CGIT status -s)
+    cp .cgit/index "$WORK/index.fsmonitor"
+    $CGIT fsmonitor stop > /dev/null
+    without=$($CGIT status -s)
+    $CGIT fsmonitor start > /dev/null
+    cp "$WORK/index.fsmonitor" .cgit/index
+    if [ "$with" != "$without" ]
+    then
+        echo "FAIL: $1"
+        echo "$with" > "$WORK/with"
+        echo "$without" > "$WORK/without"
+        diff "$WORK/without" "$WORK/with"
+        failed=1
+    else
+        echo "ok: $1"
+    fi
+    # The restarted daemon does not know the token anymore
+    $CGIT status -s > /dev/null
+}
+
+echo edit >> d1/sub/f1;                 check "modify a tracked file"
+echo new > d2/sub/new;                  check "create an untracked file"
+mkdir -p d3/a/b; echo x > d3/a/b/c;     check "create nested directories"
+rm d4/sub/f4;                           check "delete a tracked file"
+mv d5 d5moved;                          check "move a directory"
+echo y >> d5moved/sub/f2;               check "modify a file in a moved directory"
+echo z > d6/sub/x.log;                  check "create an ignored file"
+echo "*.txt" > d7/.gitignore; echo t > d7/t.txt; check "add an ignore file"
+$CGIT add d2 > /dev/null;               check "stage a new file"
+rm -r d8;                               check "remove a directory"
+touch d9/sub/f9;                        check "touch a tracked file"
+
+# Mean time of a status over 10 runs
+time_status() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt 10 ]
+    do
+        $CGIT status -s > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    awk -v ns=$((end - start)) -v label="$1" 'BEGIN { printf "%-18s %8.2f ms\n", label, ns / 10 / 1e6 }'
+}
+
+time_status "with fsmonitor"
+$CGIT fsmonitor stop > /dev/null
+time_status "without fsmonitor"
+
+exit $failed
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/ptrace.h>
+
+// Run a command and record what it cost, see bench/e2e.sh.
+//
+// usage: cgit-measure [--syscalls] [--label NAME] [--output FILE] -- COMMAND [ARGS]
+//
+// The command keeps the standard streams of cgit-measure. One JSON line is
+// appended to FILE (stderr by default):
+// {"label", "status", "wall_ns", "user_ns", "sys_ns", "maxrss_kb",
+//  "wchar", "write_bytes", "syscw", "syscalls"}
+// wchar is what the command passed to write calls, write_bytes what reached
+// the storage layer, both read from /proc/<pid>/io before the command is
+// reaped, so that the threads and reaped children of the command are counted.
+//
+// With --syscalls the command and all its threads are traced with ptrace and
+// every system call entry is counted. Tracing slows the command down a lot, so
+// the other figures of a traced run are not meaningful and syscalls is null
+// for the runs that are not traced.
+
+struct measure {
+    int status;
+    uint64_t wall_ns;
+    uint64_t user_ns;
+    uint64_t sys_ns;
+    long maxrss_kb;
+    long long wchar;
+    long long write_bytes;
+    long long syscw;
+    long long syscalls;
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t timeval_ns(struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+static void read_io(pid_t pid, struct measure *m)
+{
+    char path[64];
+    sprintf(path, "/proc/%d/io", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return;
+
+    char key[64];
+    long long value;
+    while (fscanf(file, "%63[^:]: %lld\n", key, &value) == 2)
+    {
+        if (strcmp(key, "wchar") == 0)
+            m->wchar = value;
+        else if (strcmp(key, "write_bytes") == 0)
+            m->write_bytes = value;
+        else if (strcmp(key, "syscw") == 0)
+            m->syscw = value;
+    }
+    fclose(file);
+}
+
+static int exit_status(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
+}
+
+/// @brief Resume every traced task until pid exits, counting system call entries
+static void count_syscalls(pid_t pid, struct measure *m)
+{
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE
+           | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    pid_t task;
+    while ((task = waitpid(-1, &status, __WALL)) > 0)
+    {
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            if (task == pid)
+                m->status = exit_status(status);
+            continue;
+        }
+
+        int sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80))
+        {
+            struct ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, task, sizeof(info), &info) > 0
+                && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+                m->syscalls++;
+            sig = 0;
+        } else if (sig == SIGTRAP || sig == SIGSTOP)
+        {
+            // Events of the tracer and the first stop of new tasks, not for the command
+            sig = 0;
+        }
+        ptrace(PTRACE_SYSCALL, task, 0, sig);
+    }
+}
+
+static void write_json(FILE *out, char *label, struct measure *m, int traced)
+{
+    fprintf(out, "{\"label\": \"%s\", \"status\": %d, \"wall_ns\": %llu, \"user_ns\": %llu, \"sys_ns\": %llu, "
+                 "\"maxrss_kb\": %ld, \"wchar\": %lld, \"write_bytes\": %lld, \"syscw\": %lld, \"syscalls\": ",
+            label, m->status, (unsigned long long)m->wall_ns, (unsigned long long)m->user_ns,
+            (unsigned long long)m->sys_ns, m->maxrss_kb, m->wchar, m->write_bytes, m->syscw);
+    if (traced)
+        fprintf(out, "%lld}\n", m->syscalls);
+    else
+        fprintf(out, "null}\n");
+}
+
+static int usage()
+{
+    fprintf(stderr, "usage: cgit-measure [--syscalls] [--label NAME] [--output FILE] -- COMMAND [ARGS]\n");
+    return 129;
+}
+
+int main(int argc, char **argv)
+{
+    int traced = 0;
+    char *label = NULL;
+    char *output = NULL;
+
+    int i = 1;
+    for (; i < argc && strcmp(argv[i], "--") != 0; i++)
+    {
+        if (strcmp(argv[i], "--syscalls") == 0)
+            traced = 1;
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc)
+            label = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else
+            return usage();
+    }
+    if (i + 1 >= argc)
+        return usage();
+    char **command = argv + i + 1;
+    if (label == NULL)
+        label = command[0];
+
+    struct measure m = {0};
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("cgit-measure: fork");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        if (traced)
+        {
+            ptrace(PTRACE_TRACEME, 0, 0, 0);
+            raise(SIGSTOP);
+        }
+        execvp(command[0], command);
+        perror("cgit-measure: exec");
+        _exit(127);
+    }
+
+    if (traced)
+    {
+        count_syscalls(pid, &m);
+        m.wall_ns = now_ns() - start;
+    } else
+    {
+        // Leave the command unreaped to read its counters
+        siginfo_t info;
+        while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR)
+            ;
+        m.wall_ns = now_ns() - start;
+        read_io(pid, &m);
+
+        int status;
+        struct rusage usage;
+        wait4(pid, &status, 0, &usage);
+        m.status = exit_status(status);
+        m.user_ns = timeval_ns(&usage.ru_utime);
+        m.sys_ns = timeval_ns(&usage.ru_stime);
+        m.maxrss_kb = usage.ru_maxrss;
+    }
+
+    FILE *out = stderr;
+    if (output != NULL && (out = fopen(output, "a")) == NULL)
+    {
+        perror("cgit-measure: output");
+        return 1;
+    }
+    write_json(out, label, &m, traced);
+    if (out != stderr)
+        fclose(out);
+
+    return m.status;
+}
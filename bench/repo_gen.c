@@ -0,0 +1,309 @@
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Generator of synthetic working trees, see bench/e2e.sh.
+//
+// usage: cgit-gen init [OPTIONS] DIR
+//        cgit-gen churn [OPTIONS] --step N DIR
+//
+// init writes --files files in DIR. File i is placed at a depth between 0 and
+// --depth, each level being one of --fanout directories, and has a size drawn
+// log-uniformly between --min-size and --max-size. Content is lines of words,
+// compressible like source code.
+//
+// churn applies step N of the history: --churn percent of the files of DIR are
+// touched, 70% of the changes rewrite a file, 15% add one and 15% delete one.
+// The paths of the deleted files are printed, relative to DIR, one per line.
+//
+// Everything is derived from --seed, the file index and the step, so the same
+// options always give the same trees.
+
+#define DEFAULT_FILES 1000
+#define DEFAULT_DEPTH 3
+#define DEFAULT_FANOUT 8
+#define DEFAULT_MIN_SIZE 64
+#define DEFAULT_MAX_SIZE 65536
+#define DEFAULT_SEED 42
+#define DEFAULT_CHURN 1.0
+
+#define GEN_PATH_MAX 4096
+// A step adds less than 1 << STEP_INDEX_BITS files
+#define STEP_INDEX_BITS 24
+#define REPO_DIR ".cgit"
+
+struct gen_options {
+    size_t files;
+    int depth;
+    int fanout;
+    size_t min_size;
+    size_t max_size;
+    uint64_t seed;
+    double churn;
+    long step;
+};
+
+struct file_list {
+    char **paths;
+    size_t size;
+    size_t capacity;
+};
+
+static char *words[] = {
+    "static", "int", "return", "struct", "if", "else", "for", "while", "size_t",
+    "char", "void", "const", "tree", "entry", "object", "checksum", "index",
+    "result", "buffer", "=", "==", "!=", "+", "(", ")", "{", "}", ";", "0", "1",
+};
+
+static uint64_t splitmix(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int make_parents(char *path)
+{
+    for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        int res = mkdir(path, 0755);
+        *p = '/';
+        if (res != 0 && errno != EEXIST)
+            return -1;
+    }
+    return 0;
+}
+
+/// @brief Write size bytes of text drawn from state to path
+static int write_text(char *path, size_t size, uint64_t *state)
+{
+    if (make_parents(path) != 0)
+        return -1;
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+
+    size_t written = 0;
+    size_t line = 0;
+    while (written < size)
+    {
+        char *word = words[splitmix(state) % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        if (len > size - written)
+            len = size - written;
+        fwrite(word, 1, len, file);
+        written += len;
+        line += len + 1;
+        if (written < size)
+        {
+            fputc(line > 60 ? '\n' : ' ', file);
+            written++;
+        }
+        if (line > 60)
+            line = 0;
+    }
+
+    return fclose(file);
+}
+
+static size_t draw_size(struct gen_options *options, uint64_t *state)
+{
+    double min = log((double)options->min_size);
+    double max = log((double)options->max_size);
+    double x = (double)(splitmix(state) >> 11) / (double)(1ULL << 53);
+    return (size_t)exp(min + (max - min) * x);
+}
+
+/// @brief Path and content of file index, written under dir
+static int write_file(char *dir, size_t index, struct gen_options *options)
+{
+    uint64_t state = options->seed ^ (index * 0x100000001b3ULL);
+
+    char path[GEN_PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s", dir);
+    int depth = splitmix(&state) % (options->depth + 1);
+    for (int i = 0; i < depth; i++)
+        len += snprintf(path + len, sizeof(path) - len, "/d%llu", (unsigned long long)(splitmix(&state) % options->fanout));
+    snprintf(path + len, sizeof(path) - len, "/f%zu.c", index);
+
+    return write_text(path, draw_size(options, &state), &state);
+}
+
+static void push_path(struct file_list *list, char *path)
+{
+    if (list->size == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        list->paths = realloc(list->paths, list->capacity * sizeof(char *));
+    }
+    list->paths[list->size++] = strdup(path);
+}
+
+static void list_files(char *dir, struct file_list *list)
+{
+    DIR *dp = opendir(dir);
+    if (dp == NULL)
+        return;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp)) != NULL)
+    {
+        if (strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0 || strcmp(ep->d_name, REPO_DIR) == 0)
+            continue;
+
+        char path[GEN_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, ep->d_name);
+        struct stat st;
+        if (lstat(path, &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            list_files(path, list);
+        else if (S_ISREG(st.st_mode))
+            push_path(list, path);
+    }
+    closedir(dp);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+static int generate(char *dir, struct gen_options *options)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return -1;
+
+    for (size_t i = 0; i < options->files; i++)
+    {
+        if (write_file(dir, i, options) != 0)
+        {
+            fprintf(stderr, "cgit-gen: cannot write file %zu in %s\n", i, dir);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int churn(char *dir, struct gen_options *options)
+{
+    struct file_list list = {0};
+    list_files(dir, &list);
+    // readdir order depends on the file system, the choices must not
+    qsort(list.paths, list.size, sizeof(char *), compare_paths);
+
+    uint64_t state = options->seed ^ ((uint64_t)options->step << 32);
+    size_t changes = (size_t)(list.size * options->churn / 100);
+    if (changes == 0)
+        changes = 1;
+
+    int result = 0;
+    for (size_t i = 0; i < changes && result == 0; i++)
+    {
+        unsigned kind = splitmix(&state) % 100;
+        if (kind >= 70 && kind < 85)
+        {
+            // Each step has its own range of indices for the files it adds
+            size_t index = options->files + ((size_t)options->step << STEP_INDEX_BITS) + i;
+            result = write_file(dir, index, options);
+            continue;
+        }
+        if (list.size == 0)
+            continue;
+
+        size_t pick = splitmix(&state) % list.size;
+        if (kind < 70)
+        {
+            result = write_text(list.paths[pick], draw_size(options, &state), &state);
+            continue;
+        }
+
+        result = unlink(list.paths[pick]);
+        if (result == 0)
+            printf("%s\n", list.paths[pick] + strlen(dir) + 1);
+        free(list.paths[pick]);
+        list.size--;
+        memmove(list.paths + pick, list.paths + pick + 1, (list.size - pick) * sizeof(char *));
+    }
+
+    for (size_t i = 0; i < list.size; i++)
+        free(list.paths[i]);
+    free(list.paths);
+
+    if (result != 0)
+        fprintf(stderr, "cgit-gen: cannot apply step %ld in %s\n", options->step, dir);
+    return result;
+}
+
+static int usage()
+{
+    printf("usage: cgit-gen init [OPTIONS] DIR\n");
+    printf("       cgit-gen churn [OPTIONS] --step N DIR\n");
+    printf("options: --files N (%d) --depth N (%d) --fanout N (%d)\n", DEFAULT_FILES, DEFAULT_DEPTH, DEFAULT_FANOUT);
+    printf("         --min-size BYTES (%d) --max-size BYTES (%d)\n", DEFAULT_MIN_SIZE, DEFAULT_MAX_SIZE);
+    printf("         --seed N (%d) --churn PERCENT (%.1f)\n", DEFAULT_SEED, DEFAULT_CHURN);
+    return 129;
+}
+
+int main(int argc, char **argv)
+{
+    struct gen_options options = {
+        .files = DEFAULT_FILES,
+        .depth = DEFAULT_DEPTH,
+        .fanout = DEFAULT_FANOUT,
+        .min_size = DEFAULT_MIN_SIZE,
+        .max_size = DEFAULT_MAX_SIZE,
+        .seed = DEFAULT_SEED,
+        .churn = DEFAULT_CHURN,
+        .step = -1,
+    };
+
+    if (argc < 3)
+        return usage();
+    char *mode = argv[1];
+    char *dir = argv[argc - 1];
+
+    for (int i = 2; i < argc - 1; i++)
+    {
+        if (i + 1 >= argc - 1)
+            return usage();
+        char *value = argv[++i];
+        if (strcmp(argv[i - 1], "--files") == 0)
+            options.files = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "--depth") == 0)
+            options.depth = atoi(value);
+        else if (strcmp(argv[i - 1], "--fanout") == 0)
+            options.fanout = atoi(value);
+        else if (strcmp(argv[i - 1], "--min-size") == 0)
+            options.min_size = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "--max-size") == 0)
+            options.max_size = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "--seed") == 0)
+            options.seed = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "--churn") == 0)
+            options.churn = atof(value);
+        else if (strcmp(argv[i - 1], "--step") == 0)
+            options.step = atol(value);
+        else
+            return usage();
+    }
+
+    if (options.depth < 0 || options.fanout < 1 || options.min_size < 1 || options.max_size < options.min_size)
+        return usage();
+
+    if (strcmp(mode, "init") == 0)
+        return generate(dir, &options) == 0 ? 0 : 1;
+    if (strcmp(mode, "churn") == 0 && options.step >= 0)
+        return churn(dir, &options) == 0 ? 0 : 1;
+    return usage();
+}
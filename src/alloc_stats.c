@@ -0,0 +1,56 @@
+#ifdef DEBUG
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "includes.h"
+
+// Debug builds count the allocations of each command by interposing the
+// allocator, the counts are printed when the command exits.
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t malloc_count = 0;
+static size_t realloc_count = 0;
+static size_t free_count = 0;
+static size_t allocated_bytes = 0;
+
+void *malloc(size_t size)
+{
+    __atomic_add_fetch(&malloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocated_bytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&malloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocated_bytes, count * size, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&realloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocated_bytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL)
+        __atomic_add_fetch(&free_count, 1, __ATOMIC_RELAXED);
+    __libc_free(ptr);
+}
+
+__attribute__((destructor))
+static void print_alloc_stats()
+{
+    debug_print("%zu mallocs, %zu reallocs, %zu frees, %zu bytes allocated",
+                malloc_count, realloc_count, free_count, allocated_bytes);
+}
+
+#endif // DEBUG
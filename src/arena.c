@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define align(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+/// @brief Allocate size bytes that live until the arena is cleared or freed
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    size = align(size == 0 ? 1 : size);
+
+    struct arena_chunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->used + size > chunk->size)
+    {
+        // Allocations bigger than a chunk get a chunk of their own
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+        chunk->next = arena->chunks;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        arena->chunks = chunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+/// @brief Grow an allocation of the arena, in place when it is the last one
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size, size_t size)
+{
+    if (ptr == NULL)
+        return arena_alloc(arena, size);
+
+    if (ptr == arena->last)
+    {
+        struct arena_chunk *chunk = arena->chunks;
+        size_t offset = (unsigned char *)ptr - chunk->data;
+        if (offset + align(size) <= chunk->size)
+        {
+            chunk->used = offset + align(size);
+            return ptr;
+        }
+    }
+
+    void *result = arena_alloc(arena, size);
+    memcpy(result, ptr, old_size < size ? old_size : size);
+    return result;
+}
+
+/// @brief Copy len bytes of str in the arena, with a terminating '\0'
+char *arena_strndup(struct arena *arena, char *str, size_t len)
+{
+    char *result = arena_alloc(arena, len + 1);
+    memcpy(result, str, len);
+    result[len] = '\0';
+    return result;
+}
+
+/// @brief Release every allocation but keep the last chunk to be reused
+void clear_arena(struct arena *arena)
+{
+    if (arena->chunks == NULL)
+        return;
+
+    struct arena_chunk *chunk = arena->chunks->next;
+    while (chunk != NULL)
+    {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->chunks->next = NULL;
+    arena->chunks->used = 0;
+    arena->last = NULL;
+}
+
+void free_arena(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+    arena->last = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+
+#include <stddef.h>
+
+// An arena hands out memory from large chunks and releases all of it at once,
+// individual allocations are never freed.
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t used;
+    size_t size;
+    _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+struct arena {
+    struct arena_chunk *chunks;
+    // Last allocation, it can be grown in place by arena_realloc
+    void *last;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size, size_t size);
+char *arena_strndup(struct arena *arena, char *str, size_t len);
+void clear_arena(struct arena *arena);
+void free_arena(struct arena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_tree.h"
+#include "includes.h"
+
+void init_cache_tree(cache_tree_t *tree, char *name, size_t name_len)
+{
+    memset(tree, 0, sizeof(cache_tree_t));
+    tree->name = malloc(name_len + 1);
+    memcpy(tree->name, name, name_len);
+    tree->name[name_len] = '\0';
+    tree->entry_count = -1;
+}
+
+/// @brief Free the content of tree and of its subtrees, but not tree itself
+void free_cache_tree(cache_tree_t *tree)
+{
+    for (size_t i = 0; i < tree->subtrees_size; i++)
+        free_cache_tree(&tree->subtrees[i]);
+
+    free(tree->subtrees);
+    free(tree->name);
+    memset(tree, 0, sizeof(cache_tree_t));
+}
+
+cache_tree_t *find_cache_subtree(cache_tree_t *tree, char *name, size_t name_len)
+{
+    for (size_t i = 0; i < tree->subtrees_size; i++)
+    {
+        cache_tree_t *subtree = &tree->subtrees[i];
+        if (subtree->name != NULL && strncmp(subtree->name, name, name_len) == 0 && subtree->name[name_len] == '\0')
+            return subtree;
+    }
+
+    return NULL;
+}
+
+/// @brief Mark tree and the directories leading to path as changed
+/// When path is a directory it is invalidated as well
+void invalidate_cache_tree(cache_tree_t *tree, char *path)
+{
+    while (tree != NULL)
+    {
+        tree->entry_count = -1;
+        if (*path == '\0')
+            break;
+
+        char *slash = strchr(path, '/');
+        size_t name_len = slash == NULL ? strlen(path) : (size_t)(slash - path);
+        tree = find_cache_subtree(tree, path, name_len);
+        path += slash == NULL ? name_len : name_len + 1;
+    }
+}
+
+static int read_cache_node(cache_tree_t *tree, unsigned char **ptr, unsigned char *end)
+{
+    unsigned char *name_end = memchr(*ptr, '\0', end - *ptr);
+    if (name_end == NULL)
+        return -1;
+    init_cache_tree(tree, (char *)*ptr, name_end - *ptr);
+
+    unsigned char *line_end = memchr(name_end, '\n', end - name_end);
+    if (line_end == NULL)
+        return -1;
+
+    char line[32];
+    size_t line_len = line_end - name_end - 1;
+    if (line_len >= sizeof(line))
+        return -1;
+    memcpy(line, name_end + 1, line_len);
+    line[line_len] = '\0';
+
+    int entry_count;
+    size_t subtrees_size;
+    if (sscanf(line, "%d %zu", &entry_count, &subtrees_size) != 2)
+        return -1;
+    *ptr = line_end + 1;
+
+    tree->entry_count = entry_count;
+    if (entry_count >= 0)
+    {
+        if (*ptr + DIGEST_LENGTH > end)
+            return -1;
+        memcpy(tree->checksum, *ptr, DIGEST_LENGTH);
+        *ptr += DIGEST_LENGTH;
+    }
+
+    if (subtrees_size > (size_t)(end - *ptr))
+        return -1;
+    tree->subtrees = calloc(subtrees_size, sizeof(cache_tree_t));
+    for (size_t i = 0; i < subtrees_size; i++)
+    {
+        tree->subtrees_size++;
+        if (read_cache_node(&tree->subtrees[i], ptr, end) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/// @brief Parse the data of the cache tree extension of the index
+/// @return 0 on success, -1 if the data is malformed
+int read_cache_tree(cache_tree_t *tree, unsigned char *data, size_t size)
+{
+    unsigned char *ptr = data;
+    if (read_cache_node(tree, &ptr, data + size) != 0 || ptr != data + size)
+    {
+        free_cache_tree(tree);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void append_data(unsigned char **data, size_t *size, size_t *capacity, void *src, size_t len)
+{
+    if (*size + len > *capacity)
+    {
+        while (*size + len > *capacity)
+            *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        *data = realloc(*data, *capacity);
+    }
+
+    memcpy(*data + *size, src, len);
+    *size += len;
+}
+
+/// @brief Serialize tree as the data of the cache tree extension, appended to data
+void write_cache_tree(cache_tree_t *tree, unsigned char **data, size_t *size, size_t *capacity)
+{
+    char line[32];
+    int line_len = sprintf(line, "%d %zu\n", tree->entry_count, tree->subtrees_size);
+    append_data(data, size, capacity, tree->name, strlen(tree->name) + 1);
+    append_data(data, size, capacity, line, line_len);
+    if (tree->entry_count >= 0)
+        append_data(data, size, capacity, tree->checksum, DIGEST_LENGTH);
+
+    for (size_t i = 0; i < tree->subtrees_size; i++)
+        write_cache_tree(&tree->subtrees[i], data, size, capacity);
+}
@@ -0,0 +1,39 @@
+#ifndef CACHE_TREE_H
+#define CACHE_TREE_H 1
+
+#include <stddef.h>
+
+#include "includes.h"
+
+// The cache tree records the tree object of each directory of the index, so
+// that a commit only writes the trees of the directories that changed.
+//
+// It is stored in the index as the "TREE" extension, each node following the
+// format
+// name + '\0' + entry count (ASCII) + ' ' + subtrees count (ASCII) + '\n'
+// checksum (DIGEST_LENGTH bytes), only when the entry count is not negative
+// subtree1
+// subtree2
+// ...
+// The root has an empty name. An entry count of -1 means the directory
+// changed since its tree was written.
+
+#define CACHE_TREE_SIGNATURE "TREE"
+
+typedef struct cache_tree {
+    char *name;
+    // Number of index entries under the directory, -1 when invalid
+    int entry_count;
+    unsigned char checksum[DIGEST_LENGTH];
+    size_t subtrees_size;
+    struct cache_tree *subtrees;
+} cache_tree_t;
+
+void init_cache_tree(cache_tree_t *tree, char *name, size_t name_len);
+void free_cache_tree(cache_tree_t *tree);
+void invalidate_cache_tree(cache_tree_t *tree, char *path);
+cache_tree_t *find_cache_subtree(cache_tree_t *tree, char *name, size_t name_len);
+int read_cache_tree(cache_tree_t *tree, unsigned char *data, size_t size);
+void write_cache_tree(cache_tree_t *tree, unsigned char **data, size_t *size, size_t *capacity);
+
+#endif // CACHE_TREE_H
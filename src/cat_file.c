@@ -0,0 +1,144 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cat_file.h"
+#include "fs.h"
+#include "includes.h"
+#include "objects.h"
+#include "types.h"
+
+struct line_reader {
+    int fd;
+    char *buffer;
+    size_t start;
+    size_t end;
+    int eof;
+};
+
+struct batch_object {
+    char *checksum;
+    FILE *out;
+    // Whether the header line of the object was already written
+    int started;
+};
+
+/// @brief Return the next line of input without its '\n', NULL at the end of input
+/// A line longer than the buffer is cut into several lines
+/// @param out flushed before waiting for more input
+static char *next_line(struct line_reader *reader, FILE *out)
+{
+    while (1)
+    {
+        char *line = reader->buffer + reader->start;
+        char *newline = memchr(line, '\n', reader->end - reader->start);
+        if (newline != NULL)
+        {
+            *newline = '\0';
+            reader->start = newline - reader->buffer + 1;
+            return line;
+        }
+
+        size_t left = reader->end - reader->start;
+        if (reader->eof || left == CAT_FILE_BUFFER_SIZE - 1)
+        {
+            if (left == 0)
+                return NULL;
+            reader->buffer[reader->end] = '\0';
+            reader->start = reader->end;
+            return line;
+        }
+
+        memmove(reader->buffer, line, left);
+        reader->start = 0;
+        reader->end = left;
+
+        fflush(out);
+        ssize_t n = read(reader->fd, reader->buffer + reader->end, CAT_FILE_BUFFER_SIZE - 1 - reader->end);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            reader->eof = 1;
+        else
+            reader->end += n;
+    }
+}
+
+static void write_object_header(struct batch_object *batch, object_t *header)
+{
+    fprintf(batch->out, "%s %s %zu\n", batch->checksum, object_type_to_str(header->object_type), header->size);
+    batch->started = 1;
+}
+
+static int write_object_chunk(object_t *header, char *chunk, size_t chunk_size, void *data)
+{
+    struct batch_object *batch = data;
+    if (!batch->started)
+        write_object_header(batch, header);
+
+    fwrite(chunk, 1, chunk_size, batch->out);
+    return 0;
+}
+
+static int batch_object(int mode, char *checksum, FILE *out)
+{
+    struct batch_object batch = {.checksum = checksum, .out = out};
+    object_t header = {0};
+    int res;
+
+    if (mode == CAT_FILE_BATCH_CHECK)
+    {
+        res = read_object_info(checksum, &header);
+        if (res == FS_OK)
+            write_object_header(&batch, &header);
+    } else
+    {
+        res = stream_object(checksum, write_object_chunk, &batch);
+        // An empty object never reaches the callback
+        if (res == FS_OK && !batch.started)
+        {
+            res = read_object_info(checksum, &header);
+            if (res == FS_OK)
+                write_object_header(&batch, &header);
+        }
+        if (res == FS_OK)
+            fputc('\n', out);
+    }
+
+    if (res == OBJECT_DOES_NOT_EXIST)
+    {
+        fprintf(out, "%s missing\n", checksum);
+        return FS_OK;
+    }
+    return res;
+}
+
+/// @brief Answer every object checksum read from in, see cat_file.h
+/// @param mode CAT_FILE_BATCH or CAT_FILE_BATCH_CHECK
+int cat_file_batch(int mode, int in, FILE *out)
+{
+    if (!local_repo_exist())
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+
+    // Nothing was written to out yet, its buffer can still be replaced
+    static char out_buffer[CAT_FILE_BUFFER_SIZE];
+    setvbuf(out, out_buffer, _IOFBF, CAT_FILE_BUFFER_SIZE);
+
+    struct line_reader reader = {.fd = in};
+    reader.buffer = malloc(CAT_FILE_BUFFER_SIZE);
+
+    int result = FS_OK;
+    char *line;
+    // The caller reports a failure
+    while (result == FS_OK && (line = next_line(&reader, out)) != NULL)
+        result = batch_object(mode, line, out);
+
+    fflush(out);
+    free(reader.buffer);
+
+    return result;
+}
@@ -0,0 +1,25 @@
+#ifndef CAT_FILE_H
+#define CAT_FILE_H 1
+
+#include <stdio.h>
+
+// Batch mode reads one object checksum (hexadecimal) per line and writes, for
+// each of them
+// checksum + ' ' + type + ' ' + size + '\n'
+// followed, with CAT_FILE_BATCH only, by the raw content of the object + '\n'.
+// An object that cannot be found is answered by
+// checksum + " missing\n"
+//
+// Answers are buffered, the output is only flushed when more input has to be
+// waited for, so that a process driving cgit one object at a time still gets
+// each answer before sending the next request.
+
+#define CAT_FILE_BATCH 0
+#define CAT_FILE_BATCH_CHECK 1
+
+// Size of the input and output buffers
+#define CAT_FILE_BUFFER_SIZE 65536
+
+int cat_file_batch(int mode, int in, FILE *out);
+
+#endif // CAT_FILE_H
@@ -0,0 +1,390 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "checkout.h"
+#include "fs.h"
+#include "includes.h"
+#include "index.h"
+#include "objects.h"
+#include "tree.h"
+#include "types.h"
+#include "workqueue.h"
+
+/// @brief Remove path and everything under it
+static void remove_path(char *path)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0)
+        return;
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dp = opendir(path);
+        if (dp != NULL)
+        {
+            struct dirent *ep;
+            while ((ep = readdir(dp)) != NULL)
+            {
+                if (strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0)
+                    continue;
+
+                char child[strlen(path) + strlen(ep->d_name) + 2];
+                sprintf(child, "%s/%s", path, ep->d_name);
+                remove_path(child);
+            }
+            closedir(dp);
+        }
+        rmdir(path);
+    } else
+    {
+        unlink(path);
+    }
+}
+
+/// @brief Create the directories leading to path, the tracked files in the way
+/// must have been removed already
+static int create_leading_dirs(char *path)
+{
+    char dir[strlen(path) + 1];
+    strcpy(dir, path);
+
+    for (char *slash = strchr(dir, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        struct stat st;
+        if (lstat(dir, &st) == 0 && !S_ISDIR(st.st_mode))
+        {
+            error_print("%s is in the way of %s", dir, path);
+            return FS_ERROR;
+        }
+        if (mkdir(dir, DEFAULT_DIR_MODE) != 0 && errno != EEXIST)
+        {
+            error_print("Could not create directory %s", dir);
+            return FS_ERROR;
+        }
+        *slash = '/';
+    }
+
+    return FS_OK;
+}
+
+/// @brief Remove a file of the working tree and its parent directories once they are empty
+static void remove_file(char *path)
+{
+    if (unlink(path) != 0)
+        return;
+
+    char dir[strlen(path) + 1];
+    strcpy(dir, path);
+    char *slash;
+    while ((slash = strrchr(dir, '/')) != NULL)
+    {
+        *slash = '\0';
+        if (rmdir(dir) != 0)
+            break;
+    }
+}
+
+static int write_chunk_to_fd(object_t *header, char *chunk, size_t chunk_size, void *data)
+{
+    int fd = *(int *)data;
+    while (chunk_size > 0)
+    {
+        ssize_t written = write(fd, chunk, chunk_size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        chunk += written;
+        chunk_size -= written;
+    }
+
+    return 0;
+}
+
+/// @brief Make room for entry in the working tree: remove what is at its path
+/// and create its leading directories. Done in path order before the files
+/// are written, so that the workers never touch the same directory. What is
+/// at the path was checked by find_untracked_in_the_way to be tracked by the
+/// index, or a directory holding only ignored files
+static int prepare_entry_path(entry_t *entry)
+{
+    remove_path(entry->filename);
+    if (create_leading_dirs(entry->filename) != FS_OK)
+        return FS_ERROR;
+
+    // The content of a submodule is not in this repository
+    if (entry->mode == GIT_LINK && mkdir(entry->filename, DEFAULT_DIR_MODE) != 0)
+        return FS_ERROR;
+
+    return FS_OK;
+}
+
+/// @brief Write the content of entry to the working tree, its path must be free
+/// The file is created with O_EXCL so that it never writes through a file or
+/// a symlink that appeared in the meantime
+/// @param st filled with the stat of the written file
+static int write_entry(entry_t *entry, struct stat *st)
+{
+    char checksum[DIGEST_LENGTH * 2 + 1];
+    hash_to_hexa(entry->checksum, checksum);
+
+    int res = FS_OK;
+    if (entry->mode == SYM_LINK)
+    {
+        object_t object = {0};
+        res = read_object(checksum, &object);
+        if (res != FS_OK)
+            return res;
+
+        char target[object.size + 1];
+        memcpy(target, object.content, object.size);
+        target[object.size] = '\0';
+        free_object(&object);
+        if (symlink(target, entry->filename) != 0)
+            return FS_ERROR;
+    } else if (entry->mode != GIT_LINK)
+    {
+        int fd = open(entry->filename, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      entry->mode == REG_EXE_FILE ? 0777 : 0666);
+        if (fd == -1)
+            return FS_ERROR;
+
+        res = stream_object(checksum, write_chunk_to_fd, &fd);
+        if (close(fd) != 0 && res == FS_OK)
+            res = FS_ERROR;
+        if (res != FS_OK)
+            return res;
+    }
+
+    return lstat(entry->filename, st) == 0 ? FS_OK : FS_ERROR;
+}
+
+/// @brief Whether the file of entry differs from the index, its content is
+/// hashed when only its stat data changed
+static int has_local_changes(index_t *index, entry_t *entry, struct stat *st)
+{
+    if (entry_is_clean(index, entry, st))
+        return 0;
+    if (entry->mode != mode_from_stat(st) || entry->mode == SYM_LINK)
+        return 1;
+
+    unsigned char checksum[DIGEST_LENGTH];
+    if (hash_blob_from_file(entry->filename, checksum) != FS_OK)
+        return 1;
+    return memcmp(checksum, entry->checksum, DIGEST_LENGTH) != 0;
+}
+
+static void count_untracked(char *path, void *data)
+{
+}
+
+/// @brief Whether writing entry would overwrite untracked content: a file in
+/// place of one of its leading directories or, when current does not track
+/// its path, a file or a directory holding untracked files at its path
+/// @param untracked set to the path of that content
+static int find_untracked_in_the_way(index_t *current, entry_t *entry, char *untracked)
+{
+    strcpy(untracked, entry->filename);
+    for (char *slash = strchr(untracked, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        struct stat st;
+        // A tracked file is not in the commit since a file is below it, it is removed
+        if (lstat(untracked, &st) == 0 && !S_ISDIR(st.st_mode) && find_entry(&current->entries, untracked) == NULL)
+            return 1;
+        *slash = '/';
+    }
+
+    struct stat st;
+    if (find_entry(&current->entries, untracked) != NULL || lstat(untracked, &st) != 0)
+        return 0;
+    if (!S_ISDIR(st.st_mode))
+        return 1;
+    // The tracked files below it are not in the commit either
+    return list_untracked_files(current, untracked, 1, count_untracked, NULL) > 0;
+}
+
+struct checkout_job {
+    entry_t *entry;
+    int result;
+    struct stat st;
+};
+
+static void checkout_job(struct workqueue *queue, int worker, void *arg)
+{
+    struct checkout_job *job = arg;
+    job->result = write_entry(job->entry, &job->st);
+}
+
+/// @brief Number of workers writing files, CHECKOUT_WORKERS_ENV or else the
+/// default number of threads
+int checkout_worker_count()
+{
+    char *env = getenv(CHECKOUT_WORKERS_ENV);
+    if (env != NULL && atoi(env) > 0)
+        return atoi(env);
+
+    return default_thread_count();
+}
+
+/// @brief Make the working tree and the index match a commit
+/// Only the files that differ between the index and the commit are written,
+/// the content of the others is not read. Every path is checked before the
+/// working tree is touched: the checkout stops with CHECKOUT_CONFLICT, and
+/// prints the paths, when it would lose local changes or untracked files. The
+/// removed files are deleted first, then the paths are prepared in order, then
+/// the files are inflated and written by a pool of workers, and the errors are
+/// reported in path order
+/// @param workers number of workers, see checkout_worker_count
+/// @param force discard the local changes to tracked files, which are written
+/// again even when the commit has the content of the index, deleted ones included
+int checkout_commit(char *commit_checksum, int workers, int force)
+{
+    index_t current = {0};
+    int res = load_index_locked(&current);
+    if (res != FS_OK)
+        return res;
+
+    index_t target = {0};
+    res = load_commit_index(commit_checksum, &target);
+    if (res != FS_OK)
+    {
+        free_index(&current);
+        return res;
+    }
+
+    struct checkout_job *jobs = NULL;
+    size_t jobs_size = 0, jobs_capacity = 0;
+    entry_t **removed = NULL;
+    size_t removed_size = 0;
+    size_t conflicts = 0;
+
+    sort_tree(&current.entries);
+    tree_t *a = &current.entries, *b = &target.entries;
+    size_t i = 0, j = 0;
+    while (res == FS_OK && (i < a->entries_size || j < b->entries_size))
+    {
+        int cmp;
+        if (i == a->entries_size)
+            cmp = 1;
+        else if (j == b->entries_size)
+            cmp = -1;
+        else
+            cmp = strcmp(a->entries[i].filename, b->entries[j].filename);
+
+        entry_t *old = cmp <= 0 ? &a->entries[i++] : NULL;
+        entry_t *new = cmp >= 0 ? &b->entries[j++] : NULL;
+        // A missing file has nothing to lose, the content of a submodule is not checked
+        struct stat st;
+        int exists = old != NULL && old->mode != GIT_LINK && lstat(old->filename, &st) == 0;
+        int dirty = exists && has_local_changes(&current, old, &st);
+        int missing = old != NULL && old->mode != GIT_LINK && !exists;
+
+        if (new == NULL)
+        {
+            if (dirty && !force)
+            {
+                printf("error: your local changes to %s would be lost, the file is removed by checkout\n", old->filename);
+                conflicts++;
+                continue;
+            }
+            removed = realloc(removed, (removed_size + 1) * sizeof(entry_t *));
+            removed[removed_size++] = old;
+            continue;
+        }
+        if (old != NULL && old->mode == new->mode && memcmp(old->checksum, new->checksum, DIGEST_LENGTH) == 0
+            && (!force || (!dirty && !missing)))
+        {
+            // The local changes are kept, the stat data tells they are there
+            new->stat = old->stat;
+            continue;
+        }
+
+        char untracked[strlen(new->filename) + 1];
+        if (dirty && !force)
+        {
+            printf("error: your local changes to %s would be overwritten by checkout\n", old->filename);
+            conflicts++;
+            continue;
+        }
+        if (find_untracked_in_the_way(&current, new, untracked))
+        {
+            printf("error: the untracked %s would be overwritten by checkout\n", untracked);
+            conflicts++;
+            continue;
+        }
+
+        if (jobs_size == jobs_capacity)
+        {
+            jobs_capacity = jobs_capacity == 0 ? 64 : jobs_capacity * 2;
+            jobs = realloc(jobs, jobs_capacity * sizeof(struct checkout_job));
+        }
+        jobs[jobs_size++] = (struct checkout_job) { .entry = new, .result = FS_OK };
+    }
+
+    if (conflicts > 0)
+        res = CHECKOUT_CONFLICT;
+
+    for (size_t k = 0; res == FS_OK && k < removed_size; k++)
+        remove_file(removed[k]->filename);
+
+    // Only once every removal is done: removing a file also removes its empty
+    // parents, which may be the directory just created for a pending job
+    for (size_t k = 0; res == FS_OK && k < jobs_size; k++)
+    {
+        res = prepare_entry_path(jobs[k].entry);
+        if (res != FS_OK)
+        {
+            error_print("Could not create %s", jobs[k].entry->filename);
+        }
+    }
+
+    if (res == FS_OK && jobs_size > 0)
+    {
+        struct workqueue queue;
+        init_workqueue(&queue, jobs_size < (size_t)workers ? (int)jobs_size : workers, NULL);
+        for (size_t k = 0; k < jobs_size; k++)
+            push_work(&queue, 0, checkout_job, &jobs[k]);
+        run_workqueue(&queue);
+        free_workqueue(&queue);
+
+        for (size_t k = 0; k < jobs_size; k++)
+        {
+            debug_print("Wrote %s", jobs[k].entry->filename);
+            if (jobs[k].result != FS_OK)
+            {
+                error_print("Could not write %s", jobs[k].entry->filename);
+                if (res == FS_OK)
+                    res = jobs[k].result;
+            } else
+            {
+                fill_stat_data(&jobs[k].entry->stat, &jobs[k].st);
+            }
+        }
+    }
+
+    if (res == FS_OK)
+    {
+        // The index is replaced by the one of the commit, under the same lock
+        target.locked = current.locked;
+        target.lock_fd = current.lock_fd;
+        current.locked = 0;
+        res = save_index(&target);
+    }
+
+    free(jobs);
+    free(removed);
+    free_index(&target);
+    free_index(&current);
+    return res;
+}
@@ -0,0 +1,25 @@
+#ifndef CHECKOUT_H
+#define CHECKOUT_H 1
+
+// Checkout writes the files of a commit to the working tree, starting from
+// the index: tracked files that already hold the content of the commit in the
+// index are left untouched, the others are written from the object store and
+// the files that are not in the commit are removed. The index is then replaced
+// by the files of the commit with their stat data.
+//
+// Local changes to a file that the commit changes, and untracked files in the
+// way of the commit, are never overwritten: the checkout is then refused
+// before anything is written. Local changes to a file that the commit does not
+// change are kept.
+//
+// The files are inflated and written by a pool of workers, their number is
+// read from CHECKOUT_WORKERS_ENV when it is set.
+
+#define CHECKOUT_WORKERS_ENV "CGIT_CHECKOUT_WORKERS"
+
+#define CHECKOUT_CONFLICT (-100)
+
+int checkout_worker_count();
+int checkout_commit(char *commit_checksum, int workers, int force);
+
+#endif // CHECKOUT_H
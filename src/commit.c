@@ -1,13 +1,20 @@
+#include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
+#include "arena.h"
 #include "commit.h"
+#include "diff.h"
 #include "fs.h"
+#include "fsmonitor.h"
+#include "ignore.h"
 #include "includes.h"
+#include "index.h"
 #include "objects.h"
 #include "tree.h"
 #include "types.h"
@@ -15,13 +22,27 @@
 #define parse_field(commit, ptr, field, k_ofs, v_ofs, endline) \
     if (strcmp(ptr + k_ofs, #field) == 0) \
     { \
-        commit->field = malloc(endline - v_ofs);\
-        commit->field[endline - v_ofs - 1] = '\0'; \
-        memcpy(commit->field, ptr + v_ofs + 1, endline - v_ofs - 1);\
+        commit->field = copy_field(commit, ptr + v_ofs + 1, endline - v_ofs - 1);\
     }
 
-int commit_from_object(commit_t *commit, object_t *object)
+static char *copy_field(commit_t *commit, char *value, size_t len)
 {
+    if (commit->arena != NULL)
+        return arena_strndup(commit->arena, value, len);
+
+    char *field = malloc(len + 1);
+    memcpy(field, value, len);
+    field[len] = '\0';
+    return field;
+}
+
+/// @brief Parse the fields of a commit object
+/// @param arena where to allocate the fields, they are then released with the
+/// arena instead of free_commit. NULL for the commit to own its memory
+int commit_from_object(commit_t *commit, object_t *object, struct arena *arena)
+{
+    commit->arena = arena;
+
     int i = 0;
     while (i < object->size)
     {
@@ -49,9 +70,7 @@ int commit_from_object(commit_t *commit, object_t *object)
     if(object->size - i > 0)
     {
         debug_print("There is a commit msg");
-        commit->message = malloc(object->size - i + 1);
-        commit->message[object->size - i] = '\0';
-        memcpy(commit->message, object->content + i, object->size - i);
+        commit->message = copy_field(commit, object->content + i, object->size - i);
     }
 
     return 0;
@@ -94,8 +113,53 @@ int commit_to_object(commit_t *commit, object_t *object)
     return 0;
 }
 
+/// @brief Length of the name in an identity "<name> <seconds since epoch> <timezone>",
+/// the whole identity for the commits written before it held a time
+size_t ident_name_length(char *ident)
+{
+    size_t len = strlen(ident);
+    char *timezone = ident + len;
+    while (timezone > ident && *timezone != ' ')
+        timezone--;
+    if (timezone == ident || (timezone[1] != '+' && timezone[1] != '-'))
+        return len;
+
+    char *seconds = timezone - 1;
+    while (seconds > ident && *seconds != ' ')
+        seconds--;
+    if (seconds == ident || seconds + 1 == timezone)
+        return len;
+    for (char *c = seconds + 1; c < timezone; c++)
+    {
+        if (*c < '0' || *c > '9')
+            return len;
+    }
+
+    return seconds - ident;
+}
+
+/// @brief Time of commit, read from its committer
+/// @return seconds since the epoch, 0 when the commit does not hold it
+time_t commit_time(commit_t *commit)
+{
+    char *ident = commit->committer != NULL ? commit->committer : commit->author;
+    if (ident == NULL)
+        return 0;
+
+    size_t name_len = ident_name_length(ident);
+    if (ident[name_len] == '\0')
+        return 0;
+    return strtoll(ident + name_len + 1, NULL, 10);
+}
+
 void free_commit(commit_t *commit)
 {
+    if (commit->arena != NULL)
+    {
+        memset(commit, 0, sizeof(commit_t));
+        return;
+    }
+
     if (commit->author != NULL)
         free(commit->author);
     
@@ -114,45 +178,49 @@ void free_commit(commit_t *commit)
 
 int commit(char *msg)
 {
-    tree_t index = {0};
-    if (load_index(&index) == REPO_NOT_INITIALIZED)
+    index_t index = {0};
+    int res = load_index_locked(&index);
+    if (res != FS_OK)
     {
-        return REPO_NOT_INITIALIZED;
+        return res;
+    }
+
+    // Only the files whose stat data changed since they were added are read
+    // again, and only the ones the fsmonitor saw changing when it runs
+    refresh_fsmonitor(&index);
+    res = refresh_index(&index);
+    if (res != FS_OK)
+    {
+        free_index(&index);
+        return res;
     }
 
     object_t last_commit = {0};
     commit_t commit = {0};
     char last_commit_checksum[DIGEST_LENGTH * 2 + 1] = {0};
-    tree_t commit_tree = {0};
     get_last_commit(&last_commit);
     if (last_commit.size != 0) {
         hash_object_str(&last_commit, last_commit_checksum);
-        commit_from_object(&commit, &last_commit);
-
-        object_t last_commit_tree = {0};
-        read_object(commit.tree, &last_commit_tree);
-        tree_from_object(&commit_tree, &last_commit_tree);
-        free_object(&last_commit_tree);
+        commit_from_object(&commit, &last_commit, NULL);
     }
     free_object(&last_commit);
 
-    entry_t *current = index.first_entry;
-    while(current != NULL)
-    {   
-        object_t object = {0};
-        blob_from_file(current->filename, &object);
-
-        add_object_to_tree(&commit_tree, current->filename, current->mode, &object);
-
-        free_object(&object);
-        current = current->next;
+    unsigned char tree_checksum[DIGEST_LENGTH];
+    res = write_index_tree(&index, tree_checksum);
+    if (res != FS_OK)
+    {
+        free_commit(&commit);
+        free_index(&index);
+        return res;
     }
 
     char* author = "Antonin";
-    commit.author = realloc(commit.author, strlen(author) + 1);
-    commit.committer = realloc(commit.committer, strlen(author) + 1);
-    sprintf(commit.author, "%s", author);
-    sprintf(commit.committer, "%s", author);
+    char ident[strlen(author) + 32];
+    sprintf(ident, "%s %lld +0000", author, (long long)time(NULL));
+    commit.author = realloc(commit.author, strlen(ident) + 1);
+    commit.committer = realloc(commit.committer, strlen(ident) + 1);
+    sprintf(commit.author, "%s", ident);
+    sprintf(commit.committer, "%s", ident);
     
     if (last_commit.size != 0)
     {
@@ -166,11 +234,8 @@ int commit(char *msg)
         sprintf(commit.message, "%s", msg);
     }
 
-    struct object commit_tree_obj = {0};
-    tree_to_object(&commit_tree, &commit_tree_obj);
     char *commit_tree_checksum = malloc(DIGEST_LENGTH * 2 + 1);
-    hash_object_str(&commit_tree_obj, commit_tree_checksum);
-    write_object(&commit_tree_obj);
+    hash_to_hexa(tree_checksum, commit_tree_checksum);
 
     if(commit.tree != NULL)
     {
@@ -188,105 +253,245 @@ int commit(char *msg)
 
     free_commit(&commit);
     free_object(&commit_obj);
-    free_tree(&commit_tree);
-    free_object(&commit_tree_obj);
-    free_tree(&index);
-    
-    memset(&index, 0, sizeof(struct tree));
+
+    // The index keeps describing the committed files, with their stat data
     save_index(&index);
+    free_index(&index);
+    return 0;
 }
 
-int diff_commit_with_working_tree(char *checksum, int for_print)
+/// @brief Print the diff of a blob against another blob or a file of the working tree
+/// @param checksum_a checksum of the first blob, NULL if it does not exist
+/// @param checksum_b checksum of the second blob, NULL to read path from the working tree
+/// @param b_exists whether there is something on the second side
+static int diff_file(unsigned char *checksum_a, unsigned char *checksum_b, int b_exists, char *path,
+                     struct diff_options *options, FILE *out)
 {
-    struct object commit_obj = {0};
-    if (read_object(checksum, &commit_obj) == OBJECT_DOES_NOT_EXIST)
+    object_t a = {0}, b = {0};
+    int res = FS_OK;
+    char hexa[DIGEST_LENGTH * 2 + 1];
+
+    if (checksum_a != NULL)
     {
-        return OBJECT_DOES_NOT_EXIST;
+        hash_to_hexa(checksum_a, hexa);
+        res = read_object(hexa, &a);
+    }
+    if (res == FS_OK && b_exists && checksum_b != NULL)
+    {
+        hash_to_hexa(checksum_b, hexa);
+        res = read_object(hexa, &b);
+    } else if (res == FS_OK && b_exists)
+    {
+        res = blob_from_file(path, &b);
     }
 
-    if (commit_obj.object_type != COMMIT)
-        return WRONG_OBJECT_TYPE;
+    if (res == FS_OK)
+    {
+        // An empty file may have no content buffer but still is a side of the diff
+        char *content_a = checksum_a == NULL ? NULL : a.content == NULL ? "" : a.content;
+        char *content_b = !b_exists ? NULL : b.content == NULL ? "" : b.content;
+        diff_buffers(content_a, a.size, content_b, b.size, path, path, options, out);
+    }
+
+    free_object(&a);
+    free_object(&b);
+    return res;
+}
+
+/// @brief List the files of the working tree that are not ignored, in the
+/// same order as the entries of an index
+static void list_working_tree(char *dirname, tree_t *files)
+{
+    DIR *dp = opendir(*dirname == '\0' ? "." : dirname);
+    if (dp == NULL)
+        return;
 
-    struct commit commit = {0};
-    commit_from_object(&commit, &commit_obj);
+    struct dirent *ep;
+    while ((ep = readdir(dp)) != NULL)
+    {
+        if (strcmp(ep->d_name, "..") == 0 || strcmp(ep->d_name, ".") == 0)
+            continue;
 
-    struct object obj = {0};
-    read_object(commit.tree, &obj);
+        char path[strlen(dirname) + strlen(ep->d_name) + 2];
+        if (*dirname == '\0')
+            sprintf(path, "%s", ep->d_name);
+        else
+            sprintf(path, "%s/%s", dirname, ep->d_name);
 
-    struct tree commit_tree = {0};
-    tree_from_object(&commit_tree, &obj);
+        struct stat st;
+        if (strcmp(path, LOCAL_REPO) == 0 || lstat(path, &st) != 0 || is_path_ignored(path, S_ISDIR(st.st_mode)))
+            continue;
 
-    remove_dir(TMP"/a");
-    create_dir(TMP"/a");
+        if (S_ISDIR(st.st_mode))
+        {
+            list_working_tree(path, files);
+        } else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))
+        {
+            unsigned char no_checksum[DIGEST_LENGTH] = {0};
+            append_entry_to_tree(files, no_checksum, BLOB, path, mode_from_stat(&st));
+        }
+    }
+    closedir(dp);
+    sort_tree(files);
+}
 
-    dump_tree(TMP"/a", &commit_tree);
+struct diff_context {
+    struct diff_options *options;
+    FILE *out;
+    // The second side of the changes is the working tree
+    int working_tree;
+};
+
+/// @brief Print a change reported by diff_trees or by the walk of the working tree
+/// Raw lines follow the format
+/// :<mode a> <mode b> <checksum a> <checksum b> <status>\t<path>
+/// with zeros for a missing side and for the checksums of the working tree
+static int print_change(char status, char *path, entry_t *a, entry_t *b, void *data)
+{
+    struct diff_context *context = data;
+    struct diff_options *options = context->options;
 
-#define DIFF_WT_BASE_CMD "diff -ru%s --exclude-from=.gitignore --color=%s "TMP"/a ./ > "LOCAL_REPO"/last.diff"
+    if ((a == NULL || b == NULL) && !options->new_files)
+        return FS_OK;
 
-    char cmd[strlen(DIFF_WT_BASE_CMD) + 8];
-    if (for_print)
+    if (options->output == DIFF_OUTPUT_NAME_STATUS)
+    {
+        fprintf(context->out, "%c\t%s\n", status, path);
+    } else if (options->output == DIFF_OUTPUT_RAW)
     {
-        sprintf(cmd, DIFF_WT_BASE_CMD, "N", "always");
-    } else 
+        char hexa_a[DIGEST_LENGTH * 2 + 1], hexa_b[DIGEST_LENGTH * 2 + 1];
+        memset(hexa_a, '0', DIGEST_LENGTH * 2);
+        memset(hexa_b, '0', DIGEST_LENGTH * 2);
+        hexa_a[DIGEST_LENGTH * 2] = hexa_b[DIGEST_LENGTH * 2] = '\0';
+        if (a != NULL)
+            hash_to_hexa(a->checksum, hexa_a);
+        if (b != NULL && !context->working_tree)
+            hash_to_hexa(b->checksum, hexa_b);
+
+        fprintf(context->out, ":%06o %06o %s %s %c\t%s\n", a == NULL ? 0 : a->mode, b == NULL ? 0 : b->mode,
+                hexa_a, hexa_b, status, path);
+    } else if ((a == NULL || a->type == BLOB) && (b == NULL || b->type == BLOB))
     {
-        sprintf(cmd, DIFF_WT_BASE_CMD, "", "never");
+        unsigned char *checksum_b = b == NULL || context->working_tree ? NULL : b->checksum;
+        return diff_file(a == NULL ? NULL : a->checksum, checksum_b, b != NULL, path, options, context->out);
     }
 
-    FILE *p = popen(cmd, "w");
-    pclose(p);
+    return FS_OK;
+}
 
-    free_tree(&commit_tree);
-    free_commit(&commit);
-    free_object(&obj);
-    free_object(&commit_obj);
+/// @brief Print the diff between a commit and the working tree
+/// Files whose stat data match a clean entry of the index holding the same
+/// content as the commit are not read
+int diff_commit_with_working_tree(char *checksum, struct diff_options *options, FILE *out)
+{
+    index_t commit_files = {0};
+    int res = load_commit_index(checksum, &commit_files);
+    if (res != FS_OK)
+        return res;
+
+    index_t index = {0};
+    int has_index = load_index(&index) == FS_OK;
+
+    tree_t files = {0};
+    list_working_tree("", &files);
+
+    struct diff_context context = { .options = options, .out = out, .working_tree = 1 };
+    tree_t *a = &commit_files.entries;
+    size_t i = 0, j = 0;
+    while (res == FS_OK && (i < a->entries_size || j < files.entries_size))
+    {
+        int cmp;
+        if (i == a->entries_size)
+            cmp = 1;
+        else if (j == files.entries_size)
+            cmp = -1;
+        else
+            cmp = strcmp(a->entries[i].filename, files.entries[j].filename);
+
+        entry_t *entry_a = cmp <= 0 ? &a->entries[i++] : NULL;
+        entry_t *entry_b = cmp >= 0 ? &files.entries[j++] : NULL;
+        if (entry_a == NULL)
+        {
+            res = print_change(DIFF_ADDED, entry_b->filename, NULL, entry_b, &context);
+            continue;
+        } else if (entry_b == NULL)
+        {
+            res = print_change(DIFF_DELETED, entry_a->filename, entry_a, NULL, &context);
+            continue;
+        }
+
+        entry_t *cached = has_index ? find_entry(&index.entries, entry_a->filename) : NULL;
+        struct stat st;
+        int clean = cached != NULL && memcmp(cached->checksum, entry_a->checksum, DIGEST_LENGTH) == 0
+            && lstat(entry_a->filename, &st) == 0 && entry_is_clean(&index, cached, &st);
+        if (clean)
+            continue;
+
+        // A patch is only printed when the content differs, the other outputs need to know it first
+        if (options->output != DIFF_OUTPUT_PATCH)
+        {
+            unsigned char file_checksum[DIGEST_LENGTH];
+            if (entry_a->mode == entry_b->mode && hash_blob_from_file(entry_a->filename, file_checksum) == FS_OK
+                && memcmp(file_checksum, entry_a->checksum, DIGEST_LENGTH) == 0)
+                continue;
+        }
+        res = print_change(DIFF_MODIFIED, entry_a->filename, entry_a, entry_b, &context);
+    }
+
+    free_tree(&files);
+    free_index(&index);
+    free_index(&commit_files);
+    return res;
+}
+
+/// @brief Read the tree of a commit
+/// @return FS_OK, OBJECT_DOES_NOT_EXIST, WRONG_OBJECT_TYPE, or FS_ERROR when it has no tree
+int get_commit_tree(char *checksum, unsigned char *tree_checksum)
+{
+    object_t object = {0};
+    int res = read_object(checksum, &object);
+    if (res != FS_OK)
+        return res;
+    if (object.object_type != COMMIT)
+    {
+        free_object(&object);
+        return WRONG_OBJECT_TYPE;
+    }
+
+    struct arena arena = {0};
+    commit_t commit = {0};
+    commit_from_object(&commit, &object, &arena);
+    if (commit.tree != NULL)
+    {
+        hexa_to_hash(commit.tree, tree_checksum);
+    } else
+    {
+        error_print("Commit %s has no tree", checksum);
+        res = FS_ERROR;
+    }
+
+    free_arena(&arena);
+    free_object(&object);
+    return res;
 }
 
-int diff_commit(char* checksum_a, char* checksum_b, int for_print)
+/// @brief Print the diff between two commits
+/// Their trees are compared by diff_trees, so only the changed files and
+/// directories are read
+int diff_commit(char* checksum_a, char* checksum_b, struct diff_options *options, FILE *out)
 {
-    struct object commit_a_obj = {0}, commit_b_obj = {0};
-    if (read_object(checksum_a, &commit_a_obj) == OBJECT_DOES_NOT_EXIST)
+    unsigned char tree_a[DIGEST_LENGTH], tree_b[DIGEST_LENGTH];
+    if (get_commit_tree(checksum_a, tree_a) != FS_OK)
     {
         errno = 1;
         return OBJECT_DOES_NOT_EXIST;
     }
-    if (read_object(checksum_b, &commit_b_obj) == OBJECT_DOES_NOT_EXIST)
+    if (get_commit_tree(checksum_b, tree_b) != FS_OK)
     {
-        free_object(&commit_a_obj);
         errno = 2;
         return OBJECT_DOES_NOT_EXIST;
     }
 
-    struct commit commit_a = {0}, commit_b = {0};
-    commit_from_object(&commit_a, &commit_a_obj);
-    commit_from_object(&commit_b, &commit_b_obj);
-    
-    struct object tree_a_obj, tree_b_obj;
-    read_object(commit_a.tree, &tree_a_obj);
-    read_object(commit_b.tree, &tree_b_obj);
-
-    struct tree tree_a, tree_b;
-    tree_from_object(&tree_a, &tree_a_obj);
-    tree_from_object(&tree_b, &tree_b_obj);
-
-    remove_dir(TMP"/a");
-    remove_dir(TMP"/b");
-
-    create_dir(TMP"/a");
-    create_dir(TMP"/b");
-
-    dump_tree(TMP"/a", &tree_a);
-    dump_tree(TMP"/b", &tree_b);
-
-    FILE *f = popen("diff -ruN "TMP"/a "TMP"/b --color=always> "LOCAL_REPO"/last.diff", "w");
-    pclose(f);
-
-    free_tree(&tree_a);
-    free_tree(&tree_b);
-    free_commit(&commit_a);
-    free_commit(&commit_b);
-    free_object(&tree_a_obj);
-    free_object(&tree_b_obj);
-    free_object(&commit_a_obj);
-    free_object(&commit_b_obj);
-    return 0;
-}
\ No newline at end of file
+    struct diff_context context = { .options = options, .out = out, .working_tree = 0 };
+    return diff_trees(tree_a, tree_b, print_change, &context);
+}
@@ -1,13 +1,20 @@
 #ifndef COMMIT_H
 #define COMMIT_H 1
 
+#include <stdio.h>
+#include <time.h>
+
+#include "diff.h"
 #include "types.h"
 
-int commit_from_object(commit_t *commit, object_t *object);
+int commit_from_object(commit_t *commit, object_t *object, struct arena *arena);
 int commit_to_object(commit_t *commit, object_t *object);
 void free_commit(commit_t *commit);
-int diff_commit(char* checksum_a, char* checksum_b, int for_print);
-int diff_commit_with_working_tree(char *checksum, int for_print);
+size_t ident_name_length(char *ident);
+time_t commit_time(commit_t *commit);
+int get_commit_tree(char *checksum, unsigned char *tree_checksum);
+int diff_commit(char* checksum_a, char* checksum_b, struct diff_options *options, FILE *out);
+int diff_commit_with_working_tree(char *checksum, struct diff_options *options, FILE *out);
 int commit(char *msg);
 
 #endif // COMMIT_H
\ No newline at end of file
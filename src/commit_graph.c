@@ -0,0 +1,447 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "commit.h"
+#include "commit_graph.h"
+#include "fs.h"
+#include "includes.h"
+#include "objects.h"
+#include "refs.h"
+#include "types.h"
+#include "utils.h"
+
+/// @brief Map the commit graph of the repository
+/// @return FS_OK, FILE_NOT_FOUND when there is none or INVALID_COMMIT_GRAPH
+int load_commit_graph(struct commit_graph *graph)
+{
+    memset(graph, 0, sizeof(struct commit_graph));
+
+    int fd = open(COMMIT_GRAPH_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return FILE_NOT_FOUND;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return INVALID_COMMIT_GRAPH;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return FS_ERROR;
+
+    graph->map = map;
+    graph->size = st.st_size;
+    if (graph->size < COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE + DIGEST_LENGTH
+        || memcmp(graph->map, COMMIT_GRAPH_SIGNATURE, 4) != 0
+        || get_be32(graph->map + 4) != COMMIT_GRAPH_VERSION)
+        goto invalid;
+
+    graph->commits_count = get_be32(graph->map + 8);
+    size_t expected_size = COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE
+        + (size_t)graph->commits_count * (DIGEST_LENGTH + COMMIT_GRAPH_DATA_SIZE) + DIGEST_LENGTH;
+    if (graph->size != expected_size
+        || get_be32(graph->map + COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE - 4) != graph->commits_count)
+        goto invalid;
+
+    return FS_OK;
+
+invalid:
+    error_print("Invalid commit graph %s", COMMIT_GRAPH_FILE);
+    free_commit_graph(graph);
+    return INVALID_COMMIT_GRAPH;
+}
+
+void free_commit_graph(struct commit_graph *graph)
+{
+    if (graph->map != NULL)
+        munmap(graph->map, graph->size);
+    memset(graph, 0, sizeof(struct commit_graph));
+}
+
+static unsigned char *graph_checksums(struct commit_graph *graph)
+{
+    return graph->map + COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE;
+}
+
+/// @brief Look for a commit in the graph
+/// @return 1 and position set if it is in the graph, 0 otherwise
+int find_graph_commit(struct commit_graph *graph, unsigned char *checksum, uint32_t *position)
+{
+    if (graph == NULL || graph->map == NULL)
+        return 0;
+
+    unsigned char *fanout = graph->map + COMMIT_GRAPH_HEADER_SIZE;
+    unsigned char *checksums = graph_checksums(graph);
+
+    uint32_t low = checksum[0] == 0 ? 0 : get_be32(fanout + (checksum[0] - 1) * 4);
+    uint32_t high = get_be32(fanout + checksum[0] * 4);
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(checksum, checksums + (size_t)mid * DIGEST_LENGTH, DIGEST_LENGTH);
+        if (cmp == 0)
+        {
+            *position = mid;
+            return 1;
+        }
+
+        if (cmp < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return 0;
+}
+
+void get_graph_commit(struct commit_graph *graph, uint32_t position, struct commit_info *info)
+{
+    unsigned char *checksums = graph_checksums(graph);
+    unsigned char *data = checksums + (size_t)graph->commits_count * DIGEST_LENGTH
+        + (size_t)position * COMMIT_GRAPH_DATA_SIZE;
+
+    memcpy(info->checksum, checksums + (size_t)position * DIGEST_LENGTH, DIGEST_LENGTH);
+    memcpy(info->tree, data, DIGEST_LENGTH);
+
+    uint32_t parent = get_be32(data + DIGEST_LENGTH);
+    info->has_parent = parent != COMMIT_GRAPH_NO_PARENT && parent < graph->commits_count;
+    if (info->has_parent)
+        memcpy(info->parent, checksums + (size_t)parent * DIGEST_LENGTH, DIGEST_LENGTH);
+
+    info->generation = get_be32(data + DIGEST_LENGTH + 4);
+    info->time = get_be64(data + DIGEST_LENGTH + 8);
+}
+
+/// @brief Get a commit from the graph, or else read it from its object
+/// @param graph may be NULL or not loaded, the commit is then always read
+int lookup_commit_info(struct commit_graph *graph, unsigned char *checksum, struct commit_info *info)
+{
+    uint32_t position;
+    if (find_graph_commit(graph, checksum, &position))
+    {
+        get_graph_commit(graph, position, info);
+        return FS_OK;
+    }
+
+    char hexa[DIGEST_LENGTH * 2 + 1];
+    hash_to_hexa(checksum, hexa);
+    object_t object = {0};
+    int res = read_object(hexa, &object);
+    if (res != FS_OK)
+        return res;
+
+    if (object.object_type != COMMIT)
+    {
+        free_object(&object);
+        return WRONG_OBJECT_TYPE;
+    }
+
+    struct arena arena = {0};
+    commit_t commit = {0};
+    commit_from_object(&commit, &object, &arena);
+
+    memset(info, 0, sizeof(struct commit_info));
+    memcpy(info->checksum, checksum, DIGEST_LENGTH);
+    if (commit.tree != NULL)
+        hexa_to_hash(commit.tree, info->tree);
+    info->has_parent = commit.parent != NULL && hexa_to_hash(commit.parent, info->parent) == 0;
+    info->time = commit_time(&commit);
+
+    free_arena(&arena);
+    free_object(&object);
+    return FS_OK;
+}
+
+struct graph_writer {
+    struct commit_graph *old_graph;
+    struct commit_info *commits;
+    size_t commits_size;
+    size_t commits_capacity;
+    // Open addressing table of the positions in commits plus one, 0 when empty
+    size_t *table;
+    size_t table_size;
+};
+
+static size_t commit_slot(struct graph_writer *writer, unsigned char *checksum)
+{
+    size_t slot = get_be32(checksum) & (writer->table_size - 1);
+    while (writer->table[slot] != 0
+           && memcmp(writer->commits[writer->table[slot] - 1].checksum, checksum, DIGEST_LENGTH) != 0)
+        slot = (slot + 1) & (writer->table_size - 1);
+
+    return slot;
+}
+
+static void add_graph_commit(struct graph_writer *writer, struct commit_info *info)
+{
+    if (writer->commits_size == writer->commits_capacity)
+    {
+        writer->commits_capacity = writer->commits_capacity == 0 ? 256 : writer->commits_capacity * 2;
+        writer->commits = realloc(writer->commits, writer->commits_capacity * sizeof(struct commit_info));
+
+        // The table stays at most half full
+        free(writer->table);
+        writer->table_size = writer->commits_capacity * 2;
+        writer->table = calloc(writer->table_size, sizeof(size_t));
+        for (size_t i = 0; i < writer->commits_size; i++)
+            writer->table[commit_slot(writer, writer->commits[i].checksum)] = i + 1;
+    }
+
+    writer->commits[writer->commits_size++] = *info;
+    writer->table[commit_slot(writer, info->checksum)] = writer->commits_size;
+}
+
+/// @brief Add checksum and its ancestors until one that is already known.
+/// The commits of the previous graph are taken from it without being read
+static int add_commit_chain(struct graph_writer *writer, unsigned char *checksum)
+{
+    unsigned char current[DIGEST_LENGTH];
+    memcpy(current, checksum, DIGEST_LENGTH);
+
+    while (writer->table_size == 0 || writer->table[commit_slot(writer, current)] == 0)
+    {
+        struct commit_info info;
+        int res = lookup_commit_info(writer->old_graph, current, &info);
+        if (res != FS_OK)
+            return res;
+
+        add_graph_commit(writer, &info);
+        if (!info.has_parent)
+            break;
+        memcpy(current, info.parent, DIGEST_LENGTH);
+    }
+
+    return FS_OK;
+}
+
+static int compare_commit_info(const void *a, const void *b)
+{
+    return memcmp(((struct commit_info *)a)->checksum, ((struct commit_info *)b)->checksum, DIGEST_LENGTH);
+}
+
+static int write_hashed(FILE *file, EVP_MD_CTX *ctx, void *data, size_t size)
+{
+    sha1_update(ctx, data, size);
+    return fwrite(data, 1, size, file) == size ? FS_OK : FS_ERROR;
+}
+
+static int write_graph_file(char *path, struct commit_info *commits, size_t count, uint32_t *parents)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return FS_ERROR;
+
+    int result = FS_OK;
+    EVP_MD_CTX *ctx = sha1_init();
+
+    unsigned char header[COMMIT_GRAPH_HEADER_SIZE];
+    memcpy(header, COMMIT_GRAPH_SIGNATURE, 4);
+    put_be32(header + 4, COMMIT_GRAPH_VERSION);
+    put_be32(header + 8, count);
+    result |= write_hashed(file, ctx, header, COMMIT_GRAPH_HEADER_SIZE);
+
+    unsigned char fanout[COMMIT_GRAPH_FANOUT_SIZE];
+    size_t j = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        while (j < count && commits[j].checksum[0] == i)
+            j++;
+        put_be32(fanout + i * 4, j);
+    }
+    result |= write_hashed(file, ctx, fanout, COMMIT_GRAPH_FANOUT_SIZE);
+
+    for (size_t i = 0; i < count; i++)
+        result |= write_hashed(file, ctx, commits[i].checksum, DIGEST_LENGTH);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned char data[COMMIT_GRAPH_DATA_SIZE];
+        memcpy(data, commits[i].tree, DIGEST_LENGTH);
+        put_be32(data + DIGEST_LENGTH, parents[i]);
+        put_be32(data + DIGEST_LENGTH + 4, commits[i].generation);
+        put_be64(data + DIGEST_LENGTH + 8, commits[i].time);
+        result |= write_hashed(file, ctx, data, COMMIT_GRAPH_DATA_SIZE);
+    }
+
+    unsigned char checksum[DIGEST_LENGTH];
+    sha1_final(ctx, checksum);
+    if (fwrite(checksum, 1, DIGEST_LENGTH, file) != DIGEST_LENGTH)
+        result = FS_ERROR;
+    if (fclose(file) != 0)
+        result = FS_ERROR;
+
+    return result != FS_OK ? FS_ERROR : FS_OK;
+}
+
+/// @brief Write the commit graph of the commits reachable from the branches
+/// Commits already in the previous graph are not read again
+/// @param commits_count set to the number of commits in the graph
+int write_commit_graph(size_t *commits_count)
+{
+    if (!local_repo_exist())
+        return REPO_NOT_INITIALIZED;
+
+    struct commit_graph old_graph;
+    struct graph_writer writer = {0};
+    if (load_commit_graph(&old_graph) == FS_OK)
+        writer.old_graph = &old_graph;
+
+    struct ref_table refs;
+    int res = load_refs(&refs);
+    for (size_t i = 0; res == FS_OK && i < refs.capacity; i++)
+    {
+        if (refs.refs[i].name == NULL)
+            continue;
+
+        unsigned char checksum[DIGEST_LENGTH];
+        if (hexa_to_hash(refs.refs[i].checksum, checksum) == 0)
+            res = add_commit_chain(&writer, checksum);
+    }
+    free_refs(&refs);
+    free_commit_graph(&old_graph);
+
+    size_t count = writer.commits_size;
+    struct commit_info *commits = writer.commits;
+    uint32_t *parents = malloc((count == 0 ? 1 : count) * sizeof(uint32_t));
+    if (res == FS_OK)
+    {
+        qsort(commits, count, sizeof(struct commit_info), compare_commit_info);
+        for (size_t i = 0; i < count; i++)
+        {
+            struct commit_info *parent = NULL;
+            if (commits[i].has_parent)
+                parent = bsearch(commits[i].parent, commits, count, sizeof(struct commit_info), compare_commit_info);
+            parents[i] = parent == NULL ? COMMIT_GRAPH_NO_PARENT : parent - commits;
+            commits[i].generation = 0;
+        }
+
+        // Generations are set from the oldest commit of each chain without one
+        uint32_t *chain = malloc((count == 0 ? 1 : count) * sizeof(uint32_t));
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t chain_size = 0;
+            uint32_t current = i;
+            while (current != COMMIT_GRAPH_NO_PARENT && commits[current].generation == 0)
+            {
+                chain[chain_size++] = current;
+                current = parents[current];
+            }
+
+            uint32_t generation = current == COMMIT_GRAPH_NO_PARENT ? 0 : commits[current].generation;
+            while (chain_size > 0)
+                commits[chain[--chain_size]].generation = ++generation;
+        }
+        free(chain);
+
+        mkdir(INFO_DIR, DEFAULT_DIR_MODE);
+        res = write_graph_file(COMMIT_GRAPH_LOCK_FILE, commits, count, parents);
+        if (res == FS_OK && rename(COMMIT_GRAPH_LOCK_FILE, COMMIT_GRAPH_FILE) != 0)
+            res = FS_ERROR;
+        if (res != FS_OK)
+            unlink(COMMIT_GRAPH_LOCK_FILE);
+    }
+
+    if (commits_count != NULL)
+        *commits_count = count;
+    free(parents);
+    free(writer.commits);
+    free(writer.table);
+    return res;
+}
+
+/// @brief Generation of a commit, the commits written after the graph are
+/// counted down to the first one that is in it
+static int commit_generation(struct commit_graph *graph, unsigned char *checksum, uint32_t *generation)
+{
+    unsigned char current[DIGEST_LENGTH];
+    memcpy(current, checksum, DIGEST_LENGTH);
+
+    uint32_t above = 0;
+    while (1)
+    {
+        struct commit_info info;
+        int res = lookup_commit_info(graph, current, &info);
+        if (res != FS_OK)
+            return res;
+
+        if (info.generation != 0)
+        {
+            *generation = info.generation + above;
+            return FS_OK;
+        }
+
+        above++;
+        if (!info.has_parent)
+        {
+            *generation = above;
+            return FS_OK;
+        }
+        memcpy(current, info.parent, DIGEST_LENGTH);
+    }
+}
+
+/// @brief Replace checksum by the one of its parent
+/// @return FS_OK, 1 for a root commit or an error
+static int step_to_parent(struct commit_graph *graph, unsigned char *checksum)
+{
+    struct commit_info info;
+    int res = lookup_commit_info(graph, checksum, &info);
+    if (res != FS_OK)
+        return res;
+    if (!info.has_parent)
+        return 1;
+
+    memcpy(checksum, info.parent, DIGEST_LENGTH);
+    return FS_OK;
+}
+
+/// @brief Find the most recent common ancestor of two commits
+/// The deeper commit first goes down to the generation of the other one, then
+/// both go down together, so only the commits between them and the base are
+/// visited
+/// @param graph may be NULL, the commits are then read from their objects
+/// @return 1 and base set if found, 0 if the commits have no common ancestor,
+/// or an error
+int merge_base(struct commit_graph *graph, unsigned char *checksum_a, unsigned char *checksum_b, unsigned char *base)
+{
+    uint32_t generation_a, generation_b;
+    int res = commit_generation(graph, checksum_a, &generation_a);
+    if (res == FS_OK)
+        res = commit_generation(graph, checksum_b, &generation_b);
+    if (res != FS_OK)
+        return res;
+
+    unsigned char a[DIGEST_LENGTH], b[DIGEST_LENGTH];
+    memcpy(a, checksum_a, DIGEST_LENGTH);
+    memcpy(b, checksum_b, DIGEST_LENGTH);
+
+    for (; res == FS_OK && generation_a > generation_b; generation_a--)
+        res = step_to_parent(graph, a);
+    for (; res == FS_OK && generation_b > generation_a; generation_b--)
+        res = step_to_parent(graph, b);
+
+    while (res == FS_OK && memcmp(a, b, DIGEST_LENGTH) != 0)
+    {
+        res = step_to_parent(graph, a);
+        if (res == FS_OK)
+            res = step_to_parent(graph, b);
+    }
+
+    if (res == 1)
+        return 0;
+    if (res != FS_OK)
+        return res;
+
+    memcpy(base, a, DIGEST_LENGTH);
+    return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "includes.h"
+
+// The commit graph holds what history walks need from each commit reachable
+// from the branches, so that they do not inflate and parse commit objects.
+//
+// Commit graph file should follow the format
+// "CGPH" + version (4 bytes) + number of commits (4 bytes)
+// fanout table: 256 * 4 bytes, entry i is the number of commits whose
+// first checksum byte is <= i
+// sorted commit checksums: n * DIGEST_LENGTH
+// commit data: n * COMMIT_GRAPH_DATA_SIZE, in the order of the checksums
+// SHA-1 of everything above
+//
+// The data of a commit is the checksum of its tree (DIGEST_LENGTH bytes), the
+// position of its parent (4 bytes, COMMIT_GRAPH_NO_PARENT for a root commit),
+// its generation number (4 bytes) and its commit time (8 bytes). The
+// generation of a root commit is 1, the one of another commit is one more
+// than the generation of its parent.
+//
+// All integers are stored in network byte order.
+
+#define COMMIT_GRAPH_SIGNATURE "CGPH"
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_HEADER_SIZE 12
+#define COMMIT_GRAPH_FANOUT_SIZE (256 * 4)
+#define COMMIT_GRAPH_DATA_SIZE (DIGEST_LENGTH + 4 + 4 + 8)
+#define COMMIT_GRAPH_NO_PARENT 0xffffffff
+
+#define INVALID_COMMIT_GRAPH (-70)
+
+struct commit_graph {
+    unsigned char *map;
+    size_t size;
+    uint32_t commits_count;
+};
+
+/// @brief a commit as found in the commit graph, or read from its object
+/// when it is not in the graph
+struct commit_info {
+    unsigned char checksum[DIGEST_LENGTH];
+    unsigned char tree[DIGEST_LENGTH];
+    int has_parent;
+    unsigned char parent[DIGEST_LENGTH];
+    // 0 when the commit is not in the graph
+    uint32_t generation;
+    int64_t time;
+};
+
+int load_commit_graph(struct commit_graph *graph);
+void free_commit_graph(struct commit_graph *graph);
+int find_graph_commit(struct commit_graph *graph, unsigned char *checksum, uint32_t *position);
+void get_graph_commit(struct commit_graph *graph, uint32_t position, struct commit_info *info);
+int lookup_commit_info(struct commit_graph *graph, unsigned char *checksum, struct commit_info *info);
+int write_commit_graph(size_t *commits_count);
+int merge_base(struct commit_graph *graph, unsigned char *checksum_a, unsigned char *checksum_b, unsigned char *base);
+
+#endif // COMMIT_GRAPH_H
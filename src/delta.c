@@ -0,0 +1,318 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+
+#define HASH_BASE 0x01000193u
+#define MAX_CHAIN_LENGTH 64
+
+struct delta_buffer {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+};
+
+struct delta_index {
+    uint32_t *buckets;
+    uint32_t *next;
+    uint32_t mask;
+    int shift;
+};
+
+static void buffer_grow(struct delta_buffer *buf, size_t needed)
+{
+    if (buf->size + needed <= buf->capacity)
+        return;
+
+    while (buf->size + needed > buf->capacity)
+        buf->capacity = buf->capacity == 0 ? 64 : buf->capacity * 2;
+    buf->data = realloc(buf->data, buf->capacity);
+}
+
+static void buffer_put_varint(struct delta_buffer *buf, size_t value)
+{
+    buffer_grow(buf, 10);
+    do
+    {
+        unsigned char c = value & 0x7f;
+        value >>= 7;
+        if (value)
+            c |= 0x80;
+        buf->data[buf->size++] = c;
+    } while (value);
+}
+
+static uint32_t block_hash(unsigned char *block)
+{
+    uint32_t hash = 0;
+    for (int i = 0; i < DELTA_MIN_MATCH; i++)
+        hash = hash * HASH_BASE + block[i];
+    return hash;
+}
+
+static uint32_t bucket_of(struct delta_index *index, uint32_t hash)
+{
+    return (hash * 2654435761u) >> index->shift;
+}
+
+static void create_index(struct delta_index *index, unsigned char *base, size_t base_size)
+{
+    size_t blocks = base_size / DELTA_MIN_MATCH;
+    int bits = 4;
+    while (bits < 31 && ((size_t)1 << bits) < blocks)
+        bits++;
+
+    index->mask = (1u << bits) - 1;
+    index->shift = 32 - bits;
+    index->buckets = calloc((size_t)1 << bits, sizeof(uint32_t));
+    index->next = malloc((blocks + 1) * sizeof(uint32_t));
+
+    // Later blocks are inserted first so a chain yields the earliest offsets first
+    for (size_t i = blocks; i > 0; i--)
+    {
+        uint32_t bucket = bucket_of(index, block_hash(base + (i - 1) * DELTA_MIN_MATCH));
+        index->next[i - 1] = index->buckets[bucket];
+        index->buckets[bucket] = i;
+    }
+}
+
+static void free_index(struct delta_index *index)
+{
+    free(index->buckets);
+    free(index->next);
+}
+
+static void emit_insert(struct delta_buffer *buf, unsigned char *data, size_t size)
+{
+    while (size > 0)
+    {
+        size_t chunk = size > DELTA_MAX_INSERT ? DELTA_MAX_INSERT : size;
+        buffer_grow(buf, chunk + 1);
+        buf->data[buf->size++] = chunk;
+        memcpy(buf->data + buf->size, data, chunk);
+        buf->size += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void emit_copy(struct delta_buffer *buf, size_t offset, size_t size)
+{
+    while (size > 0)
+    {
+        size_t chunk = size > DELTA_MAX_COPY ? DELTA_MAX_COPY : size;
+        buffer_grow(buf, 8);
+        size_t op = buf->size++;
+        unsigned char cmd = 0x80;
+        for (int i = 0; i < 4; i++)
+        {
+            unsigned char byte = (offset >> (8 * i)) & 0xff;
+            if (byte)
+            {
+                cmd |= 1 << i;
+                buf->data[buf->size++] = byte;
+            }
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            unsigned char byte = (chunk >> (8 * i)) & 0xff;
+            if (byte)
+            {
+                cmd |= 0x10 << i;
+                buf->data[buf->size++] = byte;
+            }
+        }
+        buf->data[op] = cmd;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+/// @brief Encode target as a list of copy and insert instructions against base
+/// @param max_delta_size give up once the delta grows past this size, 0 for no limit
+/// @return 0 on success, DELTA_TOO_BIG if the delta would exceed max_delta_size
+int create_delta(unsigned char *base, size_t base_size,
+                 unsigned char *target, size_t target_size,
+                 size_t max_delta_size,
+                 unsigned char **delta, size_t *delta_size)
+{
+    if (base_size > 0xffffffffu)
+        return DELTA_TOO_BIG;
+
+    struct delta_buffer buf = {0};
+    buffer_put_varint(&buf, base_size);
+    buffer_put_varint(&buf, target_size);
+
+    struct delta_index index;
+    create_index(&index, base, base_size);
+
+    uint32_t high = 1;
+    for (int i = 0; i < DELTA_MIN_MATCH - 1; i++)
+        high *= HASH_BASE;
+
+    size_t insert_start = 0;
+    size_t i = 0;
+    uint32_t hash = target_size >= DELTA_MIN_MATCH ? block_hash(target) : 0;
+    while (i + DELTA_MIN_MATCH <= target_size)
+    {
+        size_t best_offset = 0, best_size = 0;
+        uint32_t candidate = index.buckets[bucket_of(&index, hash)];
+        for (int chain = 0; candidate != 0 && chain < MAX_CHAIN_LENGTH; chain++)
+        {
+            size_t offset = (size_t)(candidate - 1) * DELTA_MIN_MATCH;
+            candidate = index.next[candidate - 1];
+            if (memcmp(base + offset, target + i, DELTA_MIN_MATCH) != 0)
+                continue;
+
+            size_t size = DELTA_MIN_MATCH;
+            while (offset + size < base_size && i + size < target_size && base[offset + size] == target[i + size])
+                size++;
+
+            if (size > best_size)
+            {
+                best_offset = offset;
+                best_size = size;
+            }
+        }
+
+        if (best_size < DELTA_MIN_MATCH)
+        {
+            if (i + DELTA_MIN_MATCH < target_size)
+                hash = (hash - target[i] * high) * HASH_BASE + target[i + DELTA_MIN_MATCH];
+            i++;
+            continue;
+        }
+
+        // Pending literals may also match right before the copied block
+        while (i > insert_start && best_offset > 0 && base[best_offset - 1] == target[i - 1])
+        {
+            i--;
+            best_offset--;
+            best_size++;
+        }
+
+        emit_insert(&buf, target + insert_start, i - insert_start);
+        emit_copy(&buf, best_offset, best_size);
+        i += best_size;
+        insert_start = i;
+
+        if (max_delta_size != 0 && buf.size > max_delta_size)
+            break;
+
+        if (i + DELTA_MIN_MATCH <= target_size)
+            hash = block_hash(target + i);
+    }
+    emit_insert(&buf, target + insert_start, target_size - insert_start);
+    free_index(&index);
+
+    if (max_delta_size != 0 && buf.size > max_delta_size)
+    {
+        free(buf.data);
+        return DELTA_TOO_BIG;
+    }
+
+    *delta = buf.data;
+    *delta_size = buf.size;
+    return 0;
+}
+
+static int get_varint(unsigned char **ptr, unsigned char *end, size_t *value)
+{
+    *value = 0;
+    int shift = 0;
+    unsigned char c;
+    do
+    {
+        if (*ptr >= end || shift > 63)
+            return INVALID_DELTA;
+        c = *(*ptr)++;
+        *value |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+/// @brief Read the size of the object a delta produces without applying it
+int delta_result_size(unsigned char *delta, size_t delta_size, size_t *result_size)
+{
+    unsigned char *ptr = delta;
+    unsigned char *end = delta + delta_size;
+    size_t base_size;
+    if (get_varint(&ptr, end, &base_size) != 0)
+        return INVALID_DELTA;
+    return get_varint(&ptr, end, result_size);
+}
+
+/// @brief Rebuild the target of a delta from its base
+/// @param result allocated by the function, to be freed by the caller
+/// @return 0 on success, INVALID_DELTA if the delta does not apply to base
+int apply_delta(unsigned char *base, size_t base_size,
+                unsigned char *delta, size_t delta_size,
+                unsigned char **result, size_t *result_size)
+{
+    unsigned char *ptr = delta;
+    unsigned char *end = delta + delta_size;
+
+    size_t expected_base_size, size;
+    if (get_varint(&ptr, end, &expected_base_size) != 0 || get_varint(&ptr, end, &size) != 0)
+        return INVALID_DELTA;
+    if (expected_base_size != base_size)
+        return INVALID_DELTA;
+
+    unsigned char *out = malloc(size == 0 ? 1 : size);
+    size_t written = 0;
+    while (ptr < end)
+    {
+        unsigned char cmd = *ptr++;
+        if (cmd & 0x80)
+        {
+            size_t offset = 0, copy_size = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                if (!(cmd & (1 << i)))
+                    continue;
+                if (ptr >= end)
+                    goto invalid;
+                offset |= (size_t)*ptr++ << (8 * i);
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                if (!(cmd & (0x10 << i)))
+                    continue;
+                if (ptr >= end)
+                    goto invalid;
+                copy_size |= (size_t)*ptr++ << (8 * i);
+            }
+            if (copy_size == 0)
+                copy_size = 0x10000;
+
+            if (offset + copy_size > base_size || written + copy_size > size)
+                goto invalid;
+            memcpy(out + written, base + offset, copy_size);
+            written += copy_size;
+        } else if (cmd != 0)
+        {
+            if (ptr + cmd > end || written + cmd > size)
+                goto invalid;
+            memcpy(out + written, ptr, cmd);
+            ptr += cmd;
+            written += cmd;
+        } else
+        {
+            goto invalid;
+        }
+    }
+
+    if (written != size)
+        goto invalid;
+
+    *result = out;
+    *result_size = size;
+    return 0;
+
+invalid:
+    free(out);
+    return INVALID_DELTA;
+}
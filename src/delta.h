@@ -0,0 +1,34 @@
+#ifndef DELTA_H
+#define DELTA_H 1
+
+#include <stddef.h>
+
+// Delta should follow the format
+// size of the base (varint) + size of the result (varint)
+// instruction1
+// instruction2
+// ...
+//
+// An instruction is either
+// - copy: 1xxxxxxx [offset1] [offset2] [offset3] [offset4] [size1] [size2] [size3]
+//   the 4 lower bits tell which offset bytes follow, the 3 next which size
+//   bytes follow, a missing byte is 0 and a size of 0 means 0x10000
+// - insert: 0xxxxxxx followed by that many (1 to 127) literal bytes
+
+#define DELTA_MIN_MATCH 16
+#define DELTA_MAX_INSERT 0x7f
+#define DELTA_MAX_COPY 0xffffff
+
+#define DELTA_TOO_BIG (-1)
+#define INVALID_DELTA (-2)
+
+int create_delta(unsigned char *base, size_t base_size,
+                 unsigned char *target, size_t target_size,
+                 size_t max_delta_size,
+                 unsigned char **delta, size_t *delta_size);
+int apply_delta(unsigned char *base, size_t base_size,
+                unsigned char *delta, size_t delta_size,
+                unsigned char **result, size_t *result_size);
+int delta_result_size(unsigned char *delta, size_t delta_size, size_t *result_size);
+
+#endif // DELTA_H
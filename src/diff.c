@@ -0,0 +1,562 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+
+#define COLOR_RESET "\033[m"
+#define COLOR_BOLD "\033[1m"
+#define COLOR_RED "\033[31m"
+#define COLOR_GREEN "\033[32m"
+#define COLOR_CYAN "\033[36m"
+
+// Past this many edits the search for a minimal diff gives up and splits at
+// the furthest point reached, so very different files stay cheap to diff
+#define MYERS_MIN_COST 256
+
+struct diff_file {
+    size_t lines_count;
+    char **lines;
+    size_t *line_sizes;
+    uint32_t *ids;
+    // changed[i] is set when line i is not part of the common subsequence
+    char *changed;
+};
+
+struct line_table {
+    size_t capacity;
+    uint32_t *ids;
+    char **lines;
+    size_t *line_sizes;
+    uint32_t *hashes;
+    uint32_t next_id;
+};
+
+struct diff_context {
+    uint32_t *a;
+    uint32_t *b;
+    char *changed_a;
+    char *changed_b;
+    long *forward;
+    long *backward;
+    long max_cost;
+    // Scratch arrays indexed by line id, for the patience diff
+    uint32_t *count_a;
+    uint32_t *count_b;
+    long *position_a;
+    long *position_b;
+};
+
+void init_diff_options(struct diff_options *options)
+{
+    options->algorithm = DIFF_MYERS;
+    options->output = DIFF_OUTPUT_PATCH;
+    options->context = DIFF_DEFAULT_CONTEXT;
+    options->color = 0;
+    options->new_files = 1;
+}
+
+static uint32_t line_hash(char *line, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (unsigned char)line[i]) * 16777619u;
+    return hash;
+}
+
+static void split_lines(struct diff_file *file, char *data, size_t size)
+{
+    memset(file, 0, sizeof(struct diff_file));
+
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++)
+        if (data[i] == '\n')
+            count++;
+    if (size > 0 && data[size - 1] != '\n')
+        count++;
+
+    file->lines_count = count;
+    file->lines = malloc((count + 1) * sizeof(char *));
+    file->line_sizes = malloc((count + 1) * sizeof(size_t));
+    file->ids = malloc((count + 1) * sizeof(uint32_t));
+    file->changed = calloc(count + 1, 1);
+
+    size_t start = 0, line = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] != '\n')
+            continue;
+        file->lines[line] = data + start;
+        file->line_sizes[line++] = i + 1 - start;
+        start = i + 1;
+    }
+    if (start < size)
+    {
+        file->lines[line] = data + start;
+        file->line_sizes[line] = size - start;
+    }
+}
+
+static void free_diff_file(struct diff_file *file)
+{
+    free(file->lines);
+    free(file->line_sizes);
+    free(file->ids);
+    free(file->changed);
+}
+
+/// @brief Give the same id to equal lines, so that lines are compared as integers
+/// The line terminator is part of the line, a last line without one differs
+static void intern_lines(struct line_table *table, struct diff_file *file)
+{
+    for (size_t i = 0; i < file->lines_count; i++)
+    {
+        uint32_t hash = line_hash(file->lines[i], file->line_sizes[i]);
+        size_t slot = hash & (table->capacity - 1);
+        while (table->lines[slot] != NULL)
+        {
+            if (table->hashes[slot] == hash && table->line_sizes[slot] == file->line_sizes[i]
+                && memcmp(table->lines[slot], file->lines[i], file->line_sizes[i]) == 0)
+                break;
+            slot = (slot + 1) & (table->capacity - 1);
+        }
+
+        if (table->lines[slot] == NULL)
+        {
+            table->lines[slot] = file->lines[i];
+            table->line_sizes[slot] = file->line_sizes[i];
+            table->hashes[slot] = hash;
+            table->ids[slot] = table->next_id++;
+        }
+        file->ids[i] = table->ids[slot];
+    }
+}
+
+static void mark_changed(char *changed, long start, long end)
+{
+    for (long i = start; i < end; i++)
+        changed[i] = 1;
+}
+
+/// @brief Find a point on an optimal edit path between a[a_start, a_end) and
+/// b[b_start, b_end), the ranges have no common prefix nor suffix
+/// @return 0 if the split was found, -1 if the search gave up
+static int middle_snake(struct diff_context *ctx, long a_start, long a_end, long b_start, long b_end,
+                        long *split_a, long *split_b)
+{
+    long n = a_end - a_start, m = b_end - b_start;
+    long delta = n - m;
+    int odd = delta & 1;
+    long max = (n + m + 1) / 2;
+    long *vf = ctx->forward + max + 1;
+    long *vb = ctx->backward + max + 1;
+    vf[1] = 0;
+    vb[1] = 0;
+
+    for (long d = 0; d <= max; d++)
+    {
+        if (d > ctx->max_cost)
+        {
+            // Split at the forward path that went the furthest
+            long best = -1;
+            for (long k = -(d - 1); k <= d - 1; k += 2)
+            {
+                long x = vf[k] < n ? vf[k] : n;
+                long y = x - k;
+                if (y < 0 || y > m || x + y <= best)
+                    continue;
+                best = x + y;
+                *split_a = a_start + x;
+                *split_b = b_start + y;
+            }
+            if (best <= 0 || best >= n + m)
+                return -1;
+            return 0;
+        }
+
+        for (long k = -d; k <= d; k += 2)
+        {
+            long x = (k == -d || (k != d && vf[k - 1] < vf[k + 1])) ? vf[k + 1] : vf[k - 1] + 1;
+            long y = x - k;
+            while (x < n && y < m && ctx->a[a_start + x] == ctx->b[b_start + y])
+            {
+                x++;
+                y++;
+            }
+            vf[k] = x;
+
+            long c = delta - k;
+            if (odd && c >= -(d - 1) && c <= d - 1 && vf[k] + vb[c] >= n)
+            {
+                *split_a = a_start + x;
+                *split_b = b_start + y;
+                return 0;
+            }
+        }
+
+        for (long k = -d; k <= d; k += 2)
+        {
+            long x = (k == -d || (k != d && vb[k - 1] < vb[k + 1])) ? vb[k + 1] : vb[k - 1] + 1;
+            long y = x - k;
+            while (x < n && y < m && ctx->a[a_end - 1 - x] == ctx->b[b_end - 1 - y])
+            {
+                x++;
+                y++;
+            }
+            vb[k] = x;
+
+            long c = delta - k;
+            if (!odd && c >= -d && c <= d && vb[k] + vf[c] >= n)
+            {
+                *split_a = a_end - x;
+                *split_b = b_end - y;
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Myers' diff in linear space: split the ranges on the middle of an
+/// optimal edit path and diff both halves
+static void myers_diff(struct diff_context *ctx, long a_start, long a_end, long b_start, long b_end)
+{
+    while (a_start < a_end && b_start < b_end && ctx->a[a_start] == ctx->b[b_start])
+    {
+        a_start++;
+        b_start++;
+    }
+    while (a_start < a_end && b_start < b_end && ctx->a[a_end - 1] == ctx->b[b_end - 1])
+    {
+        a_end--;
+        b_end--;
+    }
+
+    if (a_start == a_end || b_start == b_end)
+    {
+        mark_changed(ctx->changed_a, a_start, a_end);
+        mark_changed(ctx->changed_b, b_start, b_end);
+        return;
+    }
+
+    long split_a, split_b;
+    if (middle_snake(ctx, a_start, a_end, b_start, b_end, &split_a, &split_b) != 0)
+    {
+        mark_changed(ctx->changed_a, a_start, a_end);
+        mark_changed(ctx->changed_b, b_start, b_end);
+        return;
+    }
+
+    myers_diff(ctx, a_start, split_a, b_start, split_b);
+    myers_diff(ctx, split_a, a_end, split_b, b_end);
+}
+
+/// @brief Patience diff: the lines that appear exactly once on each side are
+/// matched in their longest common order, and the ranges between them are
+/// diffed the same way. Ranges without such lines fall back to Myers' diff
+static void patience_diff(struct diff_context *ctx, long a_start, long a_end, long b_start, long b_end)
+{
+    while (a_start < a_end && b_start < b_end && ctx->a[a_start] == ctx->b[b_start])
+    {
+        a_start++;
+        b_start++;
+    }
+    while (a_start < a_end && b_start < b_end && ctx->a[a_end - 1] == ctx->b[b_end - 1])
+    {
+        a_end--;
+        b_end--;
+    }
+
+    if (a_start == a_end || b_start == b_end)
+    {
+        mark_changed(ctx->changed_a, a_start, a_end);
+        mark_changed(ctx->changed_b, b_start, b_end);
+        return;
+    }
+
+    for (long i = a_start; i < a_end; i++)
+    {
+        ctx->count_a[ctx->a[i]] = 0;
+        ctx->count_b[ctx->a[i]] = 0;
+    }
+    for (long i = b_start; i < b_end; i++)
+    {
+        ctx->count_a[ctx->b[i]] = 0;
+        ctx->count_b[ctx->b[i]] = 0;
+    }
+    for (long i = a_start; i < a_end; i++)
+    {
+        ctx->count_a[ctx->a[i]]++;
+        ctx->position_a[ctx->a[i]] = i;
+    }
+    for (long i = b_start; i < b_end; i++)
+    {
+        ctx->count_b[ctx->b[i]]++;
+        ctx->position_b[ctx->b[i]] = i;
+    }
+
+    // Unique common lines in the order of a, with their position in b
+    long unique_count = 0;
+    long *unique_b = malloc((a_end - a_start) * sizeof(long));
+    for (long i = a_start; i < a_end; i++)
+    {
+        uint32_t id = ctx->a[i];
+        if (ctx->count_a[id] == 1 && ctx->count_b[id] == 1)
+            unique_b[unique_count++] = ctx->position_b[id];
+    }
+
+    if (unique_count == 0)
+    {
+        free(unique_b);
+        myers_diff(ctx, a_start, a_end, b_start, b_end);
+        return;
+    }
+
+    // Longest increasing subsequence of the positions in b, by patience sorting
+    long *tails = malloc(unique_count * sizeof(long));
+    long *previous = malloc(unique_count * sizeof(long));
+    long piles = 0;
+    for (long i = 0; i < unique_count; i++)
+    {
+        long low = 0, high = piles;
+        while (low < high)
+        {
+            long middle = (low + high) / 2;
+            if (unique_b[tails[middle]] < unique_b[i])
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        previous[i] = low > 0 ? tails[low - 1] : -1;
+        tails[low] = i;
+        if (low == piles)
+            piles++;
+    }
+
+    long *anchors = malloc(piles * sizeof(long));
+    for (long i = tails[piles - 1], j = piles - 1; i != -1; i = previous[i], j--)
+        anchors[j] = unique_b[i];
+    free(tails);
+    free(previous);
+    free(unique_b);
+
+    // The scratch arrays are reused by the recursion, the anchors are copied first
+    long *anchors_a = malloc(piles * sizeof(long));
+    for (long i = 0; i < piles; i++)
+        anchors_a[i] = ctx->position_a[ctx->b[anchors[i]]];
+
+    long last_a = a_start, last_b = b_start;
+    for (long i = 0; i < piles; i++)
+    {
+        patience_diff(ctx, last_a, anchors_a[i], last_b, anchors[i]);
+        last_a = anchors_a[i] + 1;
+        last_b = anchors[i] + 1;
+    }
+    patience_diff(ctx, last_a, a_end, last_b, b_end);
+
+    free(anchors);
+    free(anchors_a);
+}
+
+static int is_binary(char *data, size_t size)
+{
+    size_t check_size = size < DIFF_BINARY_CHECK_SIZE ? size : DIFF_BINARY_CHECK_SIZE;
+    return data != NULL && memchr(data, '\0', check_size) != NULL;
+}
+
+static void print_line(FILE *out, struct diff_options *options, char prefix, char *color, char *line, size_t size)
+{
+    int terminated = size > 0 && line[size - 1] == '\n';
+    if (terminated)
+        size--;
+
+    if (options->color && color != NULL)
+        fprintf(out, "%s%c%.*s%s\n", color, prefix, (int)size, line, COLOR_RESET);
+    else
+        fprintf(out, "%c%.*s\n", prefix, (int)size, line);
+
+    if (!terminated)
+        fprintf(out, "\\ No newline at end of file\n");
+}
+
+static void print_range(FILE *out, char sign, long start, long count)
+{
+    // An empty range is given by the line before it
+    if (count == 0)
+        fprintf(out, "%c%ld,0", sign, start);
+    else if (count == 1)
+        fprintf(out, "%c%ld", sign, start + 1);
+    else
+        fprintf(out, "%c%ld,%ld", sign, start + 1, count);
+}
+
+/// @brief Print the hunks of the changed lines of a and b, changes closer than
+/// twice the context are printed in the same hunk
+static void print_hunks(struct diff_file *a, struct diff_file *b, struct diff_options *options, FILE *out)
+{
+    long n = a->lines_count, m = b->lines_count;
+    long context = options->context;
+    long i = 0, j = 0;
+
+    while (i < n || j < m)
+    {
+        // Skip to the next change
+        while (i < n && j < m && !a->changed[i] && !b->changed[j])
+        {
+            i++;
+            j++;
+        }
+        if (i >= n && j >= m)
+            break;
+
+        // Extend the hunk while the next change is close enough
+        long hunk_a = i - context > 0 ? i - context : 0;
+        long hunk_b = j - (i - hunk_a);
+        long end_a = i, end_b = j;
+        while (1)
+        {
+            while (end_a < n && a->changed[end_a])
+                end_a++;
+            while (end_b < m && b->changed[end_b])
+                end_b++;
+
+            long common = 0;
+            while (end_a + common < n && end_b + common < m && !a->changed[end_a + common]
+                   && !b->changed[end_b + common] && common <= 2 * context)
+                common++;
+
+            int more = end_a + common < n || end_b + common < m;
+            if (common > 2 * context || !more)
+            {
+                long tail = common < context ? common : context;
+                end_a += tail;
+                end_b += tail;
+                break;
+            }
+            end_a += common;
+            end_b += common;
+        }
+
+        if (options->color)
+            fprintf(out, COLOR_CYAN);
+        fprintf(out, "@@ ");
+        print_range(out, '-', hunk_a, end_a - hunk_a);
+        fprintf(out, " ");
+        print_range(out, '+', hunk_b, end_b - hunk_b);
+        fprintf(out, " @@%s\n", options->color ? COLOR_RESET : "");
+
+        long x = hunk_a, y = hunk_b;
+        while (x < end_a || y < end_b)
+        {
+            if (x < end_a && y < end_b && !a->changed[x] && !b->changed[y])
+            {
+                print_line(out, options, ' ', NULL, a->lines[x], a->line_sizes[x]);
+                x++;
+                y++;
+                continue;
+            }
+            while (x < end_a && a->changed[x])
+            {
+                print_line(out, options, '-', COLOR_RED, a->lines[x], a->line_sizes[x]);
+                x++;
+            }
+            while (y < end_b && b->changed[y])
+            {
+                print_line(out, options, '+', COLOR_GREEN, b->lines[y], b->line_sizes[y]);
+                y++;
+            }
+        }
+
+        i = end_a;
+        j = end_b;
+    }
+}
+
+/// @brief Print the unified diff of a and b to out, nothing when they are equal
+/// @param a content of the first buffer, NULL when the file does not exist on that side
+/// @param path_a path printed for the first buffer, the second one is given by path_b
+/// @return 1 if the buffers differ, 0 otherwise
+int diff_buffers(char *a, size_t a_size, char *b, size_t b_size, char *path_a, char *path_b,
+                 struct diff_options *options, FILE *out)
+{
+    if (a != NULL && b != NULL && a_size == b_size && memcmp(a, b, a_size) == 0)
+        return 0;
+
+    char *name_a = a == NULL ? "/dev/null" : path_a;
+    char *name_b = b == NULL ? "/dev/null" : path_b;
+    char *prefix_a = a == NULL ? "" : "a/";
+    char *prefix_b = b == NULL ? "" : "b/";
+
+    if (options->color)
+        fprintf(out, COLOR_BOLD);
+    fprintf(out, "diff --git a/%s b/%s\n", path_a, path_b);
+    if (is_binary(a, a_size) || is_binary(b, b_size))
+    {
+        fprintf(out, "Binary files %s%s and %s%s differ\n", prefix_a, name_a, prefix_b, name_b);
+        if (options->color)
+            fprintf(out, COLOR_RESET);
+        return 1;
+    }
+    fprintf(out, "--- %s%s\n+++ %s%s\n", prefix_a, name_a, prefix_b, name_b);
+    if (options->color)
+        fprintf(out, COLOR_RESET);
+
+    struct diff_file file_a, file_b;
+    split_lines(&file_a, a, a == NULL ? 0 : a_size);
+    split_lines(&file_b, b, b == NULL ? 0 : b_size);
+
+    struct line_table table = {0};
+    table.capacity = 16;
+    while (table.capacity < 2 * (file_a.lines_count + file_b.lines_count))
+        table.capacity *= 2;
+    table.ids = malloc(table.capacity * sizeof(uint32_t));
+    table.lines = calloc(table.capacity, sizeof(char *));
+    table.line_sizes = malloc(table.capacity * sizeof(size_t));
+    table.hashes = malloc(table.capacity * sizeof(uint32_t));
+    intern_lines(&table, &file_a);
+    intern_lines(&table, &file_b);
+
+    long n = file_a.lines_count, m = file_b.lines_count;
+    struct diff_context ctx = {
+        .a = file_a.ids,
+        .b = file_b.ids,
+        .changed_a = file_a.changed,
+        .changed_b = file_b.changed,
+        .forward = malloc((n + m + 3) * sizeof(long)),
+        .backward = malloc((n + m + 3) * sizeof(long)),
+        .max_cost = MYERS_MIN_COST,
+    };
+    // Like git, allow about the square root of the size in edits before giving up
+    while (ctx.max_cost * ctx.max_cost < n + m)
+        ctx.max_cost *= 2;
+
+    if (options->algorithm == DIFF_PATIENCE)
+    {
+        ctx.count_a = malloc((table.next_id + 1) * sizeof(uint32_t));
+        ctx.count_b = malloc((table.next_id + 1) * sizeof(uint32_t));
+        ctx.position_a = malloc((table.next_id + 1) * sizeof(long));
+        ctx.position_b = malloc((table.next_id + 1) * sizeof(long));
+        patience_diff(&ctx, 0, n, 0, m);
+    } else
+    {
+        myers_diff(&ctx, 0, n, 0, m);
+    }
+
+    print_hunks(&file_a, &file_b, options, out);
+
+    free(ctx.forward);
+    free(ctx.backward);
+    free(ctx.count_a);
+    free(ctx.count_b);
+    free(ctx.position_a);
+    free(ctx.position_b);
+    free(table.ids);
+    free(table.lines);
+    free(table.line_sizes);
+    free(table.hashes);
+    free_diff_file(&file_a);
+    free_diff_file(&file_b);
+    return 1;
+}
@@ -0,0 +1,40 @@
+#ifndef DIFF_H
+#define DIFF_H 1
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Line diff of two buffers, printed in the unified format
+// --- a/<path>
+// +++ b/<path>
+// @@ -<first line>,<lines count> +<first line>,<lines count> @@
+// followed by the lines of the hunk, prefixed by ' ' when they are in both
+// buffers, '-' when they are only in the first and '+' when only in the second.
+// A missing side is printed as /dev/null.
+
+#define DIFF_MYERS 0
+#define DIFF_PATIENCE 1
+
+// What is printed for each changed file
+#define DIFF_OUTPUT_PATCH 0
+#define DIFF_OUTPUT_NAME_STATUS 1
+#define DIFF_OUTPUT_RAW 2
+
+#define DIFF_DEFAULT_CONTEXT 3
+// Bytes looked at for a '\0' to decide that a buffer is binary
+#define DIFF_BINARY_CHECK_SIZE 8000
+
+struct diff_options {
+    int algorithm;
+    int output;
+    int context;
+    int color;
+    // Also print the files that are only on one side, as diffs against nothing
+    int new_files;
+};
+
+void init_diff_options(struct diff_options *options);
+int diff_buffers(char *a, size_t a_size, char *b, size_t b_size, char *path_a, char *path_b,
+                 struct diff_options *options, FILE *out);
+
+#endif // DIFF_H
@@ -3,19 +3,29 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <openssl/comp.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <zlib.h>
 
+#include "arena.h"
+#include "checkout.h"
 #include "fs.h"
+#include "refs.h"
+#include "ignore.h"
 #include "includes.h"
 #include "tree.h"
 #include "objects.h"
+#include "odb.h"
+#include "pack.h"
 #include "utils.h"
+#include "workqueue.h"
 #include "commit.h"
+#include "commit_graph.h"
 
 int local_repo_exist()
 {
@@ -80,6 +90,19 @@ int init_repo()
 
 int blob_from_file(char *filename, struct object *object)
 {
+    struct stat link_info;
+    if (lstat(filename, &link_info) == 0 && S_ISLNK(link_info.st_mode))
+    {
+        // The content of a symlink is its target, as checkout writes it
+        object->object_type = BLOB;
+        object->content = realloc(object->content, link_info.st_size + 1);
+        ssize_t n = readlink(filename, object->content, link_info.st_size + 1);
+        if (n < 0 || n > link_info.st_size)
+            return FS_ERROR;
+        object->size = n;
+        return FS_OK;
+    }
+
     FILE* file = fopen(filename, "r");
     if (file == NULL) {
         error_print("File %s not found", filename);
@@ -99,68 +122,122 @@ int blob_from_file(char *filename, struct object *object)
     return FS_OK;
 }
 
-int write_object(struct object *obj)
+static int write_all(int fd, char *data, size_t size)
 {
-    if(!local_repo_exist())
+    while (size > 0)
     {
-        return REPO_NOT_INITIALIZED;
+        ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FS_ERROR;
+        }
+        data += written;
+        size -= written;
     }
-    int result = FS_OK;
 
-    struct stat buffer;
-    if (stat(OBJECTS_DIR, &buffer) != 0)
+    return FS_OK;
+}
+
+/// @brief Move a fully written temporary object file to its place in the fan-out directories
+/// The temporary file is removed if the object already exists
+static int store_tmp_object(char *tmp_path, unsigned char *raw_checksum)
+{
+    if (has_packed_object(raw_checksum))
     {
-        mkdir(OBJECTS_DIR, DEFAULT_DIR_MODE);
+        unlink(tmp_path);
+        return OBJECT_ALREADY_EXIST;
     }
-    
-    DIR *objects_dir = opendir(OBJECTS_DIR);
-    int objects_dir_fd = dirfd(objects_dir);
 
     char checksum[DIGEST_LENGTH * 2 + 1];
-    hash_object_str(obj, checksum);
+    hash_to_hexa(raw_checksum, checksum);
+    return store_loose_object(tmp_path, checksum);
+}
+
+static int create_tmp_object(char *tmp_path)
+{
+    if (open_odb() != FS_OK)
+    {
+        mkdir(OBJECTS_DIR, DEFAULT_DIR_MODE);
+    }
 
-    char tmp = checksum[2];
-    checksum[2] = '\0';
+    sprintf(tmp_path, "%s", TMP_OBJECT_TEMPLATE);
+    return mkstemp(tmp_path);
+}
 
-    if (mkdirat(objects_dir_fd, checksum, DEFAULT_DIR_MODE) != 0 && errno != EEXIST)
+int write_object(struct object *obj)
+{
+    if(!local_repo_exist())
     {
-        defer(FS_ERROR);
+        return REPO_NOT_INITIALIZED;
     }
-    int subdir_fd = openat(objects_dir_fd, checksum, O_RDONLY | __O_CLOEXEC | __O_DIRECTORY | O_NOCTTY | O_NONBLOCK);
+    int result = FS_OK;
 
-    checksum[2] = tmp;
+    unsigned char raw_checksum[DIGEST_LENGTH];
+    hash_object(obj, raw_checksum);
+    if (has_packed_object(raw_checksum))
+    {
+        return OBJECT_ALREADY_EXIST;
+    }
 
-    int save_file_fd = openat(subdir_fd, checksum + 2, O_CREAT | O_WRONLY | O_TRUNC, DEFAULT_FILE_MODE);
-    if(save_file_fd == -1) {
-        if (errno == EACCES)
-        {
-            // debug_print("Object %s already exists", checksum);
-            defer(OBJECT_ALREADY_EXIST);
-        }
-        defer(FS_ERROR);
+    uLong comp_size = compressBound(object_size(obj));
+    char *compressed = malloc(comp_size);
+    if (compress_object(obj, compressed, &comp_size) != Z_OK)
+    {
+        free(compressed);
+        return COMPRESSION_ERROR;
     }
-    FILE* save_file = fdopen(save_file_fd, "w");
 
-    size_t data_size = object_size(obj);
-    uLong comp_size = compressBound(data_size);
-    char *compressed = malloc(comp_size);   
-    
-    int res = compress_object(obj, compressed, &comp_size);
-    if (res != Z_OK)
+    char tmp_path[sizeof(TMP_OBJECT_TEMPLATE)];
+    int tmp_fd = create_tmp_object(tmp_path);
+    if (tmp_fd == -1)
     {
-        defer(COMPRESSION_ERROR);
+        free(compressed);
+        return FS_ERROR;
     }
-    fwrite(compressed, comp_size, 1, save_file);
+
+    result = write_all(tmp_fd, compressed, comp_size);
     free(compressed);
-    fclose(save_file);
+    if (close(tmp_fd) != 0)
+        result = FS_ERROR;
 
-defer:   
-    closedir(objects_dir);
-    close(subdir_fd);
-    return result;
+    if (result != FS_OK)
+    {
+        unlink(tmp_path);
+        return result;
+    }
+
+    return store_tmp_object(tmp_path, raw_checksum);
 }
 
-int read_object(char *checksum, struct object *obj)
+static int deflate_to_fd(z_stream *stream, char *data, size_t size, int flush, int fd, char *out)
+{
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = size;
+
+    int res;
+    do
+    {
+        stream->next_out = (Bytef *)out;
+        stream->avail_out = OBJECT_CHUNK_SIZE;
+        res = deflate(stream, flush);
+        if (res == Z_STREAM_ERROR)
+            return COMPRESSION_ERROR;
+
+        if (write_all(fd, out, OBJECT_CHUNK_SIZE - stream->avail_out) != FS_OK)
+            return FS_ERROR;
+    } while (stream->avail_out == 0 || (flush == Z_FINISH && res != Z_STREAM_END));
+
+    return FS_OK;
+}
+
+/// @brief Hash, compress and store the content of filename as a blob in a single pass
+/// The file is read by chunks that are fed both to the hash and to deflate, so
+/// memory use does not depend on the size of the file
+/// @param checksum set to the checksum of the blob, array of size DIGEST_LENGTH
+/// @return FS_OK or OBJECT_ALREADY_EXIST on success
+int write_blob_from_file(char *filename, unsigned char *checksum)
 {
     if(!local_repo_exist())
     {
@@ -168,258 +245,351 @@ int read_object(char *checksum, struct object *obj)
     }
     int result = FS_OK;
 
-    struct stat buffer;
-    if (stat(OBJECTS_DIR, &buffer) != 0)
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
     {
-        error_print("Object dir does not exist");
-        return OBJECT_DOES_NOT_EXIST;
+        error_print("File %s not found", filename);
+        return FILE_NOT_FOUND;
     }
 
-    DIR *objects_dir = opendir(OBJECTS_DIR);
-    int objects_dir_fd = dirfd(objects_dir);
-
-    char tmp = checksum[2];
-    checksum[2] = '\0';
+    struct stat file_info;
+    if (fstat(fd, &file_info) != 0)
+    {
+        close(fd);
+        return FS_ERROR;
+    }
 
-    int subdir_fd = openat(objects_dir_fd, checksum, O_RDONLY | __O_CLOEXEC | __O_DIRECTORY | O_NOCTTY | O_NONBLOCK);
-    if(subdir_fd == -1)
+    char tmp_path[sizeof(TMP_OBJECT_TEMPLATE)];
+    int tmp_fd = create_tmp_object(tmp_path);
+    if (tmp_fd == -1)
     {
-        closedir(objects_dir);
-        if(errno == EACCES)
-            return FILE_NOT_FOUND;
+        close(fd);
         return FS_ERROR;
     }
 
-    checksum[2] = tmp;
+    z_stream stream = {0};
+    deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+    char *in = malloc(OBJECT_CHUNK_SIZE);
+    char *out = malloc(OBJECT_CHUNK_SIZE);
 
-    fstatat(subdir_fd, checksum + 2, &buffer, 0);
-    char file_content[buffer.st_size];
-    int save_file_fd = openat(subdir_fd, checksum + 2, O_RDONLY, DEFAULT_FILE_MODE);    
-    if (save_file_fd == -1)
+    char header[HEADER_MAX_SIZE];
+    int header_len = format_header(BLOB, file_info.st_size, header);
+    EVP_MD_CTX *ctx = sha1_init();
+    sha1_update(ctx, header, header_len);
+    result = deflate_to_fd(&stream, header, header_len, Z_NO_FLUSH, tmp_fd, out);
+
+    size_t total = 0;
+    ssize_t n = 0;
+    while (result == FS_OK && (n = read(fd, in, OBJECT_CHUNK_SIZE)) != 0)
     {
-        if(errno == EACCES)
-        {    
-            error_print("Object %s does not exist", checksum);
-            defer(OBJECT_DOES_NOT_EXIST);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            result = FS_ERROR;
+            break;
         }
-        error_print("Cannot open file %s", checksum);
-        defer(FS_ERROR);
+        sha1_update(ctx, in, n);
+        total += n;
+        result = deflate_to_fd(&stream, in, n, Z_NO_FLUSH, tmp_fd, out);
     }
 
-    FILE *save_file = fdopen(save_file_fd, "r");
-    fread(file_content, 1, buffer.st_size, save_file);
-    fclose(save_file);
-
-    result = uncompress_object(obj, file_content, buffer.st_size);
+    if (result == FS_OK && total != file_info.st_size)
+    {
+        error_print("File %s changed while being read", filename);
+        result = FS_ERROR;
+    }
+    if (result == FS_OK)
+        result = deflate_to_fd(&stream, NULL, 0, Z_FINISH, tmp_fd, out);
+
+    sha1_final(ctx, checksum);
+    deflateEnd(&stream);
+    free(in);
+    free(out);
+    close(fd);
+    if (close(tmp_fd) != 0)
+        result = FS_ERROR;
+
+    if (result != FS_OK)
+    {
+        unlink(tmp_path);
+        return result;
+    }
 
-defer:
-    closedir(objects_dir);
-    return result;
+    return store_tmp_object(tmp_path, checksum);
 }
 
-int remove_object(char *checksum)
+/// @brief Compute the checksum the content of filename would have as a blob, without storing it
+/// @param checksum array of size DIGEST_LENGTH
+int hash_blob_from_file(char *filename, unsigned char *checksum)
 {
-    if(!local_repo_exist())
+    struct stat link_info;
+    if (lstat(filename, &link_info) == 0 && S_ISLNK(link_info.st_mode))
     {
-        return REPO_NOT_INITIALIZED;
+        object_t object = {0};
+        int res = blob_from_file(filename, &object);
+        if (res == FS_OK)
+            hash_object(&object, checksum);
+        free_object(&object);
+        return res;
     }
-    int result = FS_OK;
 
-    char path[strlen(OBJECTS_DIR) + strlen(checksum) + 2];
-    sprintf(path, "%s/%s", OBJECTS_DIR, checksum);
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return FILE_NOT_FOUND;
 
-    remove(path);
-}
+    struct stat file_info;
+    if (fstat(fd, &file_info) != 0)
+    {
+        close(fd);
+        return FS_ERROR;
+    }
 
-int create_dir(char *dir)
-{   
-    struct stat buffer = {0};
-    int result = FS_OK;
+    char header[HEADER_MAX_SIZE];
+    int header_len = format_header(BLOB, file_info.st_size, header);
+    EVP_MD_CTX *ctx = sha1_init();
+    sha1_update(ctx, header, header_len);
 
-    if(stat(dir, &buffer) == 0)
+    int result = FS_OK;
+    char *in = malloc(OBJECT_CHUNK_SIZE);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, in, OBJECT_CHUNK_SIZE)) != 0)
     {
-        if (S_ISDIR(buffer.st_mode))
+        if (n < 0)
         {
-            result = remove(dir);
-            if (result != 0)
-                return FS_ERROR;
+            if (errno == EINTR)
+                continue;
+            result = FS_ERROR;
+            break;
         }
-    } else {
-        result = mkdir(dir, DEFAULT_DIR_MODE);
-        if (result != 0)
-            return FS_ERROR;
+        sha1_update(ctx, in, n);
+        total += n;
     }
-}
+    free(in);
+    close(fd);
 
-void remove_dir(char *dir)
-{
-    char cmd[strlen(dir) + strlen("rm -rf ") + 1];
-    sprintf(cmd, "rm -rf %s", dir);
+    sha1_final(ctx, checksum);
+    if (result == FS_OK && total != file_info.st_size)
+        result = FS_ERROR;
 
-    FILE *p = popen(cmd, "r");
-    pclose(p);
+    return result;
 }
 
-int init_tmp_diff_dir(char* dir)
+/// @brief Get the compressed content of a loose object
+/// An object smaller than LOOSE_OBJECT_BUFFER_SIZE is read into buffer, which
+/// saves the fstat, the mapping and its page faults, a larger one is mapped
+/// @param buffer array of size LOOSE_OBJECT_BUFFER_SIZE
+/// @param header_only only the start of the object is needed, it is never mapped
+/// @param data set to buffer or to a mapping, to release with release_loose_object
+static int load_loose_object(char *checksum, char *buffer, int header_only, char **data, size_t *size)
 {
-    int dirlen = 0;
-    if (*dir != '\0')
-        dirlen = strlen(dir);
-    char path_a[dirlen + 8], path_b[dirlen + 8];
-    sprintf(path_a, "/tmp/a/%s", dir);
-    sprintf(path_b, "/tmp/b/%s", dir);
-
-    if (create_dir(path_a) != FS_OK)
-        return FS_ERROR;
-    if (create_dir(path_b) != FS_OK)
+    int save_file_fd = open_loose_object(checksum);
+    if (save_file_fd == -1)
+    {
+        if (errno == ENOENT)
+        {
+            error_print("Object %s does not exist", checksum);
+            return OBJECT_DOES_NOT_EXIST;
+        }
+        error_print("Cannot open file %s", checksum);
         return FS_ERROR;
-    
+    }
 
-    return FS_OK;
-}
+    size_t total = 0;
+    while (total < LOOSE_OBJECT_BUFFER_SIZE)
+    {
+        ssize_t n = read(save_file_fd, buffer + total, LOOSE_OBJECT_BUFFER_SIZE - total);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            close(save_file_fd);
+            return FS_ERROR;
+        }
+        if (n == 0)
+            break;
+        total += n;
+    }
 
-int tmp_dump(struct object *obj, char* filename)
-{
-    if (obj == NULL)
+    if (total < LOOSE_OBJECT_BUFFER_SIZE || header_only)
     {
-        open(filename, O_CREAT, 0644);
+        close(save_file_fd);
+        if (total == 0)
+            return FS_ERROR;
+        *data = buffer;
+        *size = total;
         return FS_OK;
     }
 
-    FILE *file = fopen(filename, "w");
-    fwrite(obj->content, obj->size, 1, file);
-    fclose(file);
+    struct stat buffer_stat;
+    if (fstat(save_file_fd, &buffer_stat) != 0)
+    {
+        close(save_file_fd);
+        return FS_ERROR;
+    }
+
+    *data = mmap(NULL, buffer_stat.st_size, PROT_READ, MAP_PRIVATE, save_file_fd, 0);
+    close(save_file_fd);
+    if (*data == MAP_FAILED)
+        return FS_ERROR;
+    *size = buffer_stat.st_size;
 
     return FS_OK;
 }
 
-int dump_tree(char *cwd, struct tree *tree)
+static void release_loose_object(char *buffer, char *data, size_t size)
 {
-    struct entry *current = tree->first_entry;
-    while(current != NULL)
-    {
-        size_t cwd_len = 0;
-        if (*cwd != '\0')
-            cwd_len = strlen(cwd);
-        size_t filename_size = cwd_len + 2 + strlen(current->filename);
-        char filename[filename_size];
-        sprintf(filename, "%s/%s", cwd, current->filename);
-
-        struct object obj = {0};
-        char checksum_str[DIGEST_LENGTH * 2 + 1];
-        hash_to_hexa(current->checksum, checksum_str);
-        read_object(checksum_str, &obj);
+    if (data != buffer)
+        munmap(data, size);
+}
 
-        if(current->type == BLOB)
-        {
-            tmp_dump(&obj, filename);
-        } else if (current->type == TREE) {
-            struct tree subtree = {0};
-            tree_from_object(&subtree, &obj);
+int read_object(char *checksum, struct object *obj)
+{
+    if (open_odb() != FS_OK)
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+    int result = FS_OK;
 
-            create_dir(filename);
-            dump_tree(filename, &subtree);
+    unsigned char raw_checksum[DIGEST_LENGTH];
+    if (hexa_to_hash(checksum, raw_checksum) == 0)
+    {
+        result = read_packed_object(raw_checksum, obj);
+        if (result != OBJECT_DOES_NOT_EXIST)
+            return result;
+    }
 
-            free_tree(&subtree);
-        }
+    char buffer[LOOSE_OBJECT_BUFFER_SIZE];
+    char *compressed;
+    size_t comp_size;
+    result = load_loose_object(checksum, buffer, 0, &compressed, &comp_size);
+    if (result != FS_OK)
+        return result;
 
-        free_object(&obj);
-        current = current->next;
+    if (uncompress_object(obj, compressed, comp_size) != Z_OK)
+    {
+        error_print("Object %s is corrupted", checksum);
+        result = COMPRESSION_ERROR;
     }
+    release_loose_object(buffer, compressed, comp_size);
 
-    return FS_OK;
+    return result;
 }
 
-int load_tree(char* checksum, struct tree *tree)
+/// @brief Read the type and size of an object without its content, header->content is left NULL
+int read_object_info(char *checksum, struct object *header)
 {
-    struct object object;
-    int res = read_object(checksum, &object);
-    if (res != FS_OK)
-        return res;
+    if (open_odb() != FS_OK)
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+    int result = FS_OK;
 
-    if (object.object_type != TREE)
+    unsigned char raw_checksum[DIGEST_LENGTH];
+    if (hexa_to_hash(checksum, raw_checksum) == 0)
     {
-        error_print("Object %s is not a tree", checksum);
-        return WRONG_OBJECT_TYPE;
+        result = packed_object_info(raw_checksum, header);
+        if (result != OBJECT_DOES_NOT_EXIST)
+            return result;
     }
 
-    tree_from_object(tree, &object);
-    free_object(&object);
+    char buffer[LOOSE_OBJECT_BUFFER_SIZE];
+    char *compressed;
+    size_t comp_size;
+    result = load_loose_object(checksum, buffer, 1, &compressed, &comp_size);
+    if (result != FS_OK)
+        return result;
 
-    return 0;
+    if (uncompress_object_header(header, compressed, comp_size) != Z_OK)
+    {
+        error_print("Object %s is corrupted", checksum);
+        result = COMPRESSION_ERROR;
+    }
+    release_loose_object(buffer, compressed, comp_size);
+
+    return result;
 }
 
-int load_index(struct tree *index)
+/// @brief Read an object by chunks, see uncompress_object_stream
+int stream_object(char *checksum, object_chunk_fn callback, void *data)
 {
-    if(!local_repo_exist() || !index_exist())
+    if (open_odb() != FS_OK)
     {
         return REPO_NOT_INITIALIZED;
     }
+    int result = FS_OK;
 
-    FILE* index_file = fopen(INDEX_FILE, "r");
-    struct stat buffer;
-    stat(INDEX_FILE, &buffer);
-
-    char* file_content = calloc(buffer.st_size + 1, sizeof(char));
-    fread(file_content, buffer.st_size, 1, index_file);
-    fclose(index_file);
-
-    object_t obj = { content: file_content, size: buffer.st_size, object_type: TREE };
+    unsigned char raw_checksum[DIGEST_LENGTH];
+    if (hexa_to_hash(checksum, raw_checksum) == 0)
+    {
+        result = stream_packed_object(raw_checksum, callback, data);
+        if (result != OBJECT_DOES_NOT_EXIST)
+            return result;
+    }
 
-    tree_from_object(index, &obj);
+    char buffer[LOOSE_OBJECT_BUFFER_SIZE];
+    char *compressed;
+    size_t comp_size;
+    result = load_loose_object(checksum, buffer, 0, &compressed, &comp_size);
+    if (result != FS_OK)
+        return result;
 
-    free(file_content);
+    if (uncompress_object_stream(compressed, comp_size, callback, data) != Z_OK)
+    {
+        error_print("Object %s is corrupted", checksum);
+        result = COMPRESSION_ERROR;
+    }
+    release_loose_object(buffer, compressed, comp_size);
 
-    return FS_OK;
+    return result;
 }
 
-int save_index(struct tree *tree)
+int remove_object(char *checksum)
 {
-    if(!local_repo_exist())
+    if (open_odb() != FS_OK)
     {
         return REPO_NOT_INITIALIZED;
     }
 
-    FILE *index_file = fopen(INDEX_FILE, "w");
-    if(index_exist == NULL)
-    {
-        return FS_ERROR;
-    }
+    return remove_loose_object(checksum);
+}
 
+int load_tree(char* checksum, struct tree *tree)
+{
     struct object object;
-    tree_to_object(tree, &object);
+    int res = read_object(checksum, &object);
+    if (res != FS_OK)
+        return res;
+
+    if (object.object_type != TREE)
+    {
+        error_print("Object %s is not a tree", checksum);
+        return WRONG_OBJECT_TYPE;
+    }
 
-    fwrite(object.content, object.size, 1, index_file);
-    fclose(index_file);
+    tree_from_object(tree, &object, NULL);
     free_object(&object);
+
+    return 0;
 }
 
 int get_head_commit_checksum(char* checksum)
 {
-    size_t head_size = 0;
-    if(!local_repo_exist() || !head_file_exist(&head_size) || !heads_dir_exist)
+    if(!local_repo_exist())
     {
         return REPO_NOT_INITIALIZED;
     }
 
-    if(head_size == 0) return NO_CURRENT_HEAD;
-
-    FILE *head_file = NULL;
-    head_file = fopen(HEAD_FILE, "r");
-    char head_path[head_size + 1];
-    memset(head_path, 0, head_size + 1);
-    fread(head_path, head_size, 1, head_file);
-    fclose(head_file);
-
-    struct stat buffer = {0};
-    if (stat(head_path, &buffer) != 0) return NO_CURRENT_HEAD;
+    char name[REF_NAME_MAX];
+    int res = read_head_ref(name, sizeof(name));
+    if (res != FS_OK)
+        return res;
 
-    memset(checksum, 0, buffer.st_size + 1);
-    head_file = fopen(head_path, "r");
-    fread(checksum, buffer.st_size, 1, head_file);
-    fclose(head_file);
+    if (read_ref(name, checksum) != FS_OK)
+        return NO_CURRENT_HEAD;
 
-    return 0;
+    return FS_OK;
 }
 
 int get_last_commit(struct object *commit)
@@ -436,292 +606,439 @@ int get_last_commit(struct object *commit)
     return FS_OK;
 }
 
+/// @brief Make the current branch point to new_head, the first commit
+/// creates the master branch
 int update_current_branch_head(char *new_head)
 {
-    size_t head_size = 0;
-    if(!local_repo_exist() || !head_file_exist(&head_size) || !heads_dir_exist)
+    if(!local_repo_exist())
     {
         return REPO_NOT_INITIALIZED;
     }
 
-    FILE *file;
-
-    if(head_size != 0) {
-        FILE *head_file = fopen(HEAD_FILE, "r");
-        char branch[head_size];
-        fread(branch, head_size, 1, head_file);
-        fclose(head_file);
-        file = fopen(branch, "w");        
-    } else 
+    char name[REF_NAME_MAX];
+    int res = read_head_ref(name, sizeof(name));
+    if (res == NO_CURRENT_HEAD)
     {
-        FILE *head_file = fopen(HEAD_FILE, "w");
-        fprintf(head_file, "%s/master", HEADS_DIR);
-        fclose(head_file);
-        file = fopen(HEADS_DIR"/master", "w");
+        strcpy(name, HEADS_PREFIX"master");
+        res = write_head_ref(name);
     }
+    if (res != FS_OK)
+        return res;
 
-    fwrite(new_head, strlen(new_head), 1, file);
-    fclose(file);
-    return 0;
+    return write_ref(name, new_head);
 }
 
 int branch_exist(char *branch)
 {
-    if(!local_repo_exist() || !heads_dir_exist())
+    if(!local_repo_exist())
         return REPO_NOT_INITIALIZED;
 
-    DIR *dir = opendir(HEADS_DIR);
-    struct dirent *ent;
-    if (dir != NULL) 
-    {
-        while((ent = readdir(dir)) != NULL)
-        {   
-            if (strcmp(ent->d_name, branch) == 0)
-            {
-                closedir(dir);
-                return 1;
-            }
-        }
-
-        closedir(dir);
-    } else
-        return FS_ERROR;
-    
-    return 0;
+    char name[strlen(HEADS_PREFIX) + strlen(branch) + 1];
+    sprintf(name, "%s%s", HEADS_PREFIX, branch);
+    char checksum[HEX_LENGTH + 1];
+    return read_ref(name, checksum) == FS_OK;
 }
 
+/// @brief Create a branch on the current commit and make it the current branch
 int new_branch(char* branch_name)
 {
+    char name[strlen(HEADS_PREFIX) + strlen(branch_name) + 1];
+    sprintf(name, "%s%s", HEADS_PREFIX, branch_name);
+    if (check_ref_name(name) != FS_OK)
+        return INVALID_REF_NAME;
+
     if(branch_exist(branch_name))
         return BRANCH_ALREADY_EXIST;
 
-    char path[strlen(HEADS_DIR) + strlen(branch_name) + 2];
-    sprintf(path, "%s/%s", HEADS_DIR, branch_name);
-
-    char old_head[DIGEST_LENGTH * 2 + 1];
-    get_head_commit_checksum(old_head);
-
-    FILE *branch_head = fopen(path, "w");
-    fprintf(branch_head, "%s", old_head);
-    fclose(branch_head);
+    char old_head[HEX_LENGTH + 1];
+    int res = get_head_commit_checksum(old_head);
+    if (res != FS_OK)
+        return res;
 
-    FILE *head_file = fopen(HEAD_FILE, "w");
-    fprintf(head_file, "%s", path);
-    fclose(head_file);
+    res = write_ref(name, old_head);
+    if (res != FS_OK)
+        return res;
 
-    return FS_OK;
+    return write_head_ref(name);
 }
 
+/// @brief Make the working tree match a commit, discarding the local changes
+/// to tracked files
 int reset_to(char* commit_checksum)
 {
-    int res = diff_commit_with_working_tree(commit_checksum, 0);
-    if(res != FS_OK)
-        return res;
-
-    FILE *p = popen("patch -p0 -R < "LOCAL_REPO"/last.diff > /dev/null", "w");
-    pclose(p);
-
-    return FS_OK;
+    return checkout_commit(commit_checksum, checkout_worker_count(), 1);
 }
 
 int checkout_branch(char *branch)
 {
-    if(!branch_exist(branch))
+    char name[strlen(HEADS_PREFIX) + strlen(branch) + 1];
+    sprintf(name, "%s%s", HEADS_PREFIX, branch);
+
+    char commit_checksum[HEX_LENGTH + 1];
+    if (read_ref(name, commit_checksum) != FS_OK)
     {
         return BRANCH_DOES_NOT_EXIST;
     }
 
-    char branch_path[strlen(HEADS_DIR) + strlen(branch) + 2];
-    sprintf(branch_path, "%s/%s", HEADS_DIR, branch);
-
-    char commit_checksum[DIGEST_LENGTH * 2 + 1] = {0};
-    FILE *branch_head = fopen(branch_path, "r");
-    fread(commit_checksum, DIGEST_LENGTH * 2, 1, branch_head);
-    fclose(branch_head);
-
     debug_print("Checking out on %s", commit_checksum);
-    reset_to(commit_checksum);
+    int res = checkout_commit(commit_checksum, checkout_worker_count(), 0);
+    if (res != FS_OK)
+        return res;
 
-    FILE *head_file = fopen(HEAD_FILE, "w");
-    fprintf(head_file, "%s", branch_path);
-    fclose(head_file);
+    return write_head_ref(name);
 }
 
-int is_file_ignored(char *filename)
+struct staged_file {
+    char *filename;
+    unsigned char checksum[DIGEST_LENGTH];
+    struct stat st;
+};
+
+struct staged_files {
+    struct staged_file *files;
+    size_t count;
+    size_t capacity;
+};
+
+struct add_context {
+    index_t *index;
+    // One list per worker so they never contend on it
+    struct staged_files *staged;
+    pthread_mutex_t error_lock;
+    int error;
+};
+
+static void add_path_job(struct workqueue *queue, int worker, void *arg);
+
+static void set_add_error(struct add_context *context, int error)
 {
-    struct stat buffer = {0};
-    if (stat(IGNORE_FILE, &buffer) != 0)
-    {
-        return 0;
-    }
-    char content[buffer.st_size + 1];
-    memset(content, 0, buffer.st_size + 1);
-    FILE *ignore_file = fopen(IGNORE_FILE, "r");
-    fread(content, buffer.st_size, 1, ignore_file);
-    fclose(ignore_file);    
+    pthread_mutex_lock(&context->error_lock);
+    if (context->error == FS_OK)
+        context->error = error;
+    pthread_mutex_unlock(&context->error_lock);
+}
 
-    int i = 0;
-    for(; filename[i] != '/'; i ++);
+static void add_directory(struct workqueue *queue, int worker, char *dirname)
+{
+    DIR *dp = opendir(dirname);
+    if (dp == NULL)
+        return;
 
-    char *current_line = strtok(content, "\n");
-    
-    while(current_line != NULL)
+    struct dirent *ep;
+    while ((ep = readdir(dp)) != NULL)
     {
-        if(strncmp(current_line, filename, i-1) == 0)
+        if (strcmp(ep->d_name, "..") == 0 || strcmp(ep->d_name, ".") == 0)
+            continue;
+
+        char *path = malloc(strlen(ep->d_name) + strlen(dirname) + 2);
+        if (strcmp(dirname, "./") == 0 || strcmp(dirname, ".") == 0)
+            sprintf(path, "%s", ep->d_name);
+        else if(dirname[strlen(dirname) - 1] == '/')
+            sprintf(path, "%s%s", dirname, ep->d_name);
+        else
+            sprintf(path, "%s/%s", dirname, ep->d_name);
+
+        int is_dir = ep->d_type == DT_DIR;
+        struct stat st;
+        if (ep->d_type == DT_UNKNOWN && stat(path, &st) == 0)
+            is_dir = S_ISDIR(st.st_mode);
+
+        // Ignored directories are not descended into
+        if (strcmp(path, LOCAL_REPO) == 0 || is_path_ignored(path, is_dir))
         {
-            return 1;
+            free(path);
+            continue;
         }
-        char alt[strlen(current_line) + 3];
-        sprintf(alt, "./%s", current_line);
-        if(strncmp(alt, filename, strlen(alt)) == 0)
-            return 1;
-        current_line = strtok(NULL, "\n");
+        push_work(queue, worker, add_path_job, path);
     }
 
-    return 0;
+    closedir(dp);
 }
 
-int add_file_to_index(struct tree *index, char *filename)
+/// @brief Job of the add worker pool: a directory pushes a job for each of its
+/// files, a file is hashed and written to the object store
+static void add_path_job(struct workqueue *queue, int worker, void *arg)
 {
-    if (is_file_ignored(filename)) {
-        return 0;
-    }
-    struct stat st = {0};
+    struct add_context *context = queue->data;
+    char *filename = arg;
+
+    struct stat st;
     if (stat(filename, &st) != 0)
     {
-        return FILE_NOT_FOUND;
+        free(filename);
+        return;
     }
+
     if (S_ISDIR(st.st_mode))
     {
-        DIR *dp;
-        struct dirent *ep;
-        dp = opendir(filename);
-        if (dp != NULL)
-        {
-            while ((ep = readdir(dp)) != NULL)
-            {
-                if (strcmp(ep->d_name, "..") != 0 && strcmp(ep->d_name, ".") != 0)
-                {
-                    char path[strlen(ep->d_name) + strlen(filename) + 2];
-                    if (strcmp(filename, "./") == 0)
-                        sprintf(path, "%s", ep->d_name);
-                    else if (strcmp(filename, ".") == 0)
-                        sprintf(path, "%s", ep->d_name);
-                    else if(filename[strlen(filename) - 1] == '/')
-                        sprintf(path, "%s%s", filename, ep->d_name);
-                    else
-                        sprintf(path, "%s/%s", filename, ep->d_name);
-                    add_file_to_index(index, path);
-                }
-            }
-            
-            closedir(dp);
-            return 0;
-        }
-    } else {
-        enum file_mode mode = REG_NONX_FILE;
-        if(S_ISLNK(st.st_mode))
-            mode = SYM_LINK;
-        if (st.st_mode & S_IXUSR == S_IXUSR)
-            mode = REG_EXE_FILE;
-        if (add_to_index(index, filename, mode) == FILE_NOT_FOUND)
-            return FILE_NOT_FOUND;
+        add_directory(queue, worker, filename);
+        free(filename);
+        return;
     }
+
+    struct staged_files *staged = &context->staged[worker];
+    if (staged->count == staged->capacity)
+    {
+        staged->capacity = staged->capacity == 0 ? 64 : staged->capacity * 2;
+        staged->files = realloc(staged->files, staged->capacity * sizeof(struct staged_file));
+    }
+
+    struct staged_file *file = &staged->files[staged->count];
+    int result = stage_file(context->index, filename, &st, file->checksum);
+    if (result != FS_OK)
+    {
+        if (result != ENTRY_UNCHANGED)
+            set_add_error(context, result);
+        free(filename);
+        return;
+    }
+
+    file->filename = filename;
+    file->st = st;
+    staged->count++;
 }
 
-int remove_file_from_index(struct tree *index, char *filename)
+static void push_untracked_job(char *path, void *data)
 {
-    if (is_file_ignored(filename))
-        return 0;
+    push_work(data, 0, add_path_job, strdup(path));
+}
+
+/// @brief Push a job for each file of dirname: the tracked ones are taken from
+/// the index, the untracked ones from its untracked cache, so only the
+/// directories that changed since the last scan are read
+static void push_directory_jobs(struct workqueue *queue, index_t *index, char *dirname)
+{
+    size_t len = strlen(dirname);
+    while (len > 0 && dirname[len - 1] == '/')
+        len--;
+    char dir[len + 1];
+    memcpy(dir, dirname, len);
+    dir[len] = '\0';
+    if (strcmp(dir, ".") == 0)
+        dir[0] = '\0';
+
+    tree_t *entries = &index->entries;
+    for (size_t i = 0; i < entries->entries_size; i++)
+    {
+        // Files the fsmonitor did not see changing are left as they are
+        if (index->fsmonitor_active && entries->entries[i].fsmonitor_valid)
+            continue;
+
+        char *filename = entries->entries[i].filename;
+        if (*dir == '\0' || (strncmp(filename, dir, len) == 0 && filename[len] == '/'))
+            push_work(queue, 0, add_path_job, strdup(filename));
+    }
+
+    list_untracked_files(index, dir, 0, push_untracked_job, queue);
+}
+
+static int compare_staged_files(const void *a, const void *b)
+{
+    return strcmp(((struct staged_file *)a)->filename, ((struct staged_file *)b)->filename);
+}
+
+/// @brief Add filename to the index, or every file under it if it is a directory
+/// The files of a directory are found through the index and its untracked cache.
+/// Files are hashed and written by a pool of threads, the index is then
+/// updated in path order so the result does not depend on the scheduling
+/// @param threads number of threads hashing files, see default_thread_count
+int add_file_to_index(index_t *index, char *filename, int threads)
+{
+    while (strncmp(filename, "./", 2) == 0 && filename[2] != '\0')
+        filename += 2;
 
     struct stat st = {0};
     if (stat(filename, &st) != 0)
+    {
         return FILE_NOT_FOUND;
+    }
+    if (strcmp(filename, LOCAL_REPO) == 0 || is_path_ignored(filename, S_ISDIR(st.st_mode))) {
+        return 0;
+    }
+
+    // Workers look entries up concurrently, which must not sort the index
+    sort_tree(&index->entries);
+
+    struct add_context context = {
+        .index = index,
+        .error = FS_OK,
+    };
+    pthread_mutex_init(&context.error_lock, NULL);
+
+    struct workqueue queue;
+    init_workqueue(&queue, threads, &context);
+    context.staged = calloc(queue.threads, sizeof(struct staged_files));
+
     if (S_ISDIR(st.st_mode))
     {
-        DIR *dp;
-        struct dirent *ep;
-        dp = opendir(filename);
-        if (dp != NULL)
-        {
-            while ((ep = readdir(dp)) != NULL)
-            {
-                if (strcmp(ep->d_name, "..") != 0 && strcmp(ep->d_name, ".") != 0)
-                {
-                    char path[strlen(ep->d_name) + strlen(filename) + 2];
-                    if (strcmp(filename, "./") == 0)
-                        sprintf(path, "%s", ep->d_name);
-                    else if(filename[strlen(filename) - 1] == '/')
-                        sprintf(path, "%s%s", filename, ep->d_name);
-                    else
-                        sprintf(path, "%s/%s", filename, ep->d_name);
-                    remove_file_from_index(index, path);
-                }
-            }
-            
-            closedir(dp);
-            return 0;
-        }
-    } else {
-        remove_from_tree(index, filename, 1);
+        push_directory_jobs(&queue, index, filename);
+    } else
+    {
+        char *path = malloc(strlen(filename) + 1);
+        strcpy(path, filename);
+        push_work(&queue, 0, add_path_job, path);
+    }
+    run_workqueue(&queue);
+
+    size_t count = 0;
+    for (int i = 0; i < queue.threads; i++)
+        count += context.staged[i].count;
+
+    struct staged_file *files = malloc((count == 0 ? 1 : count) * sizeof(struct staged_file));
+    size_t offset = 0;
+    for (int i = 0; i < queue.threads; i++)
+    {
+        memcpy(files + offset, context.staged[i].files, context.staged[i].count * sizeof(struct staged_file));
+        offset += context.staged[i].count;
+        free(context.staged[i].files);
     }
+    qsort(files, count, sizeof(struct staged_file), compare_staged_files);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        set_index_entry(index, files[i].filename, files[i].checksum, &files[i].st);
+        free(files[i].filename);
+    }
+    sort_tree(&index->entries);
+
+    free(files);
+    free(context.staged);
+    free_workqueue(&queue);
+    pthread_mutex_destroy(&context.error_lock);
+
+    return context.error;
 }
 
-int dump_log()
+/// @brief Remove filename from the index, or every file under it if it is a
+/// directory. It also works on files that no longer exist.
+int remove_file_from_index(index_t *index, char *filename)
 {
-    struct object current_obj = {0};
-    get_last_commit(&current_obj);
+    while (strncmp(filename, "./", 2) == 0)
+        filename += 2;
 
-    if (current_obj.size == 0)
-        return 0;
+    size_t len = strlen(filename);
+    while (len > 0 && filename[len - 1] == '/')
+        len--;
+    if (len == 1 && filename[0] == '.')
+        len = 0;
 
-    struct commit current = {0};
-    commit_from_object(&current, &current_obj);
+    tree_t *entries = &index->entries;
+    sort_tree(entries);
 
-    FILE *log_file = fopen(LOG_FILE, "w");
-    char checksum[DIGEST_LENGTH * 2 + 1];
-    hash_object_str(&current_obj, checksum);
-    fprintf(log_file, "commit %s HEAD\n", checksum);
-    fprintf(log_file, "Author: \t%s\n", current.author);
-    fprintf(log_file, "\n\t%s\n", current.message);
-
-    while (current.parent != NULL)
+    size_t kept = 0;
+    for (size_t i = 0; i < entries->entries_size; i++)
     {
-        free_object(&current_obj);
-        read_object(current.parent, &current_obj);
-        free_commit(&current);
-        commit_from_object(&current, &current_obj);
-
-        checksum[DIGEST_LENGTH * 2 + 1];
-        hash_object_str(&current_obj, checksum);
-        fprintf(log_file, "commit %s\n", checksum);
-        fprintf(log_file, "Author: \t%s\n", current.author);
-        fprintf(log_file, "\t%s\n", current.message);
+        entry_t *current = &entries->entries[i];
+        if (len == 0 || (strncmp(current->filename, filename, len) == 0
+            && (current->filename[len] == '\0' || current->filename[len] == '/')))
+            continue;
+        entries->entries[kept++] = *current;
     }
-    fclose(log_file);
-    return 0;
+
+    size_t removed = entries->entries_size - kept;
+    entries->entries_size = kept;
+    entries->sorted_size = kept;
+
+    char path[len + 1];
+    memcpy(path, filename, len);
+    path[len] = '\0';
+    invalidate_index_path(index, path);
+
+    return removed > 0 ? FS_OK : ENTRY_NOT_FOUND;
 }
 
-int dump_branches()
+static void print_log_entry(FILE *out, char *checksum, commit_t *commit, struct log_options *options)
 {
-    if(!heads_dir_exist())
+    char *message = commit->message == NULL ? "" : commit->message;
+    if (options->oneline)
     {
-        return REPO_NOT_INITIALIZED;
+        size_t title_len = strcspn(message, "\n");
+        fprintf(out, "%s %.*s\n", checksum, (int)title_len, message);
+        return;
     }
 
-    DIR *heads_dir = opendir(HEADS_DIR);
-    struct dirent *ep;
-    FILE *dump = fopen(TMP"/branches", "w");
-    if (heads_dir != NULL)
+    fprintf(out, "commit %s\n", checksum);
+    if (commit->author != NULL)
+        fprintf(out, "Author: \t%.*s\n", (int)ident_name_length(commit->author), commit->author);
+    time_t date = commit_time(commit);
+    if (date != 0)
+        fprintf(out, "Date: \t%s", ctime(&date));
+    size_t message_len = strlen(message);
+    while (message_len > 0 && message[message_len - 1] == '\n')
+        message_len--;
+    fprintf(out, "\n\t%.*s\n\n", (int)message_len, message);
+}
+
+/// @brief Print the history of HEAD to out while walking it
+/// The walk stops as soon as options->max_count commits were printed or a
+/// commit older than options->since is met. The parents and times are taken
+/// from the commit graph when the commits are in it, the objects are only
+/// read for the commits that are printed
+int print_log(struct log_options *options, FILE *out)
+{
+    char checksum[DIGEST_LENGTH * 2 + 1];
+    int res = get_head_commit_checksum(checksum);
+    if (res == NO_CURRENT_HEAD)
+        return FS_OK;
+    if (res != FS_OK)
+        return res;
+
+    unsigned char current[DIGEST_LENGTH];
+    if (hexa_to_hash(checksum, current) != 0)
+        return FS_OK;
+
+    struct commit_graph graph;
+    load_commit_graph(&graph);
+    struct arena arena = {0};
+    long printed = 0;
+    while (options->max_count < 0 || printed < options->max_count)
     {
-        while ((ep = readdir(heads_dir)) != NULL)
+        uint32_t position;
+        struct commit_info info;
+        int in_graph = find_graph_commit(&graph, current, &position);
+        if (in_graph)
         {
-            if (strcmp(ep->d_name, "..") != 0 && strcmp(ep->d_name, ".") != 0)
-                fprintf(dump, "%s\n", ep->d_name);
+            get_graph_commit(&graph, position, &info);
+            // Commits are walked from the newest, the older ones need not be read
+            if (options->since != 0 && info.time < options->since)
+                break;
         }
-        fclose(dump);
-        closedir(heads_dir);
-        return 0;
-    } else 
-        return FS_ERROR;
-}
\ No newline at end of file
+
+        hash_to_hexa(current, checksum);
+        object_t current_obj = {0};
+        if (read_object(checksum, &current_obj) != FS_OK)
+            break;
+
+        // Only one commit is alive at a time, its memory is reused for the next
+        commit_t commit = {0};
+        commit_from_object(&commit, &current_obj, &arena);
+        if (options->since != 0 && commit_time(&commit) < options->since)
+        {
+            free_object(&current_obj);
+            break;
+        }
+
+        print_log_entry(out, checksum, &commit, options);
+        printed++;
+
+        int has_parent;
+        if (in_graph)
+        {
+            has_parent = info.has_parent;
+            memcpy(current, info.parent, DIGEST_LENGTH);
+        } else
+        {
+            has_parent = commit.parent != NULL && hexa_to_hash(commit.parent, current) == 0;
+        }
+        free_object(&current_obj);
+        clear_arena(&arena);
+
+        // The pager was closed
+        if (!has_parent || ferror(out))
+            break;
+    }
+
+    free_arena(&arena);
+    free_commit_graph(&graph);
+    return FS_OK;
+}
@@ -1,16 +1,30 @@
 #ifndef FS_H
 #define FS_H 1
 
+#include <stdio.h>
+#include <time.h>
+
+#include "index.h"
+#include "objects.h"
 #include "types.h"
 
 #define LOCAL_REPO ".cgit"
 #define INDEX_FILE LOCAL_REPO"/index"
+#define INDEX_LOCK_FILE INDEX_FILE".lock"
 #define OBJECTS_DIR LOCAL_REPO"/objects"
+#define PACK_DIR OBJECTS_DIR"/pack"
+#define INFO_DIR OBJECTS_DIR"/info"
+#define COMMIT_GRAPH_FILE INFO_DIR"/commit-graph"
+#define COMMIT_GRAPH_LOCK_FILE COMMIT_GRAPH_FILE".lock"
 #define REFS_DIR LOCAL_REPO"/refs"
 #define HEADS_DIR REFS_DIR"/heads"
 #define HEAD_FILE LOCAL_REPO"/HEAD"
+#define PACKED_REFS_FILE LOCAL_REPO"/packed-refs"
+#define FSMONITOR_SOCKET LOCAL_REPO"/fsmonitor.sock"
 #define IGNORE_FILE ".gitignore"
-#define LOG_FILE LOCAL_REPO"/log"
+#define TMP_OBJECT_TEMPLATE OBJECTS_DIR"/tmp_obj_XXXXXX"
+#define TMP_PACK_TEMPLATE PACK_DIR"/tmp_pack_XXXXXX"
+#define TMP_IDX_TEMPLATE PACK_DIR"/tmp_idx_XXXXXX"
 
 #define TMP "/tmp"
 
@@ -30,6 +44,14 @@
 #define ENTRY_NOT_FOUND (-31)
 #define NO_CURRENT_HEAD (-40)
 
+struct log_options {
+    // Number of commits to print, -1 for no limit
+    long max_count;
+    int oneline;
+    // Commits older than since (seconds since epoch) are not printed, 0 for no limit
+    time_t since;
+};
+
 int local_repo_exist();
 int index_exist();
 
@@ -38,31 +60,28 @@ int init_repo();
 int blob_from_file(char *filename, struct object *object);
 
 int write_object(struct object *obj);
+int write_blob_from_file(char *filename, unsigned char *checksum);
+int hash_blob_from_file(char *filename, unsigned char *checksum);
 int read_object(char *checksum, struct object *obj);
+int read_object_info(char *checksum, struct object *header);
+int stream_object(char *checksum, object_chunk_fn callback, void *data);
 int remove_object(char *checksum);
 
-int save_index(struct tree *tree);
-int load_index(struct tree *index);
-int add_file_to_index(struct tree *index, char *filename);
-int remove_file_from_index(struct tree *index, char *filename);
+int add_file_to_index(index_t *index, char *filename, int threads);
+int remove_file_from_index(index_t *index, char *filename);
 
 int load_tree(char* checksum, struct tree *tree);
 
+int get_head_commit_checksum(char* checksum);
 int update_current_branch_head(char *new_head);
 int get_last_commit(struct object *commit);
 
-int tmp_dump(struct object *obj, char* filename);
-int init_tmp_diff_dir(char* dir);
 
 int new_branch(char* branch_name);
 int checkout_branch(char *branch);
 
 int reset_to(char* commit_checksum);
 
-int create_dir(char *dir);
-void remove_dir(char *dir);
-int dump_tree(char *cwd, struct tree *tree);
-int dump_log();
-int dump_branches();
+int print_log(struct log_options *options, FILE *out);
 
 #endif // FS_H
@@ -0,0 +1,575 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "fsmonitor.h"
+#include "includes.h"
+#include "index.h"
+#include "tree.h"
+#include "untracked_cache.h"
+
+#define FSMONITOR_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM \
+                          | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct journal_entry {
+    uint64_t seq;
+    char *path;
+};
+
+struct fsmonitor {
+    int inotify_fd;
+    int socket_fd;
+    // Path of the directory of each watch descriptor, NULL when unused
+    char **watches;
+    size_t watches_size;
+    // Sorted by sequence number
+    struct journal_entry *journal;
+    size_t journal_size;
+    size_t journal_capacity;
+    uint64_t seq;
+    char id[64];
+};
+
+static int connect_fsmonitor()
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strncpy(address.sun_path, FSMONITOR_SOCKET, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/// @brief Send request to the daemon and read its whole response
+/// @param response set to the response, to be freed by the caller
+static int fsmonitor_request(char *request, char **response, size_t *response_size)
+{
+    int fd = connect_fsmonitor();
+    if (fd == -1)
+        return FSMONITOR_NOT_RUNNING;
+
+    size_t len = strlen(request);
+    if (send(fd, request, len, MSG_NOSIGNAL) != (ssize_t)len || send(fd, "\n", 1, MSG_NOSIGNAL) != 1)
+    {
+        close(fd);
+        return FS_ERROR;
+    }
+    shutdown(fd, SHUT_WR);
+
+    size_t size = 0, capacity = 4096;
+    char *data = malloc(capacity);
+    ssize_t n;
+    while ((n = read(fd, data + size, capacity - size)) > 0)
+    {
+        size += n;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    close(fd);
+
+    if (n < 0)
+    {
+        free(data);
+        return FS_ERROR;
+    }
+
+    *response = data;
+    *response_size = size;
+    return FS_OK;
+}
+
+int fsmonitor_is_running()
+{
+    int fd = connect_fsmonitor();
+    if (fd == -1)
+        return 0;
+
+    close(fd);
+    return 1;
+}
+
+/// @brief Check again, despite the fsmonitor, the entries of path and below it
+static void invalidate_fsmonitor_path(index_t *index, char *path)
+{
+    tree_t *entries = &index->entries;
+    size_t len = strlen(path);
+
+    // First entry not before path, the ones below it follow
+    size_t low = 0, high = entries->entries_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(entries->entries[mid].filename, path) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for (size_t i = low; i < entries->entries_size; i++)
+    {
+        char *filename = entries->entries[i].filename;
+        if (strncmp(filename, path, len) != 0)
+            break;
+        // "a-b" sorts between "a" and "a/"
+        if (filename[len] != '\0' && filename[len] != '/')
+        {
+            if (filename[len] < '/')
+                continue;
+            break;
+        }
+        entries->entries[i].fsmonitor_valid = 0;
+    }
+
+    if (index->untracked != NULL)
+        invalidate_untracked_fsmonitor(index->untracked, path);
+}
+
+/// @brief Ask the daemon which paths changed since the token of the index, and
+/// mark them to be checked. The other paths marked as fsmonitor_valid are
+/// trusted until the end of the command
+/// @return 1 if the token changed, 0 if it did not, FSMONITOR_NOT_RUNNING when
+/// no daemon answered, in which case every path is checked
+int refresh_fsmonitor(index_t *index)
+{
+    char *response = NULL;
+    size_t size = 0;
+    int res = fsmonitor_request(index->fsmonitor_token == NULL ? "" : index->fsmonitor_token, &response, &size);
+    if (res != FS_OK)
+        return res;
+
+    char *end = response + size;
+    char *token = response;
+    char *token_end = memchr(token, '\0', size);
+    if (token_end == NULL || token_end + 2 >= end || token_end[2] != '\0')
+    {
+        free(response);
+        return FS_ERROR;
+    }
+
+    tree_t *entries = &index->entries;
+    sort_tree(entries);
+    if (token_end[1] == '1' || index->fsmonitor_token == NULL)
+    {
+        for (size_t i = 0; i < entries->entries_size; i++)
+            entries->entries[i].fsmonitor_valid = 0;
+        if (index->untracked != NULL)
+        {
+            for (size_t i = 0; i < index->untracked->dirs_size; i++)
+                index->untracked->dirs[i].fsmonitor_valid = 0;
+            index->untracked->changed = 1;
+        }
+    } else
+    {
+        for (char *path = token_end + 3; path < end; path += strlen(path) + 1)
+        {
+            if (memchr(path, '\0', end - path) == NULL)
+                break;
+            invalidate_fsmonitor_path(index, path);
+        }
+    }
+
+    int changed = index->fsmonitor_token == NULL || strcmp(index->fsmonitor_token, token) != 0;
+    free(index->fsmonitor_token);
+    index->fsmonitor_token = strdup(token);
+    index->fsmonitor_active = 1;
+    free(response);
+    return changed;
+}
+
+/// @brief Stop the daemon of the repository
+int stop_fsmonitor()
+{
+    char *response = NULL;
+    size_t size = 0;
+    int res = fsmonitor_request(FSMONITOR_QUIT, &response, &size);
+    if (res != FS_OK)
+        return res;
+
+    free(response);
+    return FS_OK;
+}
+
+static void new_journal_id(struct fsmonitor *monitor)
+{
+    static unsigned int generation = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(monitor->id, sizeof(monitor->id), "%x.%lx.%lx.%x", getpid(), (long)now.tv_sec, (long)now.tv_nsec,
+             generation++);
+}
+
+/// @brief Forget the journal, the tokens given until now become unknown
+static void reset_journal(struct fsmonitor *monitor)
+{
+    for (size_t i = 0; i < monitor->journal_size; i++)
+        free(monitor->journal[i].path);
+    monitor->journal_size = 0;
+    new_journal_id(monitor);
+}
+
+static void add_to_journal(struct fsmonitor *monitor, char *path)
+{
+    monitor->seq++;
+
+    // A file being written sends many events in a row
+    if (monitor->journal_size > 0 && strcmp(monitor->journal[monitor->journal_size - 1].path, path) == 0)
+    {
+        monitor->journal[monitor->journal_size - 1].seq = monitor->seq;
+        return;
+    }
+
+    if (monitor->journal_size == FSMONITOR_JOURNAL_MAX)
+        reset_journal(monitor);
+
+    if (monitor->journal_size == monitor->journal_capacity)
+    {
+        monitor->journal_capacity = monitor->journal_capacity == 0 ? 1024 : monitor->journal_capacity * 2;
+        monitor->journal = realloc(monitor->journal, monitor->journal_capacity * sizeof(struct journal_entry));
+    }
+
+    monitor->journal[monitor->journal_size++] = (struct journal_entry) { .seq = monitor->seq, .path = strdup(path) };
+}
+
+static void join_path(char *path, char *dir, char *name)
+{
+    if (*dir == '\0')
+        sprintf(path, "%s", name);
+    else
+        sprintf(path, "%s/%s", dir, name);
+}
+
+/// @brief Watch dir and every directory below it
+/// @param journal add everything found to the journal, for a directory that
+/// appeared after the daemon started
+/// @return FS_ERROR when a directory could not be watched, e.g. once
+/// max_user_watches is reached, the daemon would then miss its changes
+static int watch_directory(struct fsmonitor *monitor, char *dir, int journal)
+{
+    int wd = inotify_add_watch(monitor->inotify_fd, *dir == '\0' ? "." : dir, FSMONITOR_EVENTS | IN_ONLYDIR);
+    if (wd == -1)
+    {
+        // Removed in the meantime, its parent reports it
+        if (errno == ENOENT || errno == ENOTDIR)
+            return FS_OK;
+        return FS_ERROR;
+    }
+
+    if ((size_t)wd >= monitor->watches_size)
+    {
+        size_t size = monitor->watches_size == 0 ? 64 : monitor->watches_size;
+        while (size <= (size_t)wd)
+            size *= 2;
+        monitor->watches = realloc(monitor->watches, size * sizeof(char *));
+        memset(monitor->watches + monitor->watches_size, 0, (size - monitor->watches_size) * sizeof(char *));
+        monitor->watches_size = size;
+    }
+    free(monitor->watches[wd]);
+    monitor->watches[wd] = strdup(dir);
+
+    DIR *dp = opendir(*dir == '\0' ? "." : dir);
+    if (dp == NULL)
+        return errno == ENOENT || errno == ENOTDIR ? FS_OK : FS_ERROR;
+
+    int res = FS_OK;
+    struct dirent *ep;
+    while (res == FS_OK && (ep = readdir(dp)) != NULL)
+    {
+        if (strcmp(ep->d_name, "..") == 0 || strcmp(ep->d_name, ".") == 0)
+            continue;
+
+        char path[strlen(dir) + strlen(ep->d_name) + 2];
+        join_path(path, dir, ep->d_name);
+        if (strcmp(path, LOCAL_REPO) == 0)
+            continue;
+
+        if (journal)
+            add_to_journal(monitor, path);
+
+        int is_dir = ep->d_type == DT_DIR;
+        struct stat st;
+        if (ep->d_type == DT_UNKNOWN && lstat(path, &st) == 0)
+            is_dir = S_ISDIR(st.st_mode);
+        if (is_dir)
+            res = watch_directory(monitor, path, journal);
+    }
+
+    closedir(dp);
+    return res;
+}
+
+/// @brief Stop watching path and the directories below it, which moved away
+static void unwatch_directory(struct fsmonitor *monitor, char *path)
+{
+    size_t len = strlen(path);
+    for (size_t wd = 0; wd < monitor->watches_size; wd++)
+    {
+        char *current = monitor->watches[wd];
+        if (current == NULL || strncmp(current, path, len) != 0 || (current[len] != '\0' && current[len] != '/'))
+            continue;
+
+        inotify_rm_watch(monitor->inotify_fd, wd);
+        free(current);
+        monitor->watches[wd] = NULL;
+    }
+}
+
+/// @brief Add the pending inotify events to the journal
+/// When events were dropped, the journal is reset and the whole tree is
+/// watched again, as the directories created meanwhile are not watched yet
+/// @return -1 when the working tree itself went away or a directory could not
+/// be watched, the daemon must then stop answering
+static int read_events(struct fsmonitor *monitor)
+{
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(monitor->inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *ptr = buffer; ptr < buffer + n; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len)
+        {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                reset_journal(monitor);
+                if (watch_directory(monitor, "", 0) != FS_OK)
+                    return -1;
+                continue;
+            }
+
+            if (event->wd < 0 || (size_t)event->wd >= monitor->watches_size || monitor->watches[event->wd] == NULL)
+                continue;
+            char *dir = monitor->watches[event->wd];
+
+            if (event->mask & IN_IGNORED)
+            {
+                free(dir);
+                monitor->watches[event->wd] = NULL;
+                continue;
+            }
+
+            if (event->len == 0 || event->name[0] == '\0')
+            {
+                // The working tree was removed or moved
+                if (*dir == '\0' && (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+                    return -1;
+                if (*dir != '\0')
+                    add_to_journal(monitor, dir);
+                continue;
+            }
+
+            char path[strlen(dir) + strlen(event->name) + 2];
+            join_path(path, dir, event->name);
+            if (strcmp(path, LOCAL_REPO) == 0)
+                continue;
+
+            add_to_journal(monitor, path);
+            if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM))
+                unwatch_directory(monitor, path);
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))
+                && watch_directory(monitor, path, 1) != FS_OK)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/// @brief Answer the request of a client
+/// @return 1 when the daemon was asked to stop or cannot answer any more
+static int answer_client(struct fsmonitor *monitor, int fd)
+{
+    struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[256];
+    size_t size = 0;
+    ssize_t n;
+    while (size < sizeof(request) - 1 && (n = read(fd, request + size, sizeof(request) - 1 - size)) > 0)
+    {
+        size += n;
+        if (memchr(request, '\n', size) != NULL)
+            break;
+    }
+    request[size] = '\0';
+    request[strcspn(request, "\n")] = '\0';
+
+    if (strcmp(request, FSMONITOR_QUIT) == 0)
+        return 1;
+
+    // Changes made before the request must be in the answer
+    if (read_events(monitor) != 0)
+        return 1;
+
+    char token[sizeof(monitor->id) + 32];
+    int token_len = sprintf(token, "%s:%lu", monitor->id, (unsigned long)monitor->seq);
+
+    FILE *out = fdopen(dup(fd), "w");
+    if (out == NULL)
+        return 0;
+    fwrite(token, 1, token_len + 1, out);
+
+    char *separator = strrchr(request, ':');
+    size_t id_len = separator == NULL ? 0 : (size_t)(separator - request);
+    if (separator == NULL || id_len != strlen(monitor->id) || strncmp(request, monitor->id, id_len) != 0)
+    {
+        fwrite("1", 1, 2, out);
+    } else
+    {
+        fwrite("0", 1, 2, out);
+        uint64_t since = strtoull(separator + 1, NULL, 10);
+
+        // First change after the token
+        size_t low = 0, high = monitor->journal_size;
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            if (monitor->journal[mid].seq <= since)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        for (size_t i = low; i < monitor->journal_size; i++)
+            fwrite(monitor->journal[i].path, 1, strlen(monitor->journal[i].path) + 1, out);
+    }
+    fclose(out);
+
+    return 0;
+}
+
+static void run_fsmonitor(struct fsmonitor *monitor)
+{
+    struct pollfd fds[2] = {
+        { .fd = monitor->inotify_fd, .events = POLLIN },
+        { .fd = monitor->socket_fd, .events = POLLIN },
+    };
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        if ((fds[0].revents & POLLIN) && read_events(monitor) != 0)
+            return;
+
+        if (fds[1].revents & POLLIN)
+        {
+            int fd = accept(monitor->socket_fd, NULL, NULL);
+            if (fd == -1)
+                continue;
+
+            int quit = answer_client(monitor, fd);
+            close(fd);
+            if (quit)
+                return;
+        }
+    }
+}
+
+/// @brief Body of the daemon, it only listens once the whole working tree is
+/// watched, and then writes a byte to ready_fd
+static void fsmonitor_daemon(int ready_fd)
+{
+    struct fsmonitor monitor = {0};
+    signal(SIGPIPE, SIG_IGN);
+    new_journal_id(&monitor);
+
+    monitor.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (monitor.inotify_fd == -1 || watch_directory(&monitor, "", 0) != FS_OK)
+        return;
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strncpy(address.sun_path, FSMONITOR_SOCKET, sizeof(address.sun_path) - 1);
+    monitor.socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(FSMONITOR_SOCKET);
+    if (monitor.socket_fd == -1 || bind(monitor.socket_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(monitor.socket_fd, 16) != 0)
+        return;
+
+    write(ready_fd, "1", 1);
+    close(ready_fd);
+    run_fsmonitor(&monitor);
+    unlink(FSMONITOR_SOCKET);
+}
+
+/// @brief Start the daemon watching the working tree in the background, it
+/// returns once the daemon answers, or failed to watch the working tree
+int start_fsmonitor()
+{
+    if (!local_repo_exist())
+        return REPO_NOT_INITIALIZED;
+    if (fsmonitor_is_running())
+        return FSMONITOR_ALREADY_RUNNING;
+
+    int ready[2];
+    if (pipe(ready) != 0)
+        return FS_ERROR;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        close(ready[0]);
+        close(ready[1]);
+        return FS_ERROR;
+    }
+
+    if (pid == 0)
+    {
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd != -1)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+
+        // A second fork so that the daemon is not a child of the command
+        close(ready[0]);
+        if (fork() == 0)
+            fsmonitor_daemon(ready[1]);
+        _exit(0);
+    }
+    close(ready[1]);
+    waitpid(pid, NULL, 0);
+
+    // The pipe is closed without a byte when the daemon gives up
+    struct pollfd fd = { .fd = ready[0], .events = POLLIN };
+    char byte;
+    int res = FS_ERROR;
+    if (poll(&fd, 1, FSMONITOR_START_TIMEOUT * 1000) == 1 && read(ready[0], &byte, 1) == 1)
+        res = FS_OK;
+    close(ready[0]);
+
+    return res;
+}
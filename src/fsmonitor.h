@@ -0,0 +1,35 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H 1
+
+#include "index.h"
+
+// The fsmonitor daemon watches the working tree with inotify and keeps a
+// journal of the paths that changed, each change getting a new sequence
+// number. Commands ask it, on FSMONITOR_SOCKET, which paths changed since the
+// token stored in the index, and only check those.
+//
+// A token is "<daemon id>:<sequence number>", the id changes whenever the
+// daemon restarts or loses events, which makes the older tokens unknown.
+//
+// A request is the token of the client (empty when it has none) + '\n', or
+// FSMONITOR_QUIT + '\n' to stop the daemon. The response is
+// new token + '\0'
+// '1' + '\0' when everything may have changed, or '0' + '\0' followed by the
+// paths that changed, each + '\0'. A path may be a directory, in which case
+// anything below it may have changed.
+
+#define FSMONITOR_QUIT "quit"
+// Past this number of changes the journal is dropped and the id changes
+#define FSMONITOR_JOURNAL_MAX (1 << 20)
+// Time given to the daemon to watch the working tree when it starts
+#define FSMONITOR_START_TIMEOUT 10
+
+#define FSMONITOR_NOT_RUNNING (-80)
+#define FSMONITOR_ALREADY_RUNNING (-81)
+
+int fsmonitor_is_running();
+int start_fsmonitor();
+int stop_fsmonitor();
+int refresh_fsmonitor(index_t *index);
+
+#endif // FSMONITOR_H
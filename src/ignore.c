@@ -0,0 +1,562 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "ignore.h"
+#include "includes.h"
+
+#define IGNORE_NEGATIVE 1
+#define IGNORE_DIR_ONLY 2
+#define IGNORE_ANCHORED 4
+
+struct trie_node {
+    char c;
+    // Last rules ending at this node, for any path and for the paths that are
+    // not directories, -1 if none
+    int rule;
+    int file_rule;
+    struct trie_node *child;
+    struct trie_node *sibling;
+};
+
+enum glob_token_type {
+    GLOB_CHAR,
+    // '?'
+    GLOB_ANY,
+    GLOB_CLASS,
+    // '*', anything but a '/'
+    GLOB_STAR,
+    // "**", anything
+    GLOB_STARSTAR,
+    // Start of "**/", compiled to GLOB_DIRS, GLOB_STARSTAR and the GLOB_CHAR '/',
+    // reads nothing but allows to skip the two tokens after it
+    GLOB_DIRS,
+};
+
+struct glob_token {
+    enum glob_token_type type;
+    char c;
+    // After the '[' of a GLOB_CLASS, in the pattern of the rule
+    char *class;
+};
+
+struct ignore_rule {
+    char *pattern;
+    int flags;
+    // Compiled pattern of the rules holding wildcards
+    struct glob_token *tokens;
+    size_t tokens_size;
+};
+
+/// @brief rules of an IGNORE_FILE
+struct ignore_list {
+    struct ignore_rule *rules;
+    size_t rules_size;
+    // Literal rules matching the name of a file, and the relative path of a file
+    struct trie_node names;
+    struct trie_node paths;
+    // Indices of the rules holding wildcards, in order
+    size_t *globs;
+    size_t globs_size;
+};
+
+/// @brief directory met by a lookup, only its decision changes once it is known
+struct ignore_dir {
+    char *path;
+    // NULL when the directory has no IGNORE_FILE
+    struct ignore_list *list;
+    // -1 when unknown yet, 1 when the directory is ignored
+    int ignored;
+};
+
+// The directories are kept for the whole command in an open addressing table.
+// Lookups read it without any lock: a directory is only added, and the table
+// only replaced, under ignore_lock, once its IGNORE_FILE is loaded. A replaced
+// table is kept as a lookup may still be probing it.
+struct dir_table {
+    struct ignore_dir **slots;
+    size_t capacity;
+    struct dir_table *previous;
+};
+
+static struct dir_table *dirs = NULL;
+static size_t dirs_count = 0;
+static pthread_mutex_t ignore_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct trie_node *trie_child(struct trie_node *node, char c, int create)
+{
+    struct trie_node **link = &node->child;
+    for (; *link != NULL; link = &(*link)->sibling)
+    {
+        if ((*link)->c == c)
+            return *link;
+    }
+
+    if (!create)
+        return NULL;
+
+    struct trie_node *child = calloc(1, sizeof(struct trie_node));
+    child->c = c;
+    child->rule = -1;
+    child->file_rule = -1;
+    *link = child;
+    return child;
+}
+
+static void trie_insert(struct trie_node *root, char *key, int rule, int flags)
+{
+    struct trie_node *node = root;
+    for (; *key != '\0'; key++)
+        node = trie_child(node, *key, 1);
+
+    node->rule = rule;
+    if (!(flags & IGNORE_DIR_ONLY))
+        node->file_rule = rule;
+}
+
+static int trie_lookup(struct trie_node *root, char *key, int is_dir)
+{
+    struct trie_node *node = root;
+    for (; node != NULL && *key != '\0'; key++)
+        node = trie_child(node, *key, 0);
+
+    if (node == NULL)
+        return -1;
+    return is_dir ? node->rule : node->file_rule;
+}
+
+/// @brief Match c against the class starting at p, after its '['
+/// @return the end of the class, after its ']', or NULL if it is not closed
+static char *match_class(char *p, char c, int *matched)
+{
+    int negate = *p == '!' || *p == '^';
+    if (negate)
+        p++;
+
+    *matched = 0;
+    int first = 1;
+    for (; *p != '\0' && (first || *p != ']'); p++, first = 0)
+    {
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0')
+        {
+            if (c >= p[0] && c <= p[2])
+                *matched = 1;
+            p += 2;
+        } else if (*p == c)
+        {
+            *matched = 1;
+        }
+    }
+
+    if (*p != ']')
+        return NULL;
+
+    *matched ^= negate;
+    return p + 1;
+}
+
+static void push_token(struct ignore_rule *rule, enum glob_token_type type, char c, char *class)
+{
+    rule->tokens = realloc(rule->tokens, (rule->tokens_size + 1) * sizeof(struct glob_token));
+    rule->tokens[rule->tokens_size++] = (struct glob_token) { .type = type, .c = c, .class = class };
+}
+
+static void compile_glob(struct ignore_rule *rule)
+{
+    char *p = rule->pattern;
+    while (*p != '\0')
+    {
+        if (*p == '*' && p[1] == '*')
+        {
+            while (*p == '*')
+                p++;
+            if (*p == '/')
+            {
+                push_token(rule, GLOB_DIRS, 0, NULL);
+                push_token(rule, GLOB_STARSTAR, 0, NULL);
+                push_token(rule, GLOB_CHAR, '/', NULL);
+                p++;
+            } else
+            {
+                push_token(rule, GLOB_STARSTAR, 0, NULL);
+            }
+            continue;
+        }
+
+        if (*p == '*' || *p == '?')
+        {
+            push_token(rule, *p == '*' ? GLOB_STAR : GLOB_ANY, 0, NULL);
+            p++;
+            continue;
+        }
+
+        if (*p == '[')
+        {
+            int matched;
+            char *end = match_class(p + 1, 0, &matched);
+            if (end != NULL)
+            {
+                push_token(rule, GLOB_CLASS, 0, p + 1);
+                p = end;
+                continue;
+            }
+        }
+
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        push_token(rule, GLOB_CHAR, *p, NULL);
+        p++;
+    }
+}
+
+/// @brief Add state to the set, along with the states reached without
+/// reading anything
+static void add_glob_state(struct ignore_rule *rule, uint64_t *states, size_t state)
+{
+    while (!(states[state / 64] & (1ULL << (state % 64))))
+    {
+        states[state / 64] |= 1ULL << (state % 64);
+        if (state == rule->tokens_size)
+            return;
+
+        enum glob_token_type type = rule->tokens[state].type;
+        if (type == GLOB_DIRS)
+            add_glob_state(rule, states, state + 3);
+        if (type != GLOB_STAR && type != GLOB_STARSTAR && type != GLOB_DIRS)
+            return;
+        state++;
+    }
+}
+
+/// @brief Match t against the compiled pattern of rule
+/// The set of the states the pattern may be in is carried along t, so that
+/// the time is linear in the length of t whatever the wildcards, where
+/// backtracking on each '*' goes polynomial
+static int glob_match(struct ignore_rule *rule, char *t)
+{
+    size_t words = rule->tokens_size / 64 + 1;
+    uint64_t current[words], next[words];
+    memset(current, 0, sizeof(current));
+    add_glob_state(rule, current, 0);
+
+    for (; *t != '\0'; t++)
+    {
+        memset(next, 0, sizeof(next));
+        int alive = 0;
+        for (size_t i = 0; i < rule->tokens_size; i++)
+        {
+            if (!(current[i / 64] & (1ULL << (i % 64))))
+                continue;
+
+            struct glob_token *token = &rule->tokens[i];
+            int matched = 0;
+            size_t state = i + 1;
+            switch (token->type)
+            {
+            case GLOB_CHAR:
+                matched = *t == token->c;
+                break;
+            case GLOB_ANY:
+                matched = *t != '/';
+                break;
+            case GLOB_CLASS:
+                match_class(token->class, *t, &matched);
+                matched = matched && *t != '/';
+                break;
+            case GLOB_STAR:
+                matched = *t != '/';
+                state = i;
+                break;
+            case GLOB_STARSTAR:
+                matched = 1;
+                state = i;
+                break;
+            case GLOB_DIRS:
+                break;
+            }
+
+            if (matched)
+            {
+                add_glob_state(rule, next, state);
+                alive = 1;
+            }
+        }
+
+        if (!alive)
+            return 0;
+        memcpy(current, next, sizeof(current));
+    }
+
+    return (current[rule->tokens_size / 64] >> (rule->tokens_size % 64)) & 1;
+}
+
+static void add_rule(struct ignore_list *list, char *line)
+{
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\r')
+        line[--len] = '\0';
+    while (len > 0 && line[len - 1] == ' ' && (len < 2 || line[len - 2] != '\\'))
+        line[--len] = '\0';
+    if (len == 0 || line[0] == '#')
+        return;
+
+    int flags = 0;
+    if (line[0] == '!')
+    {
+        flags |= IGNORE_NEGATIVE;
+        line++;
+    } else if (line[0] == '\\' && (line[1] == '!' || line[1] == '#'))
+    {
+        line++;
+    }
+
+    // Previous versions of cgit wrote the rules of the root as "./<path>"
+    if (strncmp(line, "./", 2) == 0)
+    {
+        flags |= IGNORE_ANCHORED;
+        line += 2;
+    }
+
+    len = strlen(line);
+    if (len > 0 && line[len - 1] == '/')
+    {
+        flags |= IGNORE_DIR_ONLY;
+        line[--len] = '\0';
+    }
+    if (line[0] == '/')
+    {
+        flags |= IGNORE_ANCHORED;
+        line++;
+    }
+    if (*line == '\0')
+        return;
+    if (strchr(line, '/') != NULL)
+        flags |= IGNORE_ANCHORED;
+
+    list->rules = realloc(list->rules, (list->rules_size + 1) * sizeof(struct ignore_rule));
+    int index = list->rules_size++;
+    struct ignore_rule *rule = &list->rules[index];
+    *rule = (struct ignore_rule) { .pattern = strdup(line), .flags = flags };
+
+    if (strpbrk(line, "*?[\\") == NULL)
+    {
+        trie_insert(flags & IGNORE_ANCHORED ? &list->paths : &list->names, line, index, flags);
+    } else
+    {
+        compile_glob(rule);
+        list->globs = realloc(list->globs, (list->globs_size + 1) * sizeof(size_t));
+        list->globs[list->globs_size++] = index;
+    }
+}
+
+/// @brief Read and compile the IGNORE_FILE of dir
+/// @return the rules, NULL when the directory has none
+static struct ignore_list *load_ignore_list(char *dir)
+{
+    char path[strlen(dir) + strlen(IGNORE_FILE) + 2];
+    if (*dir == '\0')
+        sprintf(path, "%s", IGNORE_FILE);
+    else
+        sprintf(path, "%s/%s", dir, IGNORE_FILE);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return NULL;
+
+    struct ignore_list *list = calloc(1, sizeof(struct ignore_list));
+    list->names.rule = list->names.file_rule = -1;
+    list->paths.rule = list->paths.file_rule = -1;
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &capacity, file)) != -1)
+    {
+        if (line_len > 0 && line[line_len - 1] == '\n')
+            line[line_len - 1] = '\0';
+        add_rule(list, line);
+    }
+    free(line);
+    fclose(file);
+
+    debug_print("Loaded %zu ignore rules from %s", list->rules_size, path);
+    return list;
+}
+
+/// @brief Decide with the rules of list
+/// @param path relative to the directory of list
+/// @return 1 if ignored, 0 if included again, -1 if no rule matches
+static int match_ignore_list(struct ignore_list *list, char *path, int is_dir)
+{
+    char *name = strrchr(path, '/');
+    name = name == NULL ? path : name + 1;
+
+    int best = trie_lookup(&list->names, name, is_dir);
+    int path_rule = trie_lookup(&list->paths, path, is_dir);
+    if (path_rule > best)
+        best = path_rule;
+
+    // Only the rules after the best literal one can change the decision
+    for (size_t i = list->globs_size; i > 0; i--)
+    {
+        int index = list->globs[i - 1];
+        if (index <= best)
+            break;
+
+        struct ignore_rule *rule = &list->rules[index];
+        if ((rule->flags & IGNORE_DIR_ONLY) && !is_dir)
+            continue;
+        if (glob_match(rule, rule->flags & IGNORE_ANCHORED ? path : name))
+        {
+            best = index;
+            break;
+        }
+    }
+
+    if (best == -1)
+        return -1;
+    return list->rules[best].flags & IGNORE_NEGATIVE ? 0 : 1;
+}
+
+static uint32_t path_hash(char *path, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)path[i]) * 16777619u;
+    return hash;
+}
+
+static size_t dir_slot(struct dir_table *table, char *path, size_t len)
+{
+    size_t slot = path_hash(path, len) & (table->capacity - 1);
+    struct ignore_dir *dir;
+    while ((dir = __atomic_load_n(&table->slots[slot], __ATOMIC_ACQUIRE)) != NULL
+           && (strncmp(dir->path, path, len) != 0 || dir->path[len] != '\0'))
+        slot = (slot + 1) & (table->capacity - 1);
+
+    return slot;
+}
+
+/// @brief Replace the table of the directories by one twice as large
+/// ignore_lock must be held
+static struct dir_table *grow_dirs()
+{
+    struct dir_table *table = calloc(1, sizeof(struct dir_table));
+    table->capacity = dirs == NULL ? 64 : dirs->capacity * 2;
+    table->slots = calloc(table->capacity, sizeof(struct ignore_dir *));
+    table->previous = dirs;
+    for (size_t i = 0; dirs != NULL && i < dirs->capacity; i++)
+    {
+        struct ignore_dir *dir = dirs->slots[i];
+        if (dir != NULL)
+            table->slots[dir_slot(table, dir->path, strlen(dir->path))] = dir;
+    }
+
+    __atomic_store_n(&dirs, table, __ATOMIC_RELEASE);
+    return table;
+}
+
+/// @brief Find the directory made of the len first characters of path, its
+/// IGNORE_FILE is read the first time
+static struct ignore_dir *get_ignore_dir(char *path, size_t len)
+{
+    struct dir_table *table = __atomic_load_n(&dirs, __ATOMIC_ACQUIRE);
+    if (table != NULL)
+    {
+        struct ignore_dir *dir = __atomic_load_n(&table->slots[dir_slot(table, path, len)], __ATOMIC_ACQUIRE);
+        if (dir != NULL)
+            return dir;
+    }
+
+    pthread_mutex_lock(&ignore_lock);
+
+    // Another thread may have added it, or grown the table, meanwhile
+    table = dirs == NULL ? grow_dirs() : dirs;
+    size_t slot = dir_slot(table, path, len);
+    struct ignore_dir *dir = table->slots[slot];
+    if (dir == NULL)
+    {
+        if ((dirs_count + 1) * 2 >= table->capacity)
+        {
+            table = grow_dirs();
+            slot = dir_slot(table, path, len);
+        }
+        dir = calloc(1, sizeof(struct ignore_dir));
+        dir->path = strndup(path, len);
+        dir->list = load_ignore_list(dir->path);
+        dir->ignored = len == 0 ? 0 : -1;
+        __atomic_store_n(&table->slots[slot], dir, __ATOMIC_RELEASE);
+        dirs_count++;
+    }
+
+    pthread_mutex_unlock(&ignore_lock);
+    return dir;
+}
+
+/// @brief Apply the rules of the directories above path, the deepest first
+/// The directories holding path must be known not to be ignored
+static int decide(char *path, int is_dir)
+{
+    size_t len = strlen(path);
+    while (1)
+    {
+        while (len > 0 && path[len - 1] != '/')
+            len--;
+        size_t dir_len = len == 0 ? 0 : len - 1;
+
+        struct ignore_dir *dir = get_ignore_dir(path, dir_len);
+        if (dir->list != NULL)
+        {
+            int res = match_ignore_list(dir->list, path + len, is_dir);
+            if (res != -1)
+                return res;
+        }
+
+        if (dir_len == 0)
+            return 0;
+        len = dir_len;
+    }
+}
+
+/// @brief Tell whether path, relative to the root of the repository, is ignored
+/// Safe to call from several threads
+int is_path_ignored(char *path, int is_dir)
+{
+    while (strncmp(path, "./", 2) == 0)
+        path += 2;
+
+    size_t len = strlen(path);
+    while (len > 0 && path[len - 1] == '/')
+        len--;
+    char normalized[len + 1];
+    memcpy(normalized, path, len);
+    normalized[len] = '\0';
+    if (len == 0 || strcmp(normalized, ".") == 0)
+        return 0;
+
+    int ignored = 0;
+    for (char *slash = strchr(normalized, '/'); slash != NULL && !ignored; slash = strchr(slash + 1, '/'))
+    {
+        struct ignore_dir *dir = get_ignore_dir(normalized, slash - normalized);
+        ignored = __atomic_load_n(&dir->ignored, __ATOMIC_RELAXED);
+        if (ignored == -1)
+        {
+            // Threads racing on it take the same decision
+            *slash = '\0';
+            ignored = decide(normalized, 1);
+            *slash = '/';
+            __atomic_store_n(&dir->ignored, ignored, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (!ignored)
+        ignored = decide(normalized, is_dir);
+
+    return ignored;
+}
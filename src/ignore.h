@@ -0,0 +1,26 @@
+#ifndef IGNORE_H
+#define IGNORE_H 1
+
+// Ignore rules are read from the IGNORE_FILE of each directory, in the
+// .gitignore format:
+// - blank lines and lines starting with '#' are skipped
+// - a leading '!' negates the rule, a file matched by it is not ignored
+// - a trailing '/' restricts the rule to directories
+// - a rule without any other '/' matches the name of a file at any depth
+//   below its directory, the others match the path relative to it
+// - '*' and '?' match anything but a '/', "[a-z]" a class of characters,
+//   "**/", "/**" and "/**/" any number of directories
+// The last rule matching a path decides, and the rules of a directory take
+// precedence over the ones of its parents. Nothing under an ignored
+// directory can be included again.
+//
+// Each IGNORE_FILE is read and compiled once per command, the first time a
+// path below its directory is looked up, and the decision taken for each
+// directory is kept. Rules without wildcards are looked up in tries, the
+// others are compiled to tokens, matched by carrying the set of reachable
+// states along the path, and only tried when they come after the best
+// literal match. Lookups only take a lock to load an IGNORE_FILE.
+
+int is_path_ignored(char *path, int is_dir);
+
+#endif // IGNORE_H
@@ -0,0 +1,923 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache_tree.h"
+#include "commit.h"
+#include "fs.h"
+#include "ignore.h"
+#include "includes.h"
+#include "index.h"
+#include "objects.h"
+#include "tree.h"
+#include "utils.h"
+
+/// @brief Free index, releasing its lock when it was not saved
+void free_index(index_t *index)
+{
+    if (index->locked)
+    {
+        close(index->lock_fd);
+        unlink(INDEX_LOCK_FILE);
+    }
+    free_tree(&index->entries);
+    if (index->cache_tree != NULL)
+    {
+        free_cache_tree(index->cache_tree);
+        free(index->cache_tree);
+    }
+    if (index->untracked != NULL)
+    {
+        free_untracked_cache(index->untracked);
+        free(index->untracked);
+    }
+    free(index->fsmonitor_token);
+    memset(index, 0, sizeof(index_t));
+}
+
+enum file_mode mode_from_stat(struct stat *st)
+{
+    if (S_ISLNK(st->st_mode))
+        return SYM_LINK;
+    if (st->st_mode & S_IXUSR)
+        return REG_EXE_FILE;
+    return REG_NONX_FILE;
+}
+
+void fill_stat_data(struct stat_data *data, struct stat *st)
+{
+    data->ctime_sec = st->st_ctim.tv_sec;
+    data->ctime_nsec = st->st_ctim.tv_nsec;
+    data->mtime_sec = st->st_mtim.tv_sec;
+    data->mtime_nsec = st->st_mtim.tv_nsec;
+    data->dev = st->st_dev;
+    data->ino = st->st_ino;
+    data->uid = st->st_uid;
+    data->gid = st->st_gid;
+    data->size = st->st_size;
+}
+
+static int stat_data_match(struct stat_data *data, struct stat *st)
+{
+    struct stat_data current;
+    fill_stat_data(&current, st);
+    return memcmp(data, &current, sizeof(struct stat_data)) == 0;
+}
+
+/// @brief An entry is racy when its file was modified in the same instant as,
+/// or after, the index was written: a later change within the same timestamp
+/// granularity would leave its stat data untouched
+static int entry_is_racy(index_t *index, entry_t *entry)
+{
+    if (index->timestamp.tv_sec == 0)
+        return 0;
+
+    if (entry->stat.mtime_sec != (uint32_t)index->timestamp.tv_sec)
+        return entry->stat.mtime_sec > (uint32_t)index->timestamp.tv_sec;
+
+    return entry->stat.mtime_nsec >= (uint32_t)index->timestamp.tv_nsec;
+}
+
+/// @brief Tell whether the file of entry still has the content recorded in the index
+/// Only racy entries are hashed again, the others are trusted from their stat data
+/// @param st result of stat on the file of entry
+int entry_is_clean(index_t *index, entry_t *entry, struct stat *st)
+{
+    if (entry->mode != mode_from_stat(st) || !stat_data_match(&entry->stat, st))
+        return 0;
+
+    if (!entry_is_racy(index, entry))
+        return 1;
+
+    unsigned char checksum[DIGEST_LENGTH];
+    if (hash_blob_from_file(entry->filename, checksum) != FS_OK)
+        return 0;
+
+    return memcmp(checksum, entry->checksum, DIGEST_LENGTH) == 0;
+}
+
+/// @brief Write the blob of filename to the object store unless its entry in
+/// the index is clean. The index is only read, so several files can be staged
+/// concurrently before their entries are set with set_index_entry
+/// @param st result of stat on filename
+/// @param checksum set to the checksum of the blob, array of size DIGEST_LENGTH
+/// @return FS_OK if checksum was set, ENTRY_UNCHANGED if the entry is clean
+int stage_file(index_t *index, char *filename, struct stat *st, unsigned char *checksum)
+{
+    entry_t *entry = find_entry(&index->entries, filename);
+    if (entry != NULL && entry_is_clean(index, entry, st))
+        return ENTRY_UNCHANGED;
+
+    int result = write_blob_from_file(filename, checksum);
+    if (result != FS_OK && result != OBJECT_ALREADY_EXIST)
+    {
+        return result;
+    }
+
+    return FS_OK;
+}
+
+/// @brief Append the entry of a staged file to the index, the index is sorted
+/// again by sort_tree so that many files can be set at once
+void set_index_entry(index_t *index, char *filename, unsigned char *checksum, struct stat *st)
+{
+    entry_t *entry = append_entry_to_tree(&index->entries, checksum, BLOB, filename, mode_from_stat(st));
+    fill_stat_data(&entry->stat, st);
+    invalidate_index_path(index, filename);
+}
+
+/// @brief Forget the cached trees of the directories leading to path, and
+/// what the last scan of its directory found
+void invalidate_index_path(index_t *index, char *path)
+{
+    if (index->cache_tree != NULL)
+        invalidate_cache_tree(index->cache_tree, path);
+    if (index->untracked != NULL)
+        invalidate_untracked_path(index->untracked, path);
+}
+
+/// @brief Add filename to the index, the file is only hashed and written to the
+/// object store when its stat data changed since it was last added
+/// @param st result of stat on filename
+int add_to_index(index_t *index, char *filename, struct stat *st)
+{
+    unsigned char checksum[DIGEST_LENGTH];
+    int result = stage_file(index, filename, st, checksum);
+    if (result == ENTRY_UNCHANGED)
+        return FS_OK;
+    if (result != FS_OK)
+        return result;
+
+    set_index_entry(index, filename, checksum, st);
+    sort_tree(&index->entries);
+    return FS_OK;
+}
+
+/// @brief Update the index with the content of the files it tracks, only the
+/// files whose stat data changed are hashed again
+/// Files that no longer exist keep their last added content
+int refresh_index(index_t *index)
+{
+    for (size_t i = 0; i < index->entries.entries_size; i++)
+    {
+        entry_t *current = &index->entries.entries[i];
+        if (index->fsmonitor_active && current->fsmonitor_valid)
+            continue;
+
+        struct stat st;
+        if (stat(current->filename, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (entry_is_clean(index, current, &st))
+        {
+            current->fsmonitor_valid = index->fsmonitor_active;
+            continue;
+        }
+
+        unsigned char checksum[DIGEST_LENGTH];
+        int result = write_blob_from_file(current->filename, checksum);
+        if (result != FS_OK && result != OBJECT_ALREADY_EXIST)
+        {
+            return result;
+        }
+
+        if (memcmp(checksum, current->checksum, DIGEST_LENGTH) != 0 || current->mode != mode_from_stat(&st))
+            invalidate_index_path(index, current->filename);
+        memcpy(current->checksum, checksum, DIGEST_LENGTH);
+        current->mode = mode_from_stat(&st);
+        fill_stat_data(&current->stat, &st);
+        current->fsmonitor_valid = index->fsmonitor_active;
+    }
+
+    return FS_OK;
+}
+
+/// @brief Write the tree of the entries [start, end) of the index, whose paths
+/// all begin with the same prefix_len characters. The entries are sorted so
+/// the files of each subdirectory are contiguous and its tree is written once
+/// A directory whose cached tree is still valid is neither hashed nor written
+/// @param cache cached tree of the directory, updated with the tree written
+static int write_subtree(tree_t *entries, size_t start, size_t end, size_t prefix_len, cache_tree_t *cache)
+{
+    if (cache->entry_count >= 0 && (size_t)cache->entry_count == end - start)
+        return FS_OK;
+
+    tree_t tree = {0};
+    int res = FS_OK;
+
+    // Subtrees are moved from the previous cache, directories that are gone are dropped
+    size_t subtrees_size = 0;
+    cache_tree_t *subtrees = NULL;
+
+    size_t i = start;
+    while (i < end)
+    {
+        entry_t *current = &entries->entries[i];
+        char *name = current->filename + prefix_len;
+        char *slash = strchr(name, '/');
+        if (slash == NULL)
+        {
+            append_entry_to_tree(&tree, current->checksum, current->type, name, current->mode);
+            i++;
+            continue;
+        }
+
+        size_t name_len = slash - name;
+        size_t j = i + 1;
+        while (j < end && strncmp(entries->entries[j].filename + prefix_len, name, name_len + 1) == 0)
+            j++;
+
+        subtrees = realloc(subtrees, (subtrees_size + 1) * sizeof(cache_tree_t));
+        cache_tree_t *subtree = &subtrees[subtrees_size++];
+        cache_tree_t *previous = find_cache_subtree(cache, name, name_len);
+        if (previous != NULL)
+        {
+            *subtree = *previous;
+            memset(previous, 0, sizeof(cache_tree_t));
+        } else
+        {
+            init_cache_tree(subtree, name, name_len);
+        }
+
+        res = write_subtree(entries, i, j, prefix_len + name_len + 1, subtree);
+        if (res != FS_OK)
+            break;
+        append_entry_to_tree(&tree, subtree->checksum, TREE, subtree->name, DIRECTORY);
+        i = j;
+    }
+
+    for (size_t k = 0; k < cache->subtrees_size; k++)
+        free_cache_tree(&cache->subtrees[k]);
+    free(cache->subtrees);
+    cache->subtrees = subtrees;
+    cache->subtrees_size = subtrees_size;
+
+    if (res == FS_OK)
+    {
+        object_t obj = {0};
+        tree_to_object(&tree, &obj);
+        hash_object(&obj, cache->checksum);
+        res = write_object(&obj);
+        if (res == OBJECT_ALREADY_EXIST)
+            res = FS_OK;
+        free_object(&obj);
+    }
+    if (res == FS_OK)
+        cache->entry_count = end - start;
+
+    free_tree(&tree);
+    return res;
+}
+
+/// @brief Write the trees holding the content of the index, bottom-up, each
+/// directory being written exactly once, and only if it changed since the last time
+/// @param checksum set to the checksum of the root tree, array of size DIGEST_LENGTH
+int write_index_tree(index_t *index, unsigned char *checksum)
+{
+    sort_tree(&index->entries);
+    if (index->cache_tree == NULL)
+    {
+        index->cache_tree = malloc(sizeof(cache_tree_t));
+        init_cache_tree(index->cache_tree, "", 0);
+    }
+
+    int res = write_subtree(&index->entries, 0, index->entries.entries_size, 0, index->cache_tree);
+    if (res == FS_OK)
+        memcpy(checksum, index->cache_tree->checksum, DIGEST_LENGTH);
+    return res;
+}
+
+/// @brief Whether an entry of the index is below dir
+int index_has_dir(index_t *index, char *dir)
+{
+    size_t len = strlen(dir);
+    char prefix[len + 2];
+    sprintf(prefix, "%s/", dir);
+
+    // First entry not before the prefix, every path below dir follows it
+    tree_t *entries = &index->entries;
+    sort_tree(entries);
+    size_t low = 0, high = entries->entries_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(entries->entries[mid].filename, prefix) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low < entries->entries_size && strncmp(entries->entries[low].filename, prefix, len + 1) == 0;
+}
+
+struct untracked_scan {
+    index_t *index;
+    untracked_cache_t *cache;
+    // Report a directory without tracked files as "<dir>/" instead of its files
+    int collapse;
+    untracked_fn callback;
+    void *data;
+    // Directories modified since the scan started are read again by the next one
+    struct timespec start;
+};
+
+static void join_path(char *path, char *dir, char *name)
+{
+    if (*dir == '\0')
+        sprintf(path, "%s", name);
+    else
+        sprintf(path, "%s/%s", dir, name);
+}
+
+static int modified_since(struct timespec *time, struct timespec *start)
+{
+    if (time->tv_sec != start->tv_sec)
+        return time->tv_sec > start->tv_sec;
+    return time->tv_nsec >= start->tv_nsec;
+}
+
+static void push_name(char ***names, size_t *size, char *name)
+{
+    // Grown by powers of two
+    if ((*size & (*size - 1)) == 0)
+        *names = realloc(*names, (*size == 0 ? 1 : *size * 2) * sizeof(char *));
+    (*names)[(*size)++] = strdup(name);
+}
+
+/// @brief Whether the IGNORE_FILE of dir changed since record was scanned, a
+/// missing record counts as a change
+/// @param st set to the result of stat on the IGNORE_FILE, zeroed when there is none
+static int ignore_file_changed(untracked_dir_t *record, char *dir, struct stat *st)
+{
+    struct stat buffer;
+    if (st == NULL)
+        st = &buffer;
+
+    char path[strlen(dir) + strlen(IGNORE_FILE) + 2];
+    join_path(path, dir, IGNORE_FILE);
+    if (stat(path, st) != 0)
+        memset(st, 0, sizeof(struct stat));
+
+    return record == NULL || !record->ignore_valid || record->ignore_size != (uint64_t)st->st_size
+           || record->ignore_mtime_sec != (uint32_t)st->st_mtim.tv_sec
+           || record->ignore_mtime_nsec != (uint32_t)st->st_mtim.tv_nsec;
+}
+
+/// @brief Read the untracked files and the subdirectories of dir into record
+static void read_untracked_dir(struct untracked_scan *scan, char *dir, untracked_dir_t *record)
+{
+    clear_untracked_dir(record);
+
+    DIR *dp = opendir(*dir == '\0' ? "." : dir);
+    if (dp == NULL)
+        return;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp)) != NULL)
+    {
+        if (strcmp(ep->d_name, "..") == 0 || strcmp(ep->d_name, ".") == 0)
+            continue;
+
+        char path[strlen(dir) + strlen(ep->d_name) + 2];
+        join_path(path, dir, ep->d_name);
+
+        int is_dir = ep->d_type == DT_DIR;
+        struct stat st;
+        if (ep->d_type == DT_UNKNOWN && lstat(path, &st) == 0)
+            is_dir = S_ISDIR(st.st_mode);
+
+        if (strcmp(path, LOCAL_REPO) == 0 || is_path_ignored(path, is_dir))
+            continue;
+
+        if (is_dir)
+            push_name(&record->subdirs, &record->subdirs_size, ep->d_name);
+        else if (find_entry(&scan->index->entries, path) == NULL)
+            push_name(&record->untracked, &record->untracked_size, ep->d_name);
+    }
+
+    closedir(dp);
+}
+
+/// @brief Call the callback of scan on the untracked files below dir, dir is
+/// only read when it or its IGNORE_FILE changed since the last scan
+/// @param rules_changed whether the IGNORE_FILE of a parent changed
+/// @param report whether the files are given to the callback, or only counted
+/// @return number of untracked files found
+static size_t scan_untracked_dir(struct untracked_scan *scan, char *dir, int rules_changed, int report)
+{
+    untracked_cache_t *cache = scan->cache;
+    untracked_dir_t *record = find_untracked_dir(cache, dir);
+    // Neither the directory nor its IGNORE_FILE are looked at when the
+    // fsmonitor saw no change in them
+    if (record == NULL || rules_changed || !record->valid || !record->fsmonitor_valid || !scan->index->fsmonitor_active)
+    {
+        struct stat st;
+        if (stat(*dir == '\0' ? "." : dir, &st) != 0)
+            return 0;
+
+        struct stat ignore_st;
+        if (ignore_file_changed(record, dir, &ignore_st))
+            rules_changed = 1;
+        if (record == NULL)
+            record = add_untracked_dir(cache, dir);
+
+        if (rules_changed || !record->valid || record->mtime_sec != (uint32_t)st.st_mtim.tv_sec
+            || record->mtime_nsec != (uint32_t)st.st_mtim.tv_nsec)
+        {
+            read_untracked_dir(scan, dir, record);
+            record->mtime_sec = st.st_mtim.tv_sec;
+            record->mtime_nsec = st.st_mtim.tv_nsec;
+            record->ignore_mtime_sec = ignore_st.st_mtim.tv_sec;
+            record->ignore_mtime_nsec = ignore_st.st_mtim.tv_nsec;
+            record->ignore_size = ignore_st.st_size;
+            record->valid = !modified_since(&st.st_mtim, &scan->start);
+            record->ignore_valid = !modified_since(&ignore_st.st_mtim, &scan->start);
+            cache->changed = 1;
+        }
+
+        int fsmonitor_valid = scan->index->fsmonitor_active && record->valid && record->ignore_valid;
+        if (record->fsmonitor_valid != fsmonitor_valid)
+        {
+            record->fsmonitor_valid = fsmonitor_valid;
+            cache->changed = 1;
+        }
+    }
+    record->seen = 1;
+
+    // The records move when the scan of a subdirectory adds one, not their names
+    char **untracked = record->untracked, **subdirs = record->subdirs;
+    size_t untracked_size = record->untracked_size, subdirs_size = record->subdirs_size;
+
+    size_t found = untracked_size;
+    for (size_t i = 0; report && i < untracked_size; i++)
+    {
+        char path[strlen(dir) + strlen(untracked[i]) + 2];
+        join_path(path, dir, untracked[i]);
+        scan->callback(path, scan->data);
+    }
+
+    for (size_t i = 0; i < subdirs_size; i++)
+    {
+        char path[strlen(dir) + strlen(subdirs[i]) + 2];
+        join_path(path, dir, subdirs[i]);
+        if (!scan->collapse || index_has_dir(scan->index, path))
+        {
+            found += scan_untracked_dir(scan, path, rules_changed, report);
+            continue;
+        }
+
+        size_t count = scan_untracked_dir(scan, path, rules_changed, 0);
+        if (count > 0 && report)
+        {
+            char dir_path[strlen(path) + 2];
+            sprintf(dir_path, "%s/", path);
+            scan->callback(dir_path, scan->data);
+        }
+        found += count;
+    }
+
+    return found;
+}
+
+/// @brief Call callback on each file below dir that is neither in the index
+/// nor ignored. What each directory holds is kept in the untracked cache of
+/// the index, which has to be saved for the next scan to use it
+/// @param dir relative path of a directory, "" for the whole working tree
+/// @param collapse report a directory without tracked files as "<dir>/"
+/// rather than each of its files
+/// @return number of untracked files below dir
+size_t list_untracked_files(index_t *index, char *dir, int collapse, untracked_fn callback, void *data)
+{
+    if (index->untracked == NULL)
+        index->untracked = calloc(1, sizeof(untracked_cache_t));
+
+    struct untracked_scan scan = {
+        .index = index,
+        .cache = index->untracked,
+        .collapse = collapse,
+        .callback = callback,
+        .data = data,
+    };
+    clock_gettime(CLOCK_REALTIME, &scan.start);
+
+    // The rules of the parents of dir must not have changed either
+    int rules_changed = 0;
+    char parent[strlen(dir) + 1];
+    size_t len = 0;
+    while (*dir != '\0' && !rules_changed)
+    {
+        memcpy(parent, dir, len);
+        parent[len] = '\0';
+        rules_changed = ignore_file_changed(find_untracked_dir(index->untracked, parent), parent, NULL);
+
+        char *slash = strchr(dir + len + (len > 0), '/');
+        if (slash == NULL)
+            break;
+        len = slash - dir;
+    }
+
+    size_t found = scan_untracked_dir(&scan, dir, rules_changed, 1);
+    sort_untracked_cache(index->untracked, *dir == '\0');
+    return found;
+}
+
+/// @brief Add every file of tree to the index, with their path prefixed by prefix
+/// The entries have no stat data and will be hashed again on their next refresh
+int index_from_tree(index_t *index, tree_t *tree, char *prefix)
+{
+    for (size_t i = 0; i < tree->entries_size; i++)
+    {
+        entry_t *current = &tree->entries[i];
+        char path[strlen(prefix) + strlen(current->filename) + 2];
+        if (*prefix == '\0')
+            sprintf(path, "%s", current->filename);
+        else
+            sprintf(path, "%s/%s", prefix, current->filename);
+
+        if (current->type != TREE)
+        {
+            append_entry_to_tree(&index->entries, current->checksum, current->type, path, current->mode);
+            continue;
+        }
+
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(current->checksum, checksum);
+        tree_t subtree = {0};
+        int res = load_tree(checksum, &subtree);
+        if (res != FS_OK)
+            return res;
+
+        res = index_from_tree(index, &subtree, path);
+        free_tree(&subtree);
+        if (res != FS_OK)
+            return res;
+    }
+
+    return FS_OK;
+}
+
+static int index_from_commit(index_t *index, object_t *commit_obj)
+{
+    commit_t commit = {0};
+    commit_from_object(&commit, commit_obj, NULL);
+
+    tree_t tree = {0};
+    int res = load_tree(commit.tree, &tree);
+    if (res == FS_OK)
+        res = index_from_tree(index, &tree, "");
+    sort_tree(&index->entries);
+
+    free_tree(&tree);
+    free_commit(&commit);
+    return res;
+}
+
+/// @brief Fill index with the files of a commit, without stat data
+int load_commit_index(char *commit_checksum, index_t *index)
+{
+    memset(index, 0, sizeof(index_t));
+
+    object_t commit_obj = {0};
+    int res = read_object(commit_checksum, &commit_obj);
+    if (res != FS_OK)
+        return res;
+
+    if (commit_obj.object_type != COMMIT)
+    {
+        free_object(&commit_obj);
+        return WRONG_OBJECT_TYPE;
+    }
+
+    res = index_from_commit(index, &commit_obj);
+    free_object(&commit_obj);
+    if (res != FS_OK)
+        free_index(index);
+    return res;
+}
+
+/// @brief Load an index in the previous format, which only held the files
+/// staged since the last commit, on top of the content of the last commit
+static int load_legacy_index(index_t *index, char *content, size_t size)
+{
+    object_t commit_obj = {0};
+    get_last_commit(&commit_obj);
+    if (commit_obj.size != 0)
+    {
+        int res = index_from_commit(index, &commit_obj);
+        free_object(&commit_obj);
+        if (res != FS_OK)
+            return res;
+    }
+
+    tree_t staged = {0};
+    object_t obj = { content: content, size: size, object_type: TREE };
+    tree_from_object(&staged, &obj, NULL);
+    for (size_t i = 0; i < staged.entries_size; i++)
+    {
+        entry_t *current = &staged.entries[i];
+        append_entry_to_tree(&index->entries, current->checksum, current->type, current->filename, current->mode);
+    }
+    sort_tree(&index->entries);
+    free_tree(&staged);
+
+    return FS_OK;
+}
+
+static int parse_index(index_t *index, unsigned char *content, size_t size)
+{
+    if (size < INDEX_HEADER_SIZE + DIGEST_LENGTH || get_be32(content + 4) != INDEX_VERSION)
+        return INVALID_INDEX;
+
+    unsigned char checksum[DIGEST_LENGTH];
+    EVP_MD_CTX *ctx = sha1_init();
+    sha1_update(ctx, content, size - DIGEST_LENGTH);
+    sha1_final(ctx, checksum);
+    if (memcmp(checksum, content + size - DIGEST_LENGTH, DIGEST_LENGTH) != 0)
+    {
+        error_print("Index checksum mismatch");
+        return INVALID_INDEX;
+    }
+
+    uint32_t entries_count = get_be32(content + 8);
+    unsigned char *end = content + size - DIGEST_LENGTH;
+    unsigned char *ptr = content + INDEX_HEADER_SIZE;
+    for (uint32_t i = 0; i < entries_count; i++)
+    {
+        if (ptr + INDEX_ENTRY_FIXED_SIZE >= end)
+            return INVALID_INDEX;
+
+        struct stat_data data;
+        data.ctime_sec = get_be32(ptr);
+        data.ctime_nsec = get_be32(ptr + 4);
+        data.mtime_sec = get_be32(ptr + 8);
+        data.mtime_nsec = get_be32(ptr + 12);
+        data.dev = get_be32(ptr + 16);
+        data.ino = get_be32(ptr + 20);
+        enum file_mode mode = get_be32(ptr + 24);
+        data.uid = get_be32(ptr + 28);
+        data.gid = get_be32(ptr + 32);
+        data.size = get_be64(ptr + 36);
+        unsigned char *entry_checksum = ptr + 44;
+        uint16_t flags = (ptr[64] << 8) | ptr[65];
+
+        char *name = (char *)ptr + INDEX_ENTRY_FIXED_SIZE;
+        size_t name_len = flags & INDEX_NAME_MASK;
+        if (name_len == INDEX_NAME_MASK)
+            name_len = strnlen(name, (char *)end - name);
+        if ((unsigned char *)name + name_len >= end || name[name_len] != '\0')
+            return INVALID_INDEX;
+
+        enum object_type type = mode == GIT_LINK ? COMMIT : BLOB;
+        entry_t *entry = append_entry_to_tree(&index->entries, entry_checksum, type, name, mode);
+        entry->stat = data;
+        entry->fsmonitor_valid = (flags & INDEX_FSMONITOR_VALID) != 0;
+
+        size_t entry_size = INDEX_ENTRY_FIXED_SIZE + name_len + 1;
+        ptr += (entry_size + 7) & ~(size_t)7;
+    }
+    sort_tree(&index->entries);
+
+    // Extensions that are not known are skipped
+    while (ptr + INDEX_EXTENSION_HEADER_SIZE <= end)
+    {
+        uint32_t extension_size = get_be32(ptr + 4);
+        unsigned char *data = ptr + INDEX_EXTENSION_HEADER_SIZE;
+        if (data + extension_size > end)
+            return INVALID_INDEX;
+
+        if (memcmp(ptr, CACHE_TREE_SIGNATURE, 4) == 0 && index->cache_tree == NULL)
+        {
+            // A broken cache only costs the trees to be written again
+            index->cache_tree = malloc(sizeof(cache_tree_t));
+            if (read_cache_tree(index->cache_tree, data, extension_size) != 0)
+            {
+                free(index->cache_tree);
+                index->cache_tree = NULL;
+            }
+        } else if (memcmp(ptr, UNTRACKED_CACHE_SIGNATURE, 4) == 0 && index->untracked == NULL)
+        {
+            // Neither does a broken untracked cache, the working tree is scanned again
+            index->untracked = malloc(sizeof(untracked_cache_t));
+            if (read_untracked_cache(index->untracked, data, extension_size) != 0)
+            {
+                free(index->untracked);
+                index->untracked = NULL;
+            }
+        } else if (memcmp(ptr, FSMONITOR_SIGNATURE, 4) == 0 && index->fsmonitor_token == NULL)
+        {
+            if (extension_size > 0 && data[extension_size - 1] == '\0')
+                index->fsmonitor_token = strdup((char *)data);
+        }
+        ptr = data + extension_size;
+    }
+
+    return FS_OK;
+}
+
+int load_index(index_t *index)
+{
+    if(!local_repo_exist() || !index_exist())
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+    memset(index, 0, sizeof(index_t));
+
+    int fd = open(INDEX_FILE, O_RDONLY | O_CLOEXEC);
+    struct stat buffer;
+    if (fd == -1 || fstat(fd, &buffer) != 0)
+    {
+        if (fd != -1)
+            close(fd);
+        return FS_ERROR;
+    }
+    index->timestamp = buffer.st_mtim;
+
+    unsigned char *content = malloc(buffer.st_size + 1);
+    size_t read_size = 0;
+    while (read_size < buffer.st_size)
+    {
+        ssize_t n = read(fd, content + read_size, buffer.st_size - read_size);
+        if (n <= 0)
+            break;
+        read_size += n;
+    }
+    close(fd);
+
+    int result;
+    if (read_size >= 4 && memcmp(content, INDEX_SIGNATURE, 4) == 0)
+        result = parse_index(index, content, read_size);
+    else
+        result = load_legacy_index(index, (char *)content, read_size);
+    free(content);
+
+    if (result != FS_OK)
+    {
+        error_print("Cannot load index");
+        free_index(index);
+    }
+
+    return result;
+}
+
+static int write_index_data(FILE *file, EVP_MD_CTX *ctx, void *data, size_t size)
+{
+    sha1_update(ctx, data, size);
+    return fwrite(data, 1, size, file) == size ? FS_OK : FS_ERROR;
+}
+
+/// @brief Take INDEX_LOCK_FILE, then load the index. A command that writes
+/// the index loads it this way, so that no other command writes it between
+/// the load and save_index. The lock is released by save_index, or by
+/// free_index when the index is not saved
+/// @return FS_OK, or INDEX_LOCKED when another command holds the lock
+int load_index_locked(index_t *index)
+{
+    if(!local_repo_exist())
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+
+    int fd = open(INDEX_LOCK_FILE, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return errno == EEXIST ? INDEX_LOCKED : FS_ERROR;
+    }
+
+    int result = load_index(index);
+    if (result != FS_OK)
+    {
+        close(fd);
+        unlink(INDEX_LOCK_FILE);
+        return result;
+    }
+
+    index->locked = 1;
+    index->lock_fd = fd;
+    return FS_OK;
+}
+
+/// @brief Write index to INDEX_LOCK_FILE and rename it over INDEX_FILE. The
+/// lock is the one of load_index_locked, or else it is created exclusively
+/// @return FS_OK, or INDEX_LOCKED when another command is writing the index
+int save_index(index_t *index)
+{
+    if(!local_repo_exist())
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+
+    int fd = index->lock_fd;
+    if (index->locked)
+        index->locked = 0;
+    else
+        fd = open(INDEX_LOCK_FILE, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return errno == EEXIST ? INDEX_LOCKED : FS_ERROR;
+    }
+    FILE *index_file = fdopen(fd, "w");
+    if(index_file == NULL)
+    {
+        close(fd);
+        unlink(INDEX_LOCK_FILE);
+        return FS_ERROR;
+    }
+
+    int result = FS_OK;
+    EVP_MD_CTX *ctx = sha1_init();
+
+    sort_tree(&index->entries);
+    unsigned char header[INDEX_HEADER_SIZE];
+    memcpy(header, INDEX_SIGNATURE, 4);
+    put_be32(header + 4, INDEX_VERSION);
+    put_be32(header + 8, index->entries.entries_size);
+    result |= write_index_data(index_file, ctx, header, INDEX_HEADER_SIZE);
+
+    for (size_t i = 0; i < index->entries.entries_size; i++)
+    {
+        entry_t *current = &index->entries.entries[i];
+        size_t name_len = strlen(current->filename);
+        size_t entry_size = (INDEX_ENTRY_FIXED_SIZE + name_len + 1 + 7) & ~(size_t)7;
+        unsigned char entry[entry_size];
+        memset(entry, 0, entry_size);
+
+        put_be32(entry, current->stat.ctime_sec);
+        put_be32(entry + 4, current->stat.ctime_nsec);
+        put_be32(entry + 8, current->stat.mtime_sec);
+        put_be32(entry + 12, current->stat.mtime_nsec);
+        put_be32(entry + 16, current->stat.dev);
+        put_be32(entry + 20, current->stat.ino);
+        put_be32(entry + 24, current->mode);
+        put_be32(entry + 28, current->stat.uid);
+        put_be32(entry + 32, current->stat.gid);
+        put_be64(entry + 36, current->stat.size);
+        memcpy(entry + 44, current->checksum, DIGEST_LENGTH);
+        uint16_t flags = name_len < INDEX_NAME_MASK ? name_len : INDEX_NAME_MASK;
+        if (current->fsmonitor_valid)
+            flags |= INDEX_FSMONITOR_VALID;
+        entry[64] = flags >> 8;
+        entry[65] = flags & 0xff;
+        memcpy(entry + INDEX_ENTRY_FIXED_SIZE, current->filename, name_len);
+
+        result |= write_index_data(index_file, ctx, entry, entry_size);
+    }
+
+    if (index->cache_tree != NULL)
+    {
+        unsigned char *data = NULL;
+        size_t size = 0, capacity = 0;
+        write_cache_tree(index->cache_tree, &data, &size, &capacity);
+
+        unsigned char extension_header[INDEX_EXTENSION_HEADER_SIZE];
+        memcpy(extension_header, CACHE_TREE_SIGNATURE, 4);
+        put_be32(extension_header + 4, size);
+        result |= write_index_data(index_file, ctx, extension_header, INDEX_EXTENSION_HEADER_SIZE);
+        result |= write_index_data(index_file, ctx, data, size);
+        free(data);
+    }
+
+    if (index->untracked != NULL)
+    {
+        unsigned char *data = NULL;
+        size_t size = 0, capacity = 0;
+        write_untracked_cache(index->untracked, &data, &size, &capacity);
+
+        unsigned char extension_header[INDEX_EXTENSION_HEADER_SIZE];
+        memcpy(extension_header, UNTRACKED_CACHE_SIGNATURE, 4);
+        put_be32(extension_header + 4, size);
+        result |= write_index_data(index_file, ctx, extension_header, INDEX_EXTENSION_HEADER_SIZE);
+        result |= write_index_data(index_file, ctx, data, size);
+        free(data);
+        index->untracked->changed = 0;
+    }
+
+    if (index->fsmonitor_token != NULL)
+    {
+        size_t size = strlen(index->fsmonitor_token) + 1;
+        unsigned char extension_header[INDEX_EXTENSION_HEADER_SIZE];
+        memcpy(extension_header, FSMONITOR_SIGNATURE, 4);
+        put_be32(extension_header + 4, size);
+        result |= write_index_data(index_file, ctx, extension_header, INDEX_EXTENSION_HEADER_SIZE);
+        result |= write_index_data(index_file, ctx, index->fsmonitor_token, size);
+    }
+
+    unsigned char checksum[DIGEST_LENGTH];
+    sha1_final(ctx, checksum);
+    if (fwrite(checksum, 1, DIGEST_LENGTH, index_file) != DIGEST_LENGTH)
+        result = FS_ERROR;
+    if (fclose(index_file) != 0)
+        result = FS_ERROR;
+
+    if (result != FS_OK || rename(INDEX_LOCK_FILE, INDEX_FILE) != 0)
+    {
+        unlink(INDEX_LOCK_FILE);
+        return FS_ERROR;
+    }
+
+    return FS_OK;
+}
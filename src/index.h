@@ -0,0 +1,93 @@
+#ifndef INDEX_H
+#define INDEX_H 1
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "cache_tree.h"
+#include "types.h"
+#include "untracked_cache.h"
+
+// Index file should follow the format
+// "CIDX" + version (4 bytes) + number of entries (4 bytes)
+// entry1
+// entry2
+// ...
+// extension1
+// ...
+// SHA-1 of everything above
+//
+// Entries are sorted by path, each one is
+// ctime seconds, ctime nanoseconds, mtime seconds, mtime nanoseconds,
+// dev, ino, mode, uid, gid (4 bytes each), size (8 bytes),
+// checksum (DIGEST_LENGTH bytes), flags (2 bytes, the lower 12 bits hold
+// the length of the path, INDEX_FSMONITOR_VALID is set when the file did not
+// change since the fsmonitor token), path + '\0', padded with '\0' to a
+// multiple of 8 bytes
+//
+// An extension is a 4 bytes signature + size of its data (4 bytes) + data,
+// extensions that are not known are skipped. The known extensions are
+// - "TREE": the cache tree, see cache_tree.h
+// - "UNTR": the untracked cache, see untracked_cache.h
+// - "FSMN": the token of the fsmonitor daemon + '\0', see fsmonitor.h
+//
+// All integers are stored in network byte order.
+//
+// An index file that does not start with the signature is read in the
+// previous format: a serialized tree holding only the staged files.
+
+#define INDEX_SIGNATURE "CIDX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 12
+#define INDEX_ENTRY_FIXED_SIZE (9 * 4 + 8 + DIGEST_LENGTH + 2)
+#define INDEX_NAME_MASK 0x0fff
+#define INDEX_FSMONITOR_VALID 0x8000
+#define FSMONITOR_SIGNATURE "FSMN"
+#define INDEX_EXTENSION_HEADER_SIZE 8
+
+#define INVALID_INDEX (-60)
+#define INDEX_LOCKED (-61)
+#define ENTRY_UNCHANGED (1)
+
+typedef struct index {
+    tree_t entries;
+    // Modification time of the index file when it was loaded, entries
+    // modified after it cannot be trusted from their stat data alone
+    struct timespec timestamp;
+    // Trees of the directories as of the last commit, NULL when unknown
+    cache_tree_t *cache_tree;
+    // What the last scan for untracked files found, NULL when never scanned
+    untracked_cache_t *untracked;
+    // Token of the fsmonitor daemon, NULL when it was never asked
+    char *fsmonitor_token;
+    // Whether the daemon answered during this command, when it did the paths
+    // marked as fsmonitor_valid are not checked
+    int fsmonitor_active;
+    // Whether INDEX_LOCK_FILE is held, open on lock_fd, see load_index_locked
+    int locked;
+    int lock_fd;
+} index_t;
+
+typedef void (*untracked_fn)(char *path, void *data);
+
+void free_index(index_t *index);
+int load_index(index_t *index);
+int load_index_locked(index_t *index);
+int save_index(index_t *index);
+
+enum file_mode mode_from_stat(struct stat *st);
+void fill_stat_data(struct stat_data *data, struct stat *st);
+int entry_is_clean(index_t *index, entry_t *entry, struct stat *st);
+int stage_file(index_t *index, char *filename, struct stat *st, unsigned char *checksum);
+void set_index_entry(index_t *index, char *filename, unsigned char *checksum, struct stat *st);
+void invalidate_index_path(index_t *index, char *path);
+int add_to_index(index_t *index, char *filename, struct stat *st);
+int refresh_index(index_t *index);
+int write_index_tree(index_t *index, unsigned char *checksum);
+int index_has_dir(index_t *index, char *dir);
+size_t list_untracked_files(index_t *index, char *dir, int collapse, untracked_fn callback, void *data);
+int index_from_tree(index_t *index, tree_t *tree, char *prefix);
+int load_commit_index(char *commit_checksum, index_t *index);
+
+#endif // INDEX_H
@@ -4,13 +4,24 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "includes.h"
+#include "cat_file.h"
+#include "checkout.h"
 #include "commit.h"
+#include "commit_graph.h"
 #include "fs.h"
+#include "fsmonitor.h"
+#include "index.h"
 #include "objects.h"
+#include "pack.h"
+#include "pager.h"
+#include "refs.h"
+#include "status.h"
 #include "tree.h"
+#include "workqueue.h"
 
 #define ARGS_MAX_SIZE 256
 
@@ -22,14 +33,21 @@
 int print_help()
 {
     printf("Usage: cgit init\n");
-    printf("       cgit add [FILES]\n");
+    printf("       cgit add [-j THREADS] [FILES]\n");
     printf("       cgit remove [FILES]\n");
     printf("       cgit commit -m [MESSAGE]\n");
-    printf("       cgit diff <COMMIT1> [COMMIT2]\n");
+    printf("       cgit status [-s]\n");
+    printf("       cgit diff [--patience] [--name-status | --raw] <COMMIT1> [COMMIT2]\n");
     printf("       cgit branch [BRANCH]\n");
     printf("       cgit checkout [BRANCH]\n");
     printf("       cgit reset <COMMIT>\n");
-    printf("       cgit log\n");
+    printf("       cgit log [-n <N>] [--oneline] [--since <DATE>]\n");
+    printf("       cgit cat-file (<OBJECT> | --batch | --batch-check)\n");
+    printf("       cgit repack [-a] [--window <N>] [--depth <N>]\n");
+    printf("       cgit pack-refs\n");
+    printf("       cgit commit-graph write\n");
+    printf("       cgit merge-base [--is-ancestor] <COMMIT1> <COMMIT2>\n");
+    printf("       cgit fsmonitor (start | stop | status)\n");
     return 0;
 }
 
@@ -59,15 +77,29 @@ int add(int argc, char **argv)
         return 0;
     }
 
-    struct tree index = {0};
-    if (load_index(&index) == REPO_NOT_INITIALIZED)
+    index_t index = {0};
+    res = load_index_locked(&index);
+    if (res == INDEX_LOCKED)
+    {
+        printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+        return 128;
+    } else if (res != FS_OK)
     {
         printf("Not a cgit repository\n");
         return 128;
     }
+    refresh_fsmonitor(&index);
 
+    int threads = default_thread_count();
     do {
-        if (add_file_to_index(&index, buf) == FILE_NOT_FOUND)
+        if (strcmp(buf, "-j") == 0 && pop_arg(&argc, &argv, buf) == 0)
+        {
+            threads = atoi(buf);
+            res = pop_arg(&argc, &argv, buf);
+            continue;
+        }
+
+        if (add_file_to_index(&index, buf, threads) == FILE_NOT_FOUND)
         {
             printf("File %s does not exist\n", buf);
             return 1;
@@ -75,10 +107,15 @@ int add(int argc, char **argv)
         res = pop_arg(&argc, &argv, buf);
     } while (res == 0);
 
-    save_index(&index);
-    free_tree(&index);
+    res = save_index(&index);
+    free_index(&index);
+    if (res == INDEX_LOCKED)
+    {
+        printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+        return 128;
+    }
 
-    return 0;
+    return res == FS_OK ? 0 : 1;
 }
 
 int remove_cmd(int argc, char **argv) 
@@ -93,8 +130,13 @@ int remove_cmd(int argc, char **argv)
         return 0;
     }
 
-    struct tree index = {0};
-    if (load_index(&index) == REPO_NOT_INITIALIZED)
+    index_t index = {0};
+    res = load_index_locked(&index);
+    if (res == INDEX_LOCKED)
+    {
+        printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+        return 128;
+    } else if (res != FS_OK)
     {
         printf("fatal: not a cgit repository\n");
         return 128;
@@ -105,10 +147,15 @@ int remove_cmd(int argc, char **argv)
         res = pop_arg(&argc, &argv, buf);
     } while (res == 0);
 
-    save_index(&index);
-    free_tree(&index);
+    res = save_index(&index);
+    free_index(&index);
+    if (res == INDEX_LOCKED)
+    {
+        printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+        return 128;
+    }
 
-    return 0;
+    return res == FS_OK ? 0 : 1;
 }
 
 int commit_cmd(int argc, char **argv)
@@ -123,10 +170,19 @@ int commit_cmd(int argc, char **argv)
         if (pop_arg(&argc, &argv, buf) == 1)
             goto usage;
         
-        if (commit(buf) == REPO_NOT_INITIALIZED)
+        int res = commit(buf);
+        if (res == REPO_NOT_INITIALIZED)
         {
             printf("Not a cgit repository\n");
             return 128;
+        } else if (res == INDEX_LOCKED)
+        {
+            printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+            return 128;
+        } else if (res != FS_OK)
+        {
+            printf("Could not commit\n");
+            return 1;
         }
     }
 
@@ -139,40 +195,69 @@ usage:
 
 int diff(int argc, char **argv)
 {
+    char buf[ARGS_MAX_SIZE];
     char checksum_a[ARGS_MAX_SIZE];
     char checksum_b[ARGS_MAX_SIZE];
+    int commits_count = 0;
+
+    struct diff_options options;
+    init_diff_options(&options);
+
+    while (pop_arg(&argc, &argv, buf) == 0)
+    {
+        if (strcmp(buf, "--patience") == 0)
+        {
+            options.algorithm = DIFF_PATIENCE;
+        } else if (strcmp(buf, "--myers") == 0)
+        {
+            options.algorithm = DIFF_MYERS;
+        } else if (strcmp(buf, "--name-status") == 0)
+        {
+            options.output = DIFF_OUTPUT_NAME_STATUS;
+        } else if (strcmp(buf, "--raw") == 0)
+        {
+            options.output = DIFF_OUTPUT_RAW;
+        } else if (commits_count < 2)
+        {
+            strcpy(commits_count == 0 ? checksum_a : checksum_b, buf);
+            commits_count++;
+        } else
+        {
+            goto usage;
+        }
+    }
 
-    if(pop_arg(&argc, &argv, checksum_a) == 1)
+    if (commits_count == 0)
     {
         printf("No commit specified\n");
         return 0;
     }
 
-    if(pop_arg(&argc, &argv, checksum_b) == 0)
-    {
-        if (diff_commit(checksum_a, checksum_b, 1) == OBJECT_DOES_NOT_EXIST)
-        {
-            if(errno == 1)
-            {
-                printf("Could not find commit %s\n", checksum_a);
-            } else if (errno == 2)
-            {
-                printf("Could not find commit %s\n", checksum_b);
-            }
-            return 0;
-        }
-    } else 
+    options.color = isatty(STDOUT_FILENO);
+    FILE *out = start_pager();
+
+    int res;
+    if (commits_count == 2)
+        res = diff_commit(checksum_a, checksum_b, &options, out);
+    else
+        res = diff_commit_with_working_tree(checksum_a, &options, out);
+    stop_pager(out);
+
+    if (res == OBJECT_DOES_NOT_EXIST)
     {
-        if (diff_commit_with_working_tree(checksum_a, 1) == OBJECT_DOES_NOT_EXIST)
+        if (commits_count == 1 || errno == 1)
         {
             printf("Could not find commit %s\n", checksum_a);
-            return 0;
+        } else if (errno == 2)
+        {
+            printf("Could not find commit %s\n", checksum_b);
         }
     }
-
-    FILE *p = popen("cat "LOCAL_REPO"/last.diff | less -R", "w");
-    pclose(p);
     return 0;
+
+usage:
+    printf("usage: cgit diff [--patience] [--name-status | --raw] <COMMIT1> [COMMIT2]\n");
+    return 129;
 }
 
 int checkout(int argc, char **argv)
@@ -182,14 +267,25 @@ int checkout(int argc, char **argv)
     if(pop_arg(&argc, &argv, buf) == 1)
     {
         printf("No branch name specified\n");
-        return 0;
+        return 1;
     }
 
     debug_print("Checking out on %s", buf);
-    if (checkout_branch(buf) == BRANCH_DOES_NOT_EXIST)
+    int res = checkout_branch(buf);
+    if (res == BRANCH_DOES_NOT_EXIST)
     {
         printf("Branch %s does not exist, use cgit branch <name> to create one\n", buf);
+    } else if (res == CHECKOUT_CONFLICT)
+    {
+        printf("Commit or remove them before checking out %s, nothing was changed\n", buf);
+    } else if (res == INDEX_LOCKED)
+    {
+        printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+    } else if (res != FS_OK)
+    {
+        printf("Could not check out %s, the working tree may be partly updated\n", buf);
     }
+    return res == FS_OK ? 0 : 1;
 }
 
 int reset(int argc, char **argv)
@@ -199,7 +295,7 @@ int reset(int argc, char **argv)
     if(pop_arg(&argc, &argv, buf) == 1)
     {
         printf("You must give a commit to reset to\n");
-        return 0;
+        return 1;
     }
 
     int res = reset_to(buf);
@@ -209,7 +305,17 @@ int reset(int argc, char **argv)
     } else if (res == WRONG_OBJECT_TYPE)
     {
         printf("Object %s is not a commit and thus cannot be reset to\n", buf);
+    } else if (res == CHECKOUT_CONFLICT)
+    {
+        printf("Move or remove them before resetting to %s, nothing was changed\n", buf);
+    } else if (res == INDEX_LOCKED)
+    {
+        printf("The index is being written by another command, remove %s if none is running\n", INDEX_LOCK_FILE);
+    } else if (res != FS_OK)
+    {
+        printf("Could not reset to %s, the working tree may be partly updated\n", buf);
     }
+    return res == FS_OK ? 0 : 1;
 }
 
 int branch(int argc, char **argv)
@@ -218,29 +324,156 @@ int branch(int argc, char **argv)
 
     if (pop_arg(&argc, &argv, buf) == 1)
     {
-        if (dump_branches() == REPO_NOT_INITIALIZED)
+        FILE *out = start_pager();
+        int res = print_branches(out);
+        stop_pager(out);
+        if (res == REPO_NOT_INITIALIZED)
         {
             printf("Not a cgit repository\n");
             return 128;
         }
-        FILE *p = popen("cat "TMP"/branches | less", "w");
-        pclose(p);
         return 0;
     } 
 
-    if (new_branch(buf) == BRANCH_ALREADY_EXIST)
+    int res = new_branch(buf);
+    if (res == BRANCH_ALREADY_EXIST)
     {
         printf("Branch %s already exist\n", buf);
+    } else if (res == INVALID_REF_NAME)
+    {
+        printf("%s is not a valid branch name\n", buf);
+        return 128;
+    } else if (res == NO_CURRENT_HEAD)
+    {
+        printf("Cannot create a branch before the first commit\n");
+        return 128;
+    } else if (res == REF_LOCKED)
+    {
+        printf("Branch %s is being updated by another command\n", buf);
+        return 128;
     }
 
     return 0;
 }
 
+/// @brief Parse the date of --since, either "@<seconds since epoch>",
+/// "YYYY-MM-DD[ HH:MM[:SS]]" in local time or "<N> <unit> ago", where the
+/// unit is seconds, minutes, hours, days, weeks, months or years. The spaces
+/// of the last form may be replaced by dots, as in "2.weeks.ago"
+/// @return the date, or -1 when it cannot be parsed
+static time_t parse_since(char *date)
+{
+    long long seconds;
+    if (sscanf(date, "@%lld", &seconds) == 1)
+        return seconds;
+
+    struct tm tm = {0};
+    int matched = sscanf(date, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                         &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (matched >= 3)
+    {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        return mktime(&tm);
+    }
+
+    long count;
+    char unit[16];
+    if (sscanf(date, "%ld%*[ .]%15[a-z]", &count, unit) != 2)
+        return -1;
+
+    static const struct { char *name; long seconds; } units[] = {
+        { "second", 1 }, { "minute", 60 }, { "hour", 3600 }, { "day", 86400 },
+        { "week", 7 * 86400 }, { "month", 30 * 86400 }, { "year", 365 * 86400 },
+    };
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strncmp(unit, units[i].name, strlen(units[i].name)) == 0)
+            return time(NULL) - count * units[i].seconds;
+    }
+
+    return -1;
+}
+
 int log_cmd(int argc, char **argv)
 {
-    dump_log();
-    FILE *p = popen("cat "LOG_FILE" | less", "w");
-    pclose(p);
+    char buf[ARGS_MAX_SIZE];
+    struct log_options options = {
+        .max_count = -1,
+        .oneline = 0,
+        .since = 0,
+    };
+
+    while (pop_arg(&argc, &argv, buf) == 0)
+    {
+        if (strcmp(buf, "-n") == 0 && pop_arg(&argc, &argv, buf) == 0)
+        {
+            options.max_count = atol(buf);
+        } else if (strcmp(buf, "--oneline") == 0)
+        {
+            options.oneline = 1;
+        } else if (strncmp(buf, "--since=", 8) == 0 || (strcmp(buf, "--since") == 0 && pop_arg(&argc, &argv, buf) == 0))
+        {
+            char *date = strncmp(buf, "--since=", 8) == 0 ? buf + 8 : buf;
+            options.since = parse_since(date);
+            if (options.since == -1)
+            {
+                printf("Invalid date %s\n", date);
+                return 129;
+            }
+        } else
+        {
+            printf("usage: cgit log [-n <N>] [--oneline] [--since <DATE>]\n");
+            return 129;
+        }
+    }
+
+    FILE *out = start_pager();
+    int res = print_log(&options, out);
+    stop_pager(out);
+
+    if (res == REPO_NOT_INITIALIZED)
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    }
+    return 0;
+}
+
+int status(int argc, char **argv)
+{
+    char buf[ARGS_MAX_SIZE];
+    int format = STATUS_LONG;
+
+    while (pop_arg(&argc, &argv, buf) == 0)
+    {
+        if (strcmp(buf, "-s") == 0 || strcmp(buf, "--short") == 0)
+        {
+            format = STATUS_SHORT;
+        } else
+        {
+            printf("usage: cgit status [-s]\n");
+            return 129;
+        }
+    }
+
+    if (!local_repo_exist())
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    }
+
+    FILE *out = start_pager();
+    int res = print_status(format, out);
+    stop_pager(out);
+
+    if (res != FS_OK)
+    {
+        printf("Could not read the index\n");
+        return 128;
+    }
+    return 0;
 }
 
 int cat_file(int argc, char **argv)
@@ -249,10 +482,27 @@ int cat_file(int argc, char **argv)
 
     if(pop_arg(&argc, &argv, buf) == 1)
     {
-        printf("usage: cgit cat-file <object>\n");
+        printf("usage: cgit cat-file (<object> | --batch | --batch-check)\n");
         return 129;
     }
 
+    if (strcmp(buf, "--batch") == 0 || strcmp(buf, "--batch-check") == 0)
+    {
+        int mode = strcmp(buf, "--batch") == 0 ? CAT_FILE_BATCH : CAT_FILE_BATCH_CHECK;
+        int res = cat_file_batch(mode, STDIN_FILENO, stdout);
+        if (res == REPO_NOT_INITIALIZED)
+        {
+            printf("Not a cgit repository\n");
+            return 128;
+        }
+        if (res != FS_OK)
+        {
+            fprintf(stderr, "fatal: could not read an object\n");
+            return 128;
+        }
+        return 0;
+    }
+
     object_t obj = {0};
     int res = read_object(buf, &obj);
     if (res != FS_OK)
@@ -270,23 +520,240 @@ int cat_file(int argc, char **argv)
         }
     }
 
-    cat_object(STDIN_FILENO, &obj);
+    cat_object(STDOUT_FILENO, &obj);
     free_object(&obj);
     
     return 0;
 }
 
-int show_index(int argc, char **argv)
+int pack_refs_cmd(int argc, char **argv)
+{
+    size_t count = 0;
+    int res = pack_refs(&count);
+    if (res == REPO_NOT_INITIALIZED)
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    } else if (res == REF_LOCKED)
+    {
+        printf("The packed refs are being written by another command\n");
+        return 128;
+    } else if (res != FS_OK)
+    {
+        printf("Could not pack the refs\n");
+        return 128;
+    }
+
+    printf("Packed %zu refs\n", count);
+    return 0;
+}
+
+int commit_graph(int argc, char **argv)
 {
-    tree_t index = {0};
-    load_index(&index);
+    char buf[ARGS_MAX_SIZE];
 
-    object_t obj = {0};
-    tree_to_object(&index, &obj);
-    free_tree(&index);
+    if (pop_arg(&argc, &argv, buf) == 1 || strcmp(buf, "write") != 0)
+    {
+        printf("usage: cgit commit-graph write\n");
+        return 129;
+    }
 
-    cat_object(STDIN_FILENO, &obj);
-    free_object(&obj);
+    size_t count = 0;
+    int res = write_commit_graph(&count);
+    if (res == REPO_NOT_INITIALIZED)
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    } else if (res != FS_OK)
+    {
+        printf("Could not write the commit graph\n");
+        return 128;
+    }
+
+    printf("Wrote the commit graph of %zu commits\n", count);
+    return 0;
+}
+
+int fsmonitor(int argc, char **argv)
+{
+    char buf[ARGS_MAX_SIZE];
+
+    if (pop_arg(&argc, &argv, buf) == 1
+        || (strcmp(buf, "start") != 0 && strcmp(buf, "stop") != 0 && strcmp(buf, "status") != 0))
+    {
+        printf("usage: cgit fsmonitor (start | stop | status)\n");
+        return 129;
+    }
+
+    if (!local_repo_exist())
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    }
+
+    if (strcmp(buf, "status") == 0)
+    {
+        printf(fsmonitor_is_running() ? "fsmonitor is watching the working tree\n" : "fsmonitor is not running\n");
+        return 0;
+    }
+
+    if (strcmp(buf, "stop") == 0)
+    {
+        if (stop_fsmonitor() != FS_OK)
+        {
+            printf("fsmonitor is not running\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    int res = start_fsmonitor();
+    if (res == FSMONITOR_ALREADY_RUNNING)
+    {
+        printf("fsmonitor is already running\n");
+        return 1;
+    } else if (res != FS_OK)
+    {
+        printf("Could not start fsmonitor\n");
+        return 128;
+    }
+    return 0;
+}
+
+int merge_base_cmd(int argc, char **argv)
+{
+    char buf[ARGS_MAX_SIZE];
+    char checksums[2][ARGS_MAX_SIZE];
+    int is_ancestor = 0;
+    int commits_count = 0;
+
+    while (pop_arg(&argc, &argv, buf) == 0)
+    {
+        if (strcmp(buf, "--is-ancestor") == 0)
+        {
+            is_ancestor = 1;
+        } else if (commits_count < 2)
+        {
+            strcpy(checksums[commits_count++], buf);
+        } else
+        {
+            goto usage;
+        }
+    }
+    if (commits_count != 2)
+        goto usage;
+
+    unsigned char a[DIGEST_LENGTH], b[DIGEST_LENGTH], base[DIGEST_LENGTH];
+    for (int i = 0; i < 2; i++)
+    {
+        if (hexa_to_hash(checksums[i], i == 0 ? a : b) != 0)
+        {
+            printf("Could not find commit %s\n", checksums[i]);
+            return 128;
+        }
+    }
+
+    struct commit_graph graph;
+    load_commit_graph(&graph);
+    int res = merge_base(&graph, a, b, base);
+    free_commit_graph(&graph);
+
+    if (res < 0)
+    {
+        printf("Could not find the commits %s and %s\n", checksums[0], checksums[1]);
+        return 128;
+    }
+
+    // As git, --is-ancestor only answers with the exit code
+    if (is_ancestor)
+        return res == 1 && memcmp(base, a, DIGEST_LENGTH) == 0 ? 0 : 1;
+
+    if (res == 0)
+        return 1;
+
+    char hexa[DIGEST_LENGTH * 2 + 1];
+    hash_to_hexa(base, hexa);
+    printf("%s\n", hexa);
+    return 0;
+
+usage:
+    printf("usage: cgit merge-base [--is-ancestor] <COMMIT1> <COMMIT2>\n");
+    return 129;
+}
+
+int repack(int argc, char **argv)
+{
+    char buf[ARGS_MAX_SIZE];
+    struct repack_options options = {
+        .all = 0,
+        .window = DEFAULT_PACK_WINDOW,
+        .depth = DEFAULT_PACK_DEPTH,
+    };
+
+    while (pop_arg(&argc, &argv, buf) == 0)
+    {
+        if (strcmp(buf, "-a") == 0)
+        {
+            options.all = 1;
+        } else if (strcmp(buf, "--window") == 0 && pop_arg(&argc, &argv, buf) == 0)
+        {
+            options.window = atoi(buf);
+        } else if (strcmp(buf, "--depth") == 0 && pop_arg(&argc, &argv, buf) == 0)
+        {
+            options.depth = atoi(buf);
+        } else
+        {
+            goto usage;
+        }
+    }
+
+    if (options.window < 0 || options.depth < 0)
+        goto usage;
+    // Longer chains could be written but never read back
+    if (options.depth < 1)
+        options.depth = 1;
+    if (options.depth > PACK_MAX_DELTA_DEPTH - 1)
+        options.depth = PACK_MAX_DELTA_DEPTH - 1;
+
+    size_t packed_count = 0;
+    int res = repack_objects(&options, &packed_count);
+    if (res == REPO_NOT_INITIALIZED)
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    }
+
+    if (res != FS_OK)
+    {
+        printf("fatal: failed to write pack\n");
+        return 1;
+    }
+
+    printf("Packed %zu objects\n", packed_count);
+    return 0;
+
+usage:
+    printf("usage: cgit repack [-a] [--window <N>] [--depth <N>]\n");
+    return 129;
+}
+
+int show_index(int argc, char **argv)
+{
+    index_t index = {0};
+    if (load_index(&index) != FS_OK)
+    {
+        printf("Not a cgit repository\n");
+        return 128;
+    }
+
+    for (size_t i = 0; i < index.entries.entries_size; i++)
+    {
+        entry_t *current = &index.entries.entries[i];
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(current->checksum, checksum);
+        printf("%.6o %s %s\n", current->mode, checksum, current->filename);
+    }
+    free_index(&index);
 
     return 0;
 }
@@ -315,6 +782,9 @@ int main(int argc, char **argv)
     } else if (strcmp(buf, "commit") == 0)
     {
         return commit_cmd(argc, argv);
+    } else if (strcmp(buf, "status") == 0)
+    {
+        return status(argc, argv);
     } else if (strcmp(buf, "diff") == 0)
     {
         return diff(argc, argv);
@@ -335,6 +805,21 @@ int main(int argc, char **argv)
     } else if (strcmp(buf, "cat-file") == 0) 
     {  
         return cat_file(argc, argv);
+    } else if (strcmp(buf, "repack") == 0)
+    {
+        return repack(argc, argv);
+    } else if (strcmp(buf, "pack-refs") == 0)
+    {
+        return pack_refs_cmd(argc, argv);
+    } else if (strcmp(buf, "commit-graph") == 0)
+    {
+        return commit_graph(argc, argv);
+    } else if (strcmp(buf, "merge-base") == 0)
+    {
+        return merge_base_cmd(argc, argv);
+    } else if (strcmp(buf, "fsmonitor") == 0)
+    {
+        return fsmonitor(argc, argv);
     } else if (strcmp(buf, "show-index") == 0) 
     {  
         return show_index(argc, argv);
@@ -351,7 +836,7 @@ int main(int argc, char **argv)
         // commit_to_object(&commit, &obj);
         // write_object(&obj);
 
-        commit_from_object(&commit, &obj);
+        commit_from_object(&commit, &obj, NULL);
 
         debug_print("tree %s", commit.tree);
         debug_print("parent %s", commit.parent);
@@ -1,6 +1,6 @@
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
-#include <openssl/sha.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -74,16 +74,26 @@ int full_object(struct object *obj, char *buffer, size_t buffer_size)
     return 0;
 }
 
+/// @brief Write the header of an object of the given type and size
+/// @param header buffer of size HEADER_MAX_SIZE
+/// @return The size of the header, including its final '\0'
+int format_header(enum object_type type, size_t size, char *header)
+{
+    return sprintf(header, "%s %zu", object_type_str[type], size) + 1;
+}
+
 /// @brief Hash object and copy it in result
 /// @param obj
 /// @param result char array of size DIGEST_LENGTH, it is not a C-string.
 void hash_object(object_t *obj, unsigned char *result)
 {
-    size_t data_size = object_size(obj);
-    char data[data_size];
-    full_object(obj, data, data_size);
+    char header[HEADER_MAX_SIZE];
+    int header_len = format_header(obj->object_type, obj->size, header);
 
-    SHA1(data, data_size, result);
+    EVP_MD_CTX *ctx = sha1_init();
+    sha1_update(ctx, header, header_len);
+    sha1_update(ctx, obj->content, obj->size);
+    sha1_final(ctx, result);
     return;
 }
 
@@ -95,6 +105,34 @@ void hash_to_hexa(unsigned char *hash, char *result)
     return;
 }
 
+/// @brief Convert the hexa representation of a checksum back to its binary form
+/// @param hexa A C-string of length equals DIGEST_LENGTH * 2
+/// @param result char array of size DIGEST_LENGTH
+/// @return 0 on success, -1 if hexa is not a valid checksum
+int hexa_to_hash(char *hexa, unsigned char *result)
+{
+    for (int i = 0; i < DIGEST_LENGTH * 2; i++)
+    {
+        char c = hexa[i];
+        int value;
+        if (c >= '0' && c <= '9')
+            value = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value = c - 'A' + 10;
+        else
+            return -1;
+
+        if (i % 2 == 0)
+            result[i / 2] = value << 4;
+        else
+            result[i / 2] |= value;
+    }
+
+    return hexa[DIGEST_LENGTH * 2] == '\0' ? 0 : -1;
+}
+
 /// @brief Hash object and copy its hexa representation in result
 /// @param obj
 /// @param result A C-string of length equals DIGEST_LENGTH * 2
@@ -107,49 +145,230 @@ void hash_object_str(object_t *obj, char *result)
     return;
 }
 
-int uncompress_object(struct object *obj, char *compressed, uLongf comp_size)
+static int parse_header(char *header, size_t len, struct object *obj, size_t *header_len)
 {
-    uLongf def_size = HEADER_MAX_SIZE;
-    uLongf content_size = 0;
-    char *deflated = malloc(def_size);
-    int res = uncompress((Bytef *)deflated, &def_size, (Bytef *)compressed, comp_size);
-    if (res != Z_OK && res != Z_BUF_ERROR)
+    char *end = memchr(header, '\0', len);
+    if (end == NULL)
+        return Z_DATA_ERROR;
+
+    char *space = memchr(header, ' ', end - header);
+    if (space == NULL)
+        return Z_DATA_ERROR;
+
+    char *size_end;
+    obj->object_type = str_to_object_type(header);
+    obj->size = strtoull(space + 1, &size_end, 10);
+    if (size_end != end)
+        return Z_DATA_ERROR;
+
+    *header_len = end - header + 1;
+    return Z_OK;
+}
+
+/// @brief Feed the stream with at most UINT_MAX bytes at a time
+static void refill_input(z_stream *stream, Bytef **next_in, size_t *left_in)
+{
+    if (stream->avail_in != 0 || *left_in == 0)
+        return;
+
+    stream->next_in = *next_in;
+    stream->avail_in = *left_in > UINT_MAX ? UINT_MAX : *left_in;
+    *next_in += stream->avail_in;
+    *left_in -= stream->avail_in;
+}
+
+/// @brief Inflate into buffer until it is full or the stream ends, the input
+/// is fed from next_in at most UINT_MAX bytes at a time
+/// @return Z_OK when buffer is full, Z_STREAM_END, or a zlib error
+int inflate_to(z_stream *stream, Bytef **next_in, size_t *left_in, char *buffer, size_t size, size_t *inflated)
+{
+    int res = Z_OK;
+    *inflated = 0;
+    while (*inflated < size && res == Z_OK)
     {
+        refill_input(stream, next_in, left_in);
+        size_t left_out = size - *inflated;
+        stream->next_out = (Bytef *)buffer + *inflated;
+        stream->avail_out = left_out > UINT_MAX ? UINT_MAX : left_out;
+
+        uInt avail_out = stream->avail_out;
+        res = inflate(stream, Z_NO_FLUSH);
+        *inflated += avail_out - stream->avail_out;
+        if (res == Z_BUF_ERROR && stream->avail_in == 0 && *left_in == 0)
+            return Z_DATA_ERROR;
+        if (res == Z_BUF_ERROR)
+            res = Z_OK;
+    }
+
+    return res;
+}
+
+/// @brief Inflate the first bytes of the stream and parse the object header out of them
+/// @param header buffer of size HEADER_MAX_SIZE, holds the first bytes of content on return
+static int inflate_header(z_stream *stream, Bytef **next_in, size_t *left_in,
+                          struct object *obj, char *header, size_t *header_len, size_t *inflated)
+{
+    int res = inflate_to(stream, next_in, left_in, header, HEADER_MAX_SIZE, inflated);
+    if (res != Z_OK && res != Z_STREAM_END)
+        return res;
+
+    res = parse_header(header, *inflated, obj, header_len);
+    if (res != Z_OK)
+        return res;
+
+    if (*inflated - *header_len > obj->size)
+        return Z_DATA_ERROR;
+
+    return Z_OK;
+}
+
+/// @brief Inflate a loose object in one pass, the header is parsed from the first
+/// inflated bytes and the rest is inflated straight into obj->content
+int uncompress_object(struct object *obj, char *compressed, size_t comp_size)
+{
+    z_stream stream = {0};
+    if (inflateInit(&stream) != Z_OK)
+        return Z_MEM_ERROR;
+
+    Bytef *next_in = (Bytef *)compressed;
+    size_t left_in = comp_size;
+    char header[HEADER_MAX_SIZE];
+    size_t header_len, inflated;
+    int res = inflate_header(&stream, &next_in, &left_in, obj, header, &header_len, &inflated);
+    if (res != Z_OK)
+    {
+        inflateEnd(&stream);
         return res;
     }
-    int header_size = strlen(deflated) + 1;
-    def_size = header_size;
-    strtok(deflated, " ");
-    char *hr_size = strtok(NULL, " ");
-    content_size = strtol(hr_size, NULL, 10);
-    def_size += content_size;
-    deflated = realloc(deflated, def_size);
-    res = uncompress((Bytef *)deflated, &def_size, (Bytef *)compressed, comp_size);
+
+    size_t head_content = inflated - header_len;
+    obj->content = malloc(obj->size == 0 ? 1 : obj->size);
+    memcpy(obj->content, header + header_len, head_content);
+
+    size_t content_inflated = 0;
+    res = inflate_to(&stream, &next_in, &left_in, obj->content + head_content, obj->size - head_content, &content_inflated);
+    if (res == Z_OK)
+    {
+        // Content is complete, only the end of stream marker is left
+        char trailing;
+        res = inflate_to(&stream, &next_in, &left_in, &trailing, 1, &inflated);
+        if (inflated != 0)
+            res = Z_DATA_ERROR;
+    }
+    inflateEnd(&stream);
+
+    if (res != Z_STREAM_END || head_content + content_inflated != obj->size)
+    {
+        free(obj->content);
+        obj->content = NULL;
+        return res == Z_STREAM_END ? Z_DATA_ERROR : res;
+    }
+
+    return Z_OK;
+}
+
+/// @brief Inflate a loose object by chunks of OBJECT_CHUNK_SIZE bytes, memory use
+/// does not depend on the size of the object
+/// @param callback called for each chunk of content, with header holding the type
+/// and size of the object, a non zero return stops the inflate
+int uncompress_object_stream(char *compressed, size_t comp_size, object_chunk_fn callback, void *data)
+{
+    z_stream stream = {0};
+    if (inflateInit(&stream) != Z_OK)
+        return Z_MEM_ERROR;
+
+    Bytef *next_in = (Bytef *)compressed;
+    size_t left_in = comp_size;
+    object_t header_obj = {0};
+    char header[HEADER_MAX_SIZE];
+    size_t header_len, inflated;
+    int res = inflate_header(&stream, &next_in, &left_in, &header_obj, header, &header_len, &inflated);
     if (res != Z_OK)
     {
+        inflateEnd(&stream);
         return res;
     }
-    char *content_type_tmp = strtok(deflated, " ");
 
-    obj->size = content_size;
-    obj->object_type = str_to_object_type(content_type_tmp);
-    obj->content = malloc(obj->size);
-    memcpy(obj->content, deflated + header_size, obj->size);
-    free(deflated);
+    size_t total = inflated - header_len;
+    if (total > 0 && callback(&header_obj, header + header_len, total, data) != 0)
+    {
+        inflateEnd(&stream);
+        return Z_OK;
+    }
+
+    char *chunk = malloc(OBJECT_CHUNK_SIZE);
+    while (res == Z_OK)
+    {
+        res = inflate_to(&stream, &next_in, &left_in, chunk, OBJECT_CHUNK_SIZE, &inflated);
+        if (res != Z_OK && res != Z_STREAM_END)
+            break;
 
-    return 0;
+        total += inflated;
+        if (total > header_obj.size)
+        {
+            res = Z_DATA_ERROR;
+            break;
+        }
+
+        if (inflated > 0 && callback(&header_obj, chunk, inflated, data) != 0)
+        {
+            res = Z_STREAM_END;
+            total = header_obj.size;
+        }
+    }
+    free(chunk);
+    inflateEnd(&stream);
+
+    if (res != Z_STREAM_END || total != header_obj.size)
+        return res == Z_STREAM_END ? Z_DATA_ERROR : res;
+
+    return Z_OK;
 }
 
+/// @brief Inflate only the header of a loose object, obj->content is left NULL
+int uncompress_object_header(struct object *obj, char *compressed, size_t comp_size)
+{
+    z_stream stream = {0};
+    if (inflateInit(&stream) != Z_OK)
+        return Z_MEM_ERROR;
+
+    Bytef *next_in = (Bytef *)compressed;
+    size_t left_in = comp_size;
+    char header[HEADER_MAX_SIZE];
+    size_t header_len, inflated;
+    int res = inflate_header(&stream, &next_in, &left_in, obj, header, &header_len, &inflated);
+    inflateEnd(&stream);
+    obj->content = NULL;
+
+    return res;
+}
+
+/// @brief Deflate header and content of obj in compressed without assembling them first
+/// @param comp_size size of compressed, set to the size of the compressed data on return
 int compress_object(struct object *obj, char *compressed, uLongf *comp_size)
 {
-    size_t data_size = object_size(obj);
-    char *data = malloc(data_size);
-    full_object(obj, data, data_size);
+    char header[HEADER_MAX_SIZE];
+    int header_len = format_header(obj->object_type, obj->size, header);
 
-    int res = compress((Bytef *)compressed, comp_size, (Bytef *)data, data_size);
-    free(data);
+    z_stream stream = {0};
+    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+        return Z_MEM_ERROR;
 
-    return res;
+    stream.next_out = (Bytef *)compressed;
+    stream.avail_out = *comp_size;
+    stream.next_in = (Bytef *)header;
+    stream.avail_in = header_len;
+    int res = deflate(&stream, Z_NO_FLUSH);
+
+    stream.next_in = (Bytef *)obj->content;
+    stream.avail_in = obj->size;
+    while (res == Z_OK)
+        res = deflate(&stream, Z_FINISH);
+
+    *comp_size = stream.total_out;
+    deflateEnd(&stream);
+
+    return res == Z_STREAM_END ? Z_OK : Z_BUF_ERROR;
 }
 
 int cat_object(int fd, object_t *obj)
@@ -164,15 +383,14 @@ int cat_object(int fd, object_t *obj)
 
     case TREE:
         tree_t tree = {0};
-        tree_from_object(&tree, obj);
+        tree_from_object(&tree, obj, NULL);
 
-        entry_t *current = tree.first_entry;
-        while(current != NULL)
+        for (size_t i = 0; i < tree.entries_size; i++)
         {
+            entry_t *current = &tree.entries[i];
             char buf[DIGEST_LENGTH * 2 + 1];
             hash_to_hexa(current->checksum, buf);
             dprintf(fd, "%.6o %s %s %s\n", current->mode, object_type_to_str(current->type), buf, current->filename);
-            current = current->next;
         }
 
         free_tree(&tree);
@@ -2,21 +2,29 @@
 #define OBJECTS_H 1
 
 #include <stddef.h>
-#include <zconf.h>
+#include <zlib.h>
 
 #include "types.h"
 
-#define HEADER_MAX_SIZE 20
+#define HEADER_MAX_SIZE 32
+#define OBJECT_CHUNK_SIZE 65536
+
+typedef int (*object_chunk_fn)(object_t *header, char *chunk, size_t chunk_size, void *data);
 
 char* object_type_to_str(enum object_type type);
 enum object_type str_to_object_type(char* str);
 size_t object_size(struct object *obj);
+int format_header(enum object_type type, size_t size, char *header);
 int full_object(struct object *obj, char* buffer, size_t buffer_size);
-int uncompress_object(struct object *obj, char* compressed, uLongf comp_size);
+int uncompress_object(struct object *obj, char* compressed, size_t comp_size);
+int uncompress_object_header(struct object *obj, char* compressed, size_t comp_size);
+int uncompress_object_stream(char *compressed, size_t comp_size, object_chunk_fn callback, void *data);
 int compress_object(struct object *obj, char* compressed, uLongf *comp_size);
+int inflate_to(z_stream *stream, Bytef **next_in, size_t *left_in, char *buffer, size_t size, size_t *inflated);
 void hash_object(object_t *obj, unsigned char *result);
 void hash_object_str(struct object *obj, char* result);
 void hash_to_hexa(unsigned char *hash, char *result);
+int hexa_to_hash(char *hexa, unsigned char *result);
 int cat_object(int fd, object_t *obj);
 void free_object(struct object *obj);
 
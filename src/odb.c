@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "includes.h"
+#include "odb.h"
+
+static struct odb odb = {.objects_fd = -1};
+static pthread_mutex_t odb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int hexa_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/// @brief Index of the fan-out directory of a hexadecimal checksum, -1 if it is not valid
+static int fanout_index(char *checksum)
+{
+    int high = hexa_value(checksum[0]);
+    if (high == -1)
+        return -1;
+    int low = hexa_value(checksum[1]);
+    if (low == -1)
+        return -1;
+    return high << 4 | low;
+}
+
+/// @brief Open OBJECTS_DIR on first use, the descriptor is kept until the process exits
+/// @return FS_OK, or REPO_NOT_INITIALIZED when there is no objects directory
+int open_odb()
+{
+    if (__atomic_load_n(&odb.objects_fd, __ATOMIC_ACQUIRE) != -1)
+        return FS_OK;
+
+    pthread_mutex_lock(&odb_lock);
+    if (odb.objects_fd == -1)
+    {
+        int fd = open(OBJECTS_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1)
+        {
+            for (int i = 0; i < FANOUT_DIRS; i++)
+                odb.fanout_fds[i] = -1;
+            __atomic_store_n(&odb.objects_fd, fd, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&odb_lock);
+
+    return odb.objects_fd == -1 ? REPO_NOT_INITIALIZED : FS_OK;
+}
+
+/// @brief Descriptor of the fan-out directory holding the loose object checksum
+/// The descriptor belongs to the object database and must not be closed
+/// @param create whether to create the directory when it does not exist
+/// @return the descriptor, or -1 with errno set
+int fanout_dir_fd(char *checksum, int create)
+{
+    int index = fanout_index(checksum);
+    if (index == -1)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    if (open_odb() != FS_OK)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    int fd = __atomic_load_n(&odb.fanout_fds[index], __ATOMIC_ACQUIRE);
+    if (fd != -1)
+        return fd;
+
+    pthread_mutex_lock(&odb_lock);
+    fd = odb.fanout_fds[index];
+    if (fd == -1)
+    {
+        char name[3] = {checksum[0], checksum[1], '\0'};
+        fd = openat(odb.objects_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1 && errno == ENOENT && create)
+        {
+            if (mkdirat(odb.objects_fd, name, DEFAULT_DIR_MODE) == 0 || errno == EEXIST)
+                fd = openat(odb.objects_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        // A missing directory is not remembered, another command may create it
+        if (fd != -1)
+            __atomic_store_n(&odb.fanout_fds[index], fd, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&odb_lock);
+
+    return fd;
+}
+
+/// @brief Open the file of a loose object for reading
+/// @return the descriptor, or -1 with errno set, ENOENT when the object is not loose
+int open_loose_object(char *checksum)
+{
+    if (strlen(checksum) != DIGEST_LENGTH * 2)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    int dir_fd = fanout_dir_fd(checksum, 0);
+    if (dir_fd == -1)
+        return -1;
+
+    return openat(dir_fd, checksum + 2, O_RDONLY | O_CLOEXEC);
+}
+
+/// @brief Move a fully written temporary object file to the place of the loose object checksum
+/// The temporary file is removed if the object already exists or cannot be stored
+/// @return FS_OK, OBJECT_ALREADY_EXIST or FS_ERROR
+int store_loose_object(char *tmp_path, char *checksum)
+{
+    int dir_fd = fanout_dir_fd(checksum, 1);
+    if (dir_fd == -1)
+    {
+        unlink(tmp_path);
+        return FS_ERROR;
+    }
+
+    struct stat buffer;
+    if (fstatat(dir_fd, checksum + 2, &buffer, 0) == 0)
+    {
+        unlink(tmp_path);
+        return OBJECT_ALREADY_EXIST;
+    }
+
+    chmod(tmp_path, DEFAULT_FILE_MODE);
+    if (renameat(AT_FDCWD, tmp_path, dir_fd, checksum + 2) != 0)
+    {
+        unlink(tmp_path);
+        return FS_ERROR;
+    }
+
+    return FS_OK;
+}
+
+/// @brief Delete a loose object, and its fan-out directory once it is empty
+int remove_loose_object(char *checksum)
+{
+    int dir_fd = fanout_dir_fd(checksum, 0);
+    if (dir_fd == -1)
+        return errno == ENOENT ? OBJECT_DOES_NOT_EXIST : FS_ERROR;
+
+    if (unlinkat(dir_fd, checksum + 2, 0) != 0)
+        return errno == ENOENT ? OBJECT_DOES_NOT_EXIST : FS_ERROR;
+
+    // Only succeeds once the fan-out directory is empty, its descriptor then
+    // refers to a deleted directory and is dropped
+    char name[3] = {checksum[0], checksum[1], '\0'};
+    pthread_mutex_lock(&odb_lock);
+    if (unlinkat(odb.objects_fd, name, AT_REMOVEDIR) == 0)
+    {
+        int index = fanout_index(checksum);
+        close(odb.fanout_fds[index]);
+        __atomic_store_n(&odb.fanout_fds[index], -1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&odb_lock);
+
+    return FS_OK;
+}
@@ -0,0 +1,29 @@
+#ifndef ODB_H
+#define ODB_H 1
+
+// The object database keeps OBJECTS_DIR open for the whole command, along with
+// each of its 256 fan-out directories once it was first needed, so that a loose
+// object is reached by a single openat relative to a cached descriptor instead
+// of resolving its whole path again.
+//
+// Descriptors are opened lazily and may be looked up from several threads.
+
+#define FANOUT_DIRS 256
+// Loose objects smaller than this are read rather than mapped, it is also
+// always enough to hold the compressed header of an object
+#define LOOSE_OBJECT_BUFFER_SIZE 4096
+
+struct odb {
+    // -1 until OBJECTS_DIR is opened
+    int objects_fd;
+    // -1 for a fan-out directory that was not opened yet
+    int fanout_fds[FANOUT_DIRS];
+};
+
+int open_odb();
+int fanout_dir_fd(char *checksum, int create);
+int open_loose_object(char *checksum);
+int store_loose_object(char *tmp_path, char *checksum);
+int remove_loose_object(char *checksum);
+
+#endif // ODB_H
@@ -0,0 +1,1196 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "arena.h"
+#include "commit.h"
+#include "delta.h"
+#include "fs.h"
+#include "includes.h"
+#include "objects.h"
+#include "odb.h"
+#include "pack.h"
+#include "refs.h"
+#include "tree.h"
+#include "utils.h"
+
+static struct packed_git *packs = NULL;
+static int packs_prepared = 0;
+static pthread_mutex_t packs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *map_file(char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return map;
+}
+
+/// @brief Whether the counts of the fanout never decrease, so that a lookup
+/// stays within the checksums of the index
+static int is_fanout_sorted(unsigned char *fanout)
+{
+    for (int i = 1; i < 256; i++)
+    {
+        if (get_be32(fanout + i * 4) < get_be32(fanout + (i - 1) * 4))
+            return 0;
+    }
+    return 1;
+}
+
+static int add_pack(char *idx_name)
+{
+    size_t name_len = strlen(idx_name);
+    char idx_path[strlen(PACK_DIR) + name_len + 2];
+    sprintf(idx_path, "%s/%s", PACK_DIR, idx_name);
+
+    struct packed_git *pack = calloc(1, sizeof(struct packed_git));
+    pack->idx_map = map_file(idx_path, &pack->idx_size);
+    if (pack->idx_map == NULL)
+        goto invalid;
+
+    if (pack->idx_size < PACK_IDX_HEADER_SIZE + PACK_FANOUT_SIZE + 2 * DIGEST_LENGTH
+        || memcmp(pack->idx_map, PACK_IDX_SIGNATURE, 4) != 0
+        || get_be32(pack->idx_map + 4) != PACK_IDX_VERSION)
+    {
+        error_print("Invalid pack index %s", idx_path);
+        goto invalid;
+    }
+    pack->objects_count = get_be32(pack->idx_map + PACK_IDX_HEADER_SIZE + PACK_FANOUT_SIZE - 4);
+
+    // Only the large offset table has a size that the header does not give
+    size_t tables_size = PACK_IDX_HEADER_SIZE + PACK_FANOUT_SIZE
+        + (size_t)pack->objects_count * (DIGEST_LENGTH + 4) + 2 * DIGEST_LENGTH;
+    if (pack->idx_size < tables_size || (pack->idx_size - tables_size) % 8 != 0
+        || !is_fanout_sorted(pack->idx_map + PACK_IDX_HEADER_SIZE))
+    {
+        error_print("Invalid pack index %s", idx_path);
+        goto invalid;
+    }
+    pack->large_offsets_count = (pack->idx_size - tables_size) / 8;
+
+    pack->pack_path = malloc(strlen(idx_path) + 2);
+    sprintf(pack->pack_path, "%.*s.pack", (int)(strlen(idx_path) - 4), idx_path);
+    pack->pack_map = map_file(pack->pack_path, &pack->pack_size);
+    if (pack->pack_map == NULL)
+        goto invalid;
+
+    if (pack->pack_size < PACK_HEADER_SIZE + DIGEST_LENGTH
+        || memcmp(pack->pack_map, PACK_SIGNATURE, 4) != 0
+        || get_be32(pack->pack_map + 4) != PACK_VERSION
+        || get_be32(pack->pack_map + 8) != pack->objects_count)
+    {
+        error_print("Invalid pack %s", pack->pack_path);
+        goto invalid;
+    }
+
+    pack->next = packs;
+    packs = pack;
+    return FS_OK;
+
+invalid:
+    if (pack->idx_map != NULL)
+        munmap(pack->idx_map, pack->idx_size);
+    if (pack->pack_map != NULL)
+        munmap(pack->pack_map, pack->pack_size);
+    free(pack->pack_path);
+    free(pack);
+    return INVALID_PACK;
+}
+
+/// @brief Load the packs on first use, objects may be looked up from several threads
+static void prepare_packs()
+{
+    pthread_mutex_lock(&packs_lock);
+    if (packs_prepared)
+    {
+        pthread_mutex_unlock(&packs_lock);
+        return;
+    }
+
+    DIR *pack_dir = opendir(PACK_DIR);
+    if (pack_dir != NULL)
+    {
+        struct dirent *ep;
+        while ((ep = readdir(pack_dir)) != NULL)
+        {
+            size_t len = strlen(ep->d_name);
+            if (len > 4 && strcmp(ep->d_name + len - 4, ".idx") == 0)
+                add_pack(ep->d_name);
+        }
+        closedir(pack_dir);
+    }
+
+    packs_prepared = 1;
+    pthread_mutex_unlock(&packs_lock);
+}
+
+static void reprepare_packs()
+{
+    while (packs != NULL)
+    {
+        struct packed_git *next = packs->next;
+        munmap(packs->idx_map, packs->idx_size);
+        munmap(packs->pack_map, packs->pack_size);
+        free(packs->pack_path);
+        free(packs);
+        packs = next;
+    }
+    packs_prepared = 0;
+    prepare_packs();
+}
+
+static size_t pack_entry_offset(struct packed_git *pack, uint32_t pos)
+{
+    unsigned char *offsets = pack->idx_map + PACK_IDX_HEADER_SIZE + PACK_FANOUT_SIZE
+        + (size_t)pack->objects_count * DIGEST_LENGTH;
+    uint32_t offset = get_be32(offsets + (size_t)pos * 4);
+    if (!(offset & 0x80000000))
+        return offset;
+
+    // Out of the pack, so that reading the entry fails
+    if ((offset & 0x7fffffff) >= pack->large_offsets_count)
+        return pack->pack_size;
+
+    unsigned char *large = offsets + (size_t)pack->objects_count * 4 + (size_t)(offset & 0x7fffffff) * 8;
+    return get_be64(large);
+}
+
+static int find_in_pack(struct packed_git *pack, unsigned char *checksum, size_t *offset)
+{
+    unsigned char *fanout = pack->idx_map + PACK_IDX_HEADER_SIZE;
+    unsigned char *checksums = fanout + PACK_FANOUT_SIZE;
+
+    uint32_t low = checksum[0] == 0 ? 0 : get_be32(fanout + (checksum[0] - 1) * 4);
+    uint32_t high = get_be32(fanout + checksum[0] * 4);
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(checksum, checksums + (size_t)mid * DIGEST_LENGTH, DIGEST_LENGTH);
+        if (cmp == 0)
+        {
+            *offset = pack_entry_offset(pack, mid);
+            return 1;
+        }
+
+        if (cmp < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return 0;
+}
+
+int find_pack_entry(unsigned char *checksum, struct pack_entry *entry)
+{
+    prepare_packs();
+
+    for (struct packed_git *pack = packs; pack != NULL; pack = pack->next)
+    {
+        if (find_in_pack(pack, checksum, &entry->offset))
+        {
+            entry->pack = pack;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int has_packed_object(unsigned char *checksum)
+{
+    struct pack_entry entry;
+    return find_pack_entry(checksum, &entry);
+}
+
+static int pack_type_to_object_type(int pack_type, enum object_type *type)
+{
+    switch (pack_type)
+    {
+    case PACK_OBJ_COMMIT:
+        *type = COMMIT;
+        return 0;
+    case PACK_OBJ_TREE:
+        *type = TREE;
+        return 0;
+    case PACK_OBJ_BLOB:
+        *type = BLOB;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static int object_type_to_pack_type(enum object_type type)
+{
+    switch (type)
+    {
+    case COMMIT:
+        return PACK_OBJ_COMMIT;
+    case TREE:
+        return PACK_OBJ_TREE;
+    default:
+        return PACK_OBJ_BLOB;
+    }
+}
+
+/// @brief Parse the header of the entry at offset
+/// @return The size of the header, 0 if the entry is truncated
+static size_t unpack_entry_header(struct packed_git *pack, size_t offset, int *pack_type, size_t *size)
+{
+    unsigned char *ptr = pack->pack_map + offset;
+    unsigned char *end = pack->pack_map + pack->pack_size - DIGEST_LENGTH;
+    if (ptr >= end)
+        return 0;
+
+    unsigned char c = *ptr++;
+    *pack_type = (c >> 4) & 7;
+    *size = c & 0x0f;
+    int shift = 4;
+    while (c & 0x80)
+    {
+        if (ptr >= end || shift > 57)
+            return 0;
+        c = *ptr++;
+        *size |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    }
+
+    return ptr - (pack->pack_map + offset);
+}
+
+static size_t encode_entry_header(unsigned char *buf, int pack_type, size_t size)
+{
+    size_t n = 0;
+    unsigned char c = (pack_type << 4) | (size & 0x0f);
+    size >>= 4;
+    while (size)
+    {
+        buf[n++] = c | 0x80;
+        c = size & 0x7f;
+        size >>= 7;
+    }
+    buf[n++] = c;
+    return n;
+}
+
+static int inflate_entry(struct packed_git *pack, size_t offset, char *buffer, size_t size)
+{
+    z_stream stream = {0};
+    if (inflateInit(&stream) != Z_OK)
+        return COMPRESSION_ERROR;
+
+    // The entry may be larger than the uInt counters of zlib
+    Bytef *next_in = pack->pack_map + offset;
+    size_t left_in = pack->pack_size - DIGEST_LENGTH - offset;
+    size_t inflated;
+    int res = inflate_to(&stream, &next_in, &left_in, buffer, size, &inflated);
+    if (res == Z_OK && inflated == size)
+    {
+        // Only the end of stream marker is left
+        char trailing;
+        size_t trailing_inflated;
+        res = inflate_to(&stream, &next_in, &left_in, &trailing, 1, &trailing_inflated);
+        if (trailing_inflated != 0)
+            res = Z_DATA_ERROR;
+    }
+    inflateEnd(&stream);
+    if (res != Z_STREAM_END || inflated != size)
+        return COMPRESSION_ERROR;
+
+    return FS_OK;
+}
+
+static int unpack_entry(struct pack_entry *entry, object_t *obj, int depth)
+{
+    int pack_type;
+    size_t size;
+    size_t header_size = unpack_entry_header(entry->pack, entry->offset, &pack_type, &size);
+    size_t data_offset = entry->offset + header_size;
+    if (header_size == 0)
+        goto corrupted;
+
+    if (pack_type != PACK_OBJ_REF_DELTA)
+    {
+        if (pack_type_to_object_type(pack_type, &obj->object_type) != 0)
+            goto corrupted;
+
+        obj->size = size;
+        obj->content = malloc(size == 0 ? 1 : size);
+        int res = inflate_entry(entry->pack, data_offset, obj->content, size);
+        if (res != FS_OK)
+        {
+            free(obj->content);
+            obj->content = NULL;
+            obj->size = 0;
+        }
+        return res;
+    }
+
+    if (depth >= PACK_MAX_DELTA_DEPTH || data_offset + DIGEST_LENGTH > entry->pack->pack_size - DIGEST_LENGTH)
+        goto corrupted;
+
+    struct pack_entry base_entry;
+    if (!find_pack_entry(entry->pack->pack_map + data_offset, &base_entry))
+        goto corrupted;
+
+    object_t base = {0};
+    int res = unpack_entry(&base_entry, &base, depth + 1);
+    if (res != FS_OK)
+        return res;
+
+    unsigned char *delta = malloc(size == 0 ? 1 : size);
+    res = inflate_entry(entry->pack, data_offset + DIGEST_LENGTH, (char *)delta, size);
+    if (res == FS_OK)
+    {
+        unsigned char *result;
+        size_t result_size;
+        if (apply_delta((unsigned char *)base.content, base.size, delta, size, &result, &result_size) == 0)
+        {
+            obj->object_type = base.object_type;
+            obj->content = (char *)result;
+            obj->size = result_size;
+        } else
+        {
+            res = INVALID_PACK;
+        }
+    }
+    free(delta);
+    free_object(&base);
+    if (res != FS_OK)
+        goto corrupted;
+
+    return FS_OK;
+
+corrupted:
+    error_print("Corrupted entry at offset %zu in %s", entry->offset, entry->pack->pack_path);
+    return INVALID_PACK;
+}
+
+int read_packed_object(unsigned char *checksum, object_t *obj)
+{
+    struct pack_entry entry;
+    if (!find_pack_entry(checksum, &entry))
+        return OBJECT_DOES_NOT_EXIST;
+
+    return unpack_entry(&entry, obj, 0);
+}
+
+/// @brief Inflate at most size bytes from the start of an entry
+/// @return the number of bytes inflated, 0 on error
+static size_t inflate_entry_prefix(struct packed_git *pack, size_t offset, unsigned char *buffer, size_t size)
+{
+    z_stream stream = {0};
+    if (inflateInit(&stream) != Z_OK)
+        return 0;
+
+    Bytef *next_in = pack->pack_map + offset;
+    size_t left_in = pack->pack_size - DIGEST_LENGTH - offset;
+    size_t inflated;
+    int res = inflate_to(&stream, &next_in, &left_in, (char *)buffer, size, &inflated);
+    inflateEnd(&stream);
+    if (res != Z_OK && res != Z_STREAM_END)
+        return 0;
+
+    return inflated;
+}
+
+/// @brief Type and size of a packed object, without inflating its content
+/// The size of a deltified object is read from the first bytes of its delta,
+/// its type is the one of the base at the end of the chain
+int packed_object_info(unsigned char *checksum, object_t *header)
+{
+    struct pack_entry entry;
+    if (!find_pack_entry(checksum, &entry))
+        return OBJECT_DOES_NOT_EXIST;
+
+    header->content = NULL;
+    int size_known = 0;
+    for (int depth = 0; depth <= PACK_MAX_DELTA_DEPTH; depth++)
+    {
+        int pack_type;
+        size_t size;
+        size_t header_size = unpack_entry_header(entry.pack, entry.offset, &pack_type, &size);
+        size_t data_offset = entry.offset + header_size;
+        if (header_size == 0)
+            break;
+
+        if (pack_type != PACK_OBJ_REF_DELTA)
+        {
+            if (pack_type_to_object_type(pack_type, &header->object_type) != 0)
+                break;
+            if (!size_known)
+                header->size = size;
+            return FS_OK;
+        }
+
+        if (data_offset + DIGEST_LENGTH > entry.pack->pack_size - DIGEST_LENGTH)
+            break;
+
+        if (!size_known)
+        {
+            // Two varints of at most 10 bytes each
+            unsigned char delta[20];
+            size_t inflated = inflate_entry_prefix(entry.pack, data_offset + DIGEST_LENGTH, delta, sizeof(delta));
+            if (delta_result_size(delta, inflated, &header->size) != 0)
+                break;
+            size_known = 1;
+        }
+
+        if (!find_pack_entry(entry.pack->pack_map + data_offset, &entry))
+            break;
+    }
+
+    error_print("Corrupted entry at offset %zu in %s", entry.offset, entry.pack->pack_path);
+    return INVALID_PACK;
+}
+
+/// @brief Read a packed object by chunks, see uncompress_object_stream
+/// Deltified objects have to be rebuilt in memory and are given in one chunk
+int stream_packed_object(unsigned char *checksum, object_chunk_fn callback, void *data)
+{
+    struct pack_entry entry;
+    if (!find_pack_entry(checksum, &entry))
+        return OBJECT_DOES_NOT_EXIST;
+
+    int pack_type;
+    object_t header = {0};
+    size_t header_size = unpack_entry_header(entry.pack, entry.offset, &pack_type, &header.size);
+    if (header_size == 0)
+    {
+        error_print("Corrupted entry at offset %zu in %s", entry.offset, entry.pack->pack_path);
+        return INVALID_PACK;
+    }
+
+    if (pack_type_to_object_type(pack_type, &header.object_type) != 0)
+    {
+        object_t obj = {0};
+        int res = unpack_entry(&entry, &obj, 0);
+        if (res != FS_OK)
+            return res;
+        if (obj.size > 0)
+            callback(&obj, obj.content, obj.size, data);
+        free_object(&obj);
+        return FS_OK;
+    }
+
+    z_stream stream = {0};
+    if (inflateInit(&stream) != Z_OK)
+        return COMPRESSION_ERROR;
+
+    Bytef *next_in = entry.pack->pack_map + entry.offset + header_size;
+    size_t left_in = entry.pack->pack_size - DIGEST_LENGTH - entry.offset - header_size;
+    char *chunk = malloc(OBJECT_CHUNK_SIZE);
+    int res = Z_OK;
+    while (res == Z_OK)
+    {
+        size_t inflated;
+        res = inflate_to(&stream, &next_in, &left_in, chunk, OBJECT_CHUNK_SIZE, &inflated);
+        if (res != Z_OK && res != Z_STREAM_END)
+            break;
+
+        if (stream.total_out > header.size)
+        {
+            res = Z_DATA_ERROR;
+            break;
+        }
+        if (inflated > 0 && callback(&header, chunk, inflated, data) != 0)
+        {
+            free(chunk);
+            inflateEnd(&stream);
+            return FS_OK;
+        }
+    }
+    free(chunk);
+    inflateEnd(&stream);
+
+    if (res != Z_STREAM_END || stream.total_out != header.size)
+    {
+        error_print("Corrupted entry at offset %zu in %s", entry.offset, entry.pack->pack_path);
+        return COMPRESSION_ERROR;
+    }
+
+    return FS_OK;
+}
+
+struct pack_object {
+    unsigned char checksum[DIGEST_LENGTH];
+    enum object_type type;
+    size_t size;
+    uint32_t name_hash;
+    int visited;
+    size_t offset;
+
+    unsigned char *delta;
+    size_t delta_size;
+    unsigned char base[DIGEST_LENGTH];
+    int depth;
+};
+
+static int compare_pack_objects(const void *a, const void *b)
+{
+    return memcmp(((struct pack_object *)a)->checksum, ((struct pack_object *)b)->checksum, DIGEST_LENGTH);
+}
+
+/// @brief Order objects so that good delta candidates end up next to each other:
+/// same type, then same name, then biggest first
+static int compare_delta_order(const void *a, const void *b)
+{
+    struct pack_object *obj_a = *(struct pack_object **)a;
+    struct pack_object *obj_b = *(struct pack_object **)b;
+
+    if (obj_a->type != obj_b->type)
+        return obj_a->type < obj_b->type ? -1 : 1;
+    if (obj_a->name_hash != obj_b->name_hash)
+        return obj_a->name_hash < obj_b->name_hash ? -1 : 1;
+    if (obj_a->size != obj_b->size)
+        return obj_a->size > obj_b->size ? -1 : 1;
+    return compare_pack_objects(obj_a, obj_b);
+}
+
+static int is_hexa(char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!((str[i] >= '0' && str[i] <= '9') || (str[i] >= 'a' && str[i] <= 'f')))
+            return 0;
+    }
+
+    return str[len] == '\0';
+}
+
+static struct pack_object *push_pack_object(struct pack_object **objects, size_t *count, size_t *capacity)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity == 0 ? 256 : *capacity * 2;
+        *objects = realloc(*objects, *capacity * sizeof(struct pack_object));
+    }
+
+    struct pack_object *obj = &(*objects)[*count];
+    memset(obj, 0, sizeof(struct pack_object));
+    return obj;
+}
+
+/// @brief List every loose object that is not already in a pack
+static int list_loose_objects(struct pack_object **objects, size_t *count, size_t *capacity)
+{
+    DIR *objects_dir = opendir(OBJECTS_DIR);
+    if (objects_dir == NULL)
+        return FS_ERROR;
+
+    struct dirent *ep;
+    while ((ep = readdir(objects_dir)) != NULL)
+    {
+        if (!is_hexa(ep->d_name, 2))
+            continue;
+
+        char subdir_path[strlen(OBJECTS_DIR) + 4];
+        sprintf(subdir_path, "%s/%s", OBJECTS_DIR, ep->d_name);
+        DIR *subdir = opendir(subdir_path);
+        if (subdir == NULL)
+            continue;
+
+        struct dirent *sub_ep;
+        while ((sub_ep = readdir(subdir)) != NULL)
+        {
+            if (!is_hexa(sub_ep->d_name, DIGEST_LENGTH * 2 - 2))
+                continue;
+
+            char checksum[DIGEST_LENGTH * 2 + 1];
+            sprintf(checksum, "%s%s", ep->d_name, sub_ep->d_name);
+
+            struct pack_object *obj = push_pack_object(objects, count, capacity);
+            hexa_to_hash(checksum, obj->checksum);
+            if (has_packed_object(obj->checksum))
+                continue;
+            (*count)++;
+        }
+        closedir(subdir);
+    }
+    closedir(objects_dir);
+
+    return FS_OK;
+}
+
+static void list_packed_objects(struct pack_object **objects, size_t *count, size_t *capacity)
+{
+    prepare_packs();
+
+    for (struct packed_git *pack = packs; pack != NULL; pack = pack->next)
+    {
+        unsigned char *checksums = pack->idx_map + PACK_IDX_HEADER_SIZE + PACK_FANOUT_SIZE;
+        for (uint32_t i = 0; i < pack->objects_count; i++)
+        {
+            struct pack_object *obj = push_pack_object(objects, count, capacity);
+            memcpy(obj->checksum, checksums + (size_t)i * DIGEST_LENGTH, DIGEST_LENGTH);
+            (*count)++;
+        }
+    }
+}
+
+static uint32_t name_hash(char *name)
+{
+    uint32_t hash = 0;
+    unsigned char c;
+    while ((c = *name++) != '\0')
+    {
+        if (isspace(c))
+            continue;
+        hash = (hash >> 2) + ((uint32_t)c << 24);
+    }
+
+    return hash;
+}
+
+static struct pack_object *lookup_pack_object(struct pack_object *objects, size_t count, unsigned char *checksum)
+{
+    struct pack_object key;
+    memcpy(key.checksum, checksum, DIGEST_LENGTH);
+    return bsearch(&key, objects, count, sizeof(struct pack_object), compare_pack_objects);
+}
+
+static void name_tree_objects(struct pack_object *objects, size_t count, struct pack_object *tree_obj)
+{
+    char checksum[DIGEST_LENGTH * 2 + 1];
+    hash_to_hexa(tree_obj->checksum, checksum);
+
+    tree_t tree = {0};
+    if (load_tree(checksum, &tree) != FS_OK)
+        return;
+
+    for (size_t i = 0; i < tree.entries_size; i++)
+    {
+        entry_t *current = &tree.entries[i];
+        struct pack_object *obj = lookup_pack_object(objects, count, current->checksum);
+        if (obj == NULL || obj->visited)
+            continue;
+
+        obj->visited = 1;
+        obj->name_hash = name_hash(current->filename);
+        if (current->type == TREE)
+            name_tree_objects(objects, count, obj);
+    }
+
+    free_tree(&tree);
+}
+
+/// @brief Give a name to the objects reachable from the branches so that
+/// successive versions of a file are considered as delta bases for each other
+static void name_pack_objects(struct pack_object *objects, size_t count)
+{
+    struct ref_table refs;
+    if (load_refs(&refs) != FS_OK)
+        return;
+
+    struct arena arena = {0};
+    for (size_t i = 0; i < refs.capacity; i++)
+    {
+        if (refs.refs[i].name == NULL)
+            continue;
+
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        strcpy(checksum, refs.refs[i].checksum);
+
+        unsigned char raw_checksum[DIGEST_LENGTH];
+        while (hexa_to_hash(checksum, raw_checksum) == 0)
+        {
+            struct pack_object *commit_obj = lookup_pack_object(objects, count, raw_checksum);
+            if (commit_obj == NULL || commit_obj->visited)
+                break;
+            commit_obj->visited = 1;
+
+            object_t obj = {0};
+            commit_t commit = {0};
+            if (read_object(checksum, &obj) != FS_OK || obj.object_type != COMMIT)
+                break;
+            commit_from_object(&commit, &obj, &arena);
+            free_object(&obj);
+
+            struct pack_object *tree_obj = NULL;
+            if (commit.tree != NULL && hexa_to_hash(commit.tree, raw_checksum) == 0)
+                tree_obj = lookup_pack_object(objects, count, raw_checksum);
+            if (tree_obj != NULL && !tree_obj->visited)
+            {
+                tree_obj->visited = 1;
+                name_tree_objects(objects, count, tree_obj);
+            }
+
+            checksum[0] = '\0';
+            if (commit.parent != NULL)
+                snprintf(checksum, sizeof(checksum), "%s", commit.parent);
+            clear_arena(&arena);
+        }
+    }
+    free_arena(&arena);
+    free_refs(&refs);
+}
+
+struct delta_window_slot {
+    struct pack_object *obj;
+    object_t content;
+};
+
+/// @brief Try every object of the window as a base for obj and keep the smallest delta
+static void find_delta(struct pack_object *obj, object_t *content,
+                       struct delta_window_slot *window, int window_size, int max_depth)
+{
+    if (content->size <= DELTA_MIN_MATCH)
+        return;
+
+    for (int i = 0; i < window_size; i++)
+    {
+        struct pack_object *base = window[i].obj;
+        if (base == NULL || base->type != obj->type || base->depth >= max_depth)
+            continue;
+
+        // A delta against a much smaller base cannot be worth it
+        if (base->size < obj->size / 32)
+            continue;
+
+        size_t max_size = obj->delta != NULL ? obj->delta_size - 1 : obj->size / 2;
+        if (max_size <= DIGEST_LENGTH)
+            continue;
+        max_size -= DIGEST_LENGTH;
+
+        unsigned char *delta;
+        size_t delta_size;
+        if (create_delta((unsigned char *)window[i].content.content, window[i].content.size,
+                         (unsigned char *)content->content, content->size,
+                         max_size, &delta, &delta_size) != 0)
+            continue;
+
+        free(obj->delta);
+        obj->delta = delta;
+        obj->delta_size = delta_size;
+        obj->depth = base->depth + 1;
+        memcpy(obj->base, base->checksum, DIGEST_LENGTH);
+    }
+}
+
+static int compute_deltas(struct pack_object **order, size_t count, struct repack_options *options)
+{
+    if (options->window <= 0)
+        return FS_OK;
+
+    struct delta_window_slot *window = calloc(options->window, sizeof(struct delta_window_slot));
+    int next_slot = 0;
+    int result = FS_OK;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct pack_object *obj = order[i];
+        if (obj->type == COMMIT)
+            continue;
+
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(obj->checksum, checksum);
+        object_t content = {0};
+        if (read_object(checksum, &content) != FS_OK)
+        {
+            error_print("Cannot read object %s", checksum);
+            defer(FS_ERROR);
+        }
+
+        find_delta(obj, &content, window, options->window, options->depth);
+
+        struct delta_window_slot *slot = &window[next_slot];
+        if (slot->obj != NULL)
+            free_object(&slot->content);
+        slot->obj = obj;
+        slot->content = content;
+        next_slot = (next_slot + 1) % options->window;
+    }
+
+defer:
+    for (int i = 0; i < options->window; i++)
+    {
+        if (window[i].obj != NULL)
+            free_object(&window[i].content);
+    }
+    free(window);
+    return result;
+}
+
+static int write_hashed(FILE *file, EVP_MD_CTX *ctx, void *data, size_t size)
+{
+    sha1_update(ctx, data, size);
+    return fwrite(data, 1, size, file) == size ? FS_OK : FS_ERROR;
+}
+
+static int write_pack_entry(FILE *pack_file, EVP_MD_CTX *ctx, struct pack_object *pack_obj, size_t *entry_size)
+{
+    object_t obj = {0};
+    unsigned char *data;
+    size_t data_size;
+    int pack_type;
+
+    if (pack_obj->delta != NULL)
+    {
+        pack_type = PACK_OBJ_REF_DELTA;
+        data = pack_obj->delta;
+        data_size = pack_obj->delta_size;
+    } else
+    {
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(pack_obj->checksum, checksum);
+        if (read_object(checksum, &obj) != FS_OK)
+        {
+            error_print("Cannot read object %s", checksum);
+            return FS_ERROR;
+        }
+        pack_type = object_type_to_pack_type(obj.object_type);
+        data = (unsigned char *)obj.content;
+        data_size = obj.size;
+    }
+
+    unsigned char entry_header[16];
+    size_t entry_header_size = encode_entry_header(entry_header, pack_type, data_size);
+
+    uLongf comp_size = compressBound(data_size);
+    unsigned char *compressed = malloc(comp_size);
+    int res = compress(compressed, &comp_size, data, data_size);
+    free_object(&obj);
+    if (res != Z_OK)
+    {
+        free(compressed);
+        return COMPRESSION_ERROR;
+    }
+
+    int result = write_hashed(pack_file, ctx, entry_header, entry_header_size);
+    *entry_size = entry_header_size + comp_size;
+    if (pack_type == PACK_OBJ_REF_DELTA)
+    {
+        result |= write_hashed(pack_file, ctx, pack_obj->base, DIGEST_LENGTH);
+        *entry_size += DIGEST_LENGTH;
+    }
+    result |= write_hashed(pack_file, ctx, compressed, comp_size);
+    free(compressed);
+
+    return result == FS_OK ? FS_OK : FS_ERROR;
+}
+
+static int write_pack(int fd, struct pack_object **order, size_t count, unsigned char *pack_checksum)
+{
+    FILE *pack_file = fdopen(fd, "w");
+    if (pack_file == NULL)
+    {
+        close(fd);
+        return FS_ERROR;
+    }
+
+    int result = FS_OK;
+    EVP_MD_CTX *ctx = sha1_init();
+
+    unsigned char header[PACK_HEADER_SIZE];
+    memcpy(header, PACK_SIGNATURE, 4);
+    put_be32(header + 4, PACK_VERSION);
+    put_be32(header + 8, count);
+    write_hashed(pack_file, ctx, header, PACK_HEADER_SIZE);
+
+    size_t offset = PACK_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t entry_size;
+        result = write_pack_entry(pack_file, ctx, order[i], &entry_size);
+        if (result != FS_OK)
+        {
+            defer(result);
+        }
+
+        order[i]->offset = offset;
+        offset += entry_size;
+    }
+
+    sha1_final(ctx, pack_checksum);
+    ctx = NULL;
+    if (fwrite(pack_checksum, 1, DIGEST_LENGTH, pack_file) != DIGEST_LENGTH)
+        result = FS_ERROR;
+
+defer:
+    if (ctx != NULL)
+        EVP_MD_CTX_free(ctx);
+    if (fclose(pack_file) != 0)
+        result = FS_ERROR;
+    return result;
+}
+
+static int write_pack_index(int fd, struct pack_object *objects, size_t count, unsigned char *pack_checksum)
+{
+    FILE *idx_file = fdopen(fd, "w");
+    if (idx_file == NULL)
+    {
+        close(fd);
+        return FS_ERROR;
+    }
+
+    EVP_MD_CTX *ctx = sha1_init();
+
+    unsigned char header[PACK_IDX_HEADER_SIZE];
+    memcpy(header, PACK_IDX_SIGNATURE, 4);
+    put_be32(header + 4, PACK_IDX_VERSION);
+    write_hashed(idx_file, ctx, header, PACK_IDX_HEADER_SIZE);
+
+    unsigned char fanout[PACK_FANOUT_SIZE];
+    size_t j = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        while (j < count && objects[j].checksum[0] == i)
+            j++;
+        put_be32(fanout + i * 4, j);
+    }
+    write_hashed(idx_file, ctx, fanout, PACK_FANOUT_SIZE);
+
+    for (size_t i = 0; i < count; i++)
+        write_hashed(idx_file, ctx, objects[i].checksum, DIGEST_LENGTH);
+
+    uint32_t large_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned char offset[4];
+        if (objects[i].offset >= 0x80000000)
+            put_be32(offset, 0x80000000 | large_count++);
+        else
+            put_be32(offset, objects[i].offset);
+        write_hashed(idx_file, ctx, offset, 4);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (objects[i].offset < 0x80000000)
+            continue;
+        unsigned char offset[8];
+        put_be64(offset, objects[i].offset);
+        write_hashed(idx_file, ctx, offset, 8);
+    }
+
+    write_hashed(idx_file, ctx, pack_checksum, DIGEST_LENGTH);
+    unsigned char idx_checksum[DIGEST_LENGTH];
+    sha1_final(ctx, idx_checksum);
+    fwrite(idx_checksum, 1, DIGEST_LENGTH, idx_file);
+
+    return fclose(idx_file) == 0 ? FS_OK : FS_ERROR;
+}
+
+static void remove_loose_objects(struct pack_object *objects, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(objects[i].checksum, checksum);
+        remove_loose_object(checksum);
+    }
+}
+
+static void remove_packs(char **pack_paths, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t len = strlen(pack_paths[i]);
+        // Remove the index first so a reader never sees an index without its pack
+        sprintf(pack_paths[i] + len - 5, ".idx");
+        unlink(pack_paths[i]);
+        sprintf(pack_paths[i] + len - 5, ".pack");
+        unlink(pack_paths[i]);
+    }
+}
+
+static size_t remove_duplicates(struct pack_object *objects, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    size_t j = 0;
+    for (size_t i = 1; i < count; i++)
+    {
+        if (memcmp(objects[i].checksum, objects[j].checksum, DIGEST_LENGTH) != 0)
+            objects[++j] = objects[i];
+    }
+    return j + 1;
+}
+
+/// @brief Move every loose object in a new pack, storing blobs and trees as
+/// deltas against similar objects when it saves space
+/// @param packed_count set to the number of objects packed
+int repack_objects(struct repack_options *options, size_t *packed_count)
+{
+    if (!local_repo_exist())
+    {
+        return REPO_NOT_INITIALIZED;
+    }
+    int result = FS_OK;
+
+    struct pack_object *objects = NULL;
+    struct pack_object **order = NULL;
+    size_t count = 0, capacity = 0;
+    char **old_packs = NULL;
+    size_t old_packs_count = 0;
+    *packed_count = 0;
+
+    result = list_loose_objects(&objects, &count, &capacity);
+    if (result != FS_OK)
+    {
+        defer(result);
+    }
+
+    if (options->all)
+    {
+        list_packed_objects(&objects, &count, &capacity);
+        for (struct packed_git *pack = packs; pack != NULL; pack = pack->next)
+        {
+            old_packs = realloc(old_packs, (old_packs_count + 1) * sizeof(char *));
+            old_packs[old_packs_count] = malloc(strlen(pack->pack_path) + 1);
+            strcpy(old_packs[old_packs_count++], pack->pack_path);
+        }
+    }
+
+    if (count == 0)
+    {
+        defer(FS_OK);
+    }
+
+    qsort(objects, count, sizeof(struct pack_object), compare_pack_objects);
+    count = remove_duplicates(objects, count);
+
+    order = malloc(count * sizeof(struct pack_object *));
+    for (size_t i = 0; i < count; i++)
+    {
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(objects[i].checksum, checksum);
+        object_t obj = {0};
+        if (read_object(checksum, &obj) != FS_OK)
+        {
+            error_print("Cannot read object %s", checksum);
+            defer(FS_ERROR);
+        }
+        objects[i].type = obj.object_type;
+        objects[i].size = obj.size;
+        free_object(&obj);
+        order[i] = &objects[i];
+    }
+
+    name_pack_objects(objects, count);
+    qsort(order, count, sizeof(struct pack_object *), compare_delta_order);
+    result = compute_deltas(order, count, options);
+    if (result != FS_OK)
+    {
+        defer(result);
+    }
+
+    // Unique temporary names, so that concurrent repacks do not write the same files
+    mkdir(PACK_DIR, DEFAULT_DIR_MODE);
+    char tmp_pack[] = TMP_PACK_TEMPLATE;
+    char tmp_idx[] = TMP_IDX_TEMPLATE;
+    unsigned char pack_checksum[DIGEST_LENGTH];
+
+    int fd = mkstemp(tmp_pack);
+    if (fd == -1)
+    {
+        error_print("Cannot create %s", tmp_pack);
+        defer(FS_ERROR);
+    }
+    result = write_pack(fd, order, count, pack_checksum);
+    if (result != FS_OK)
+    {
+        unlink(tmp_pack);
+        defer(result);
+    }
+    fd = mkstemp(tmp_idx);
+    if (fd == -1)
+    {
+        error_print("Cannot create %s", tmp_idx);
+        unlink(tmp_pack);
+        defer(FS_ERROR);
+    }
+    result = write_pack_index(fd, objects, count, pack_checksum);
+    if (result != FS_OK)
+    {
+        unlink(tmp_pack);
+        unlink(tmp_idx);
+        defer(result);
+    }
+    chmod(tmp_pack, DEFAULT_FILE_MODE);
+    chmod(tmp_idx, DEFAULT_FILE_MODE);
+
+    char pack_name[DIGEST_LENGTH * 2 + 1];
+    hash_to_hexa(pack_checksum, pack_name);
+    char path[sizeof(PACK_DIR) + DIGEST_LENGTH * 2 + 12];
+
+    // The index is renamed last so a reader never sees an index without its pack
+    // Old packs and loose objects are only removed once both files are in place
+    sprintf(path, "%s/pack-%s.pack", PACK_DIR, pack_name);
+    if (rename(tmp_pack, path) != 0)
+    {
+        error_print("Cannot rename %s to %s", tmp_pack, path);
+        unlink(tmp_pack);
+        unlink(tmp_idx);
+        defer(FS_ERROR);
+    }
+    int same_pack = 0;
+    for (size_t i = 0; i < old_packs_count; i++)
+    {
+        // Repacking identical content gives back the same pack
+        if (strcmp(old_packs[i], path) == 0)
+        {
+            old_packs[i][0] = '\0';
+            same_pack = 1;
+        }
+    }
+    char pack_path[sizeof(path)];
+    strcpy(pack_path, path);
+    sprintf(path, "%s/pack-%s.idx", PACK_DIR, pack_name);
+    if (rename(tmp_idx, path) != 0)
+    {
+        error_print("Cannot rename %s to %s", tmp_idx, path);
+        unlink(tmp_idx);
+        // An old pack with the same name still has its index
+        if (!same_pack)
+            unlink(pack_path);
+        defer(FS_ERROR);
+    }
+
+    for (size_t i = 0; i < old_packs_count; i++)
+    {
+        if (old_packs[i][0] != '\0')
+            remove_packs(&old_packs[i], 1);
+    }
+    reprepare_packs();
+    remove_loose_objects(objects, count);
+    *packed_count = count;
+
+defer:
+    for (size_t i = 0; i < count && objects != NULL; i++)
+        free(objects[i].delta);
+    for (size_t i = 0; i < old_packs_count; i++)
+        free(old_packs[i]);
+    free(old_packs);
+    free(order);
+    free(objects);
+    return result;
+}
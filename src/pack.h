@@ -0,0 +1,85 @@
+#ifndef PACK_H
+#define PACK_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "objects.h"
+#include "types.h"
+
+// Pack file should follow the format
+// "PACK" + version (4 bytes) + number of objects (4 bytes)
+// entry1
+// entry2
+// ...
+// SHA-1 of everything above
+//
+// Each entry is a variable length header holding the object type and the
+// size of its content, followed by the zlib compressed content.
+// A delta entry has the size of the delta in its header, then the checksum of
+// its base and the zlib compressed delta (see delta.h).
+//
+// Index file should follow the format
+// "\377tOc" + version (4 bytes)
+// fanout table: 256 * 4 bytes, entry i is the number of objects whose
+// first checksum byte is <= i
+// sorted checksums: n * DIGEST_LENGTH
+// offsets in the pack: n * 4 bytes, MSB set means index in the large offset table
+// large offsets: m * 8 bytes
+// SHA-1 of the pack + SHA-1 of everything above
+//
+// All integers are stored in network byte order.
+
+#define PACK_SIGNATURE "PACK"
+#define PACK_VERSION 2
+#define PACK_HEADER_SIZE 12
+
+#define PACK_IDX_SIGNATURE "\377tOc"
+#define PACK_IDX_VERSION 2
+#define PACK_IDX_HEADER_SIZE 8
+#define PACK_FANOUT_SIZE (256 * 4)
+
+#define PACK_OBJ_COMMIT 1
+#define PACK_OBJ_TREE 2
+#define PACK_OBJ_BLOB 3
+#define PACK_OBJ_REF_DELTA 7
+
+#define DEFAULT_PACK_WINDOW 10
+#define DEFAULT_PACK_DEPTH 50
+// Bound on the chains we accept to follow when reading, whatever the depth
+// the pack was written with
+#define PACK_MAX_DELTA_DEPTH 4095
+
+#define INVALID_PACK (-50)
+
+struct packed_git {
+    char *pack_path;
+    unsigned char *idx_map;
+    size_t idx_size;
+    unsigned char *pack_map;
+    size_t pack_size;
+    uint32_t objects_count;
+    // Entries of the large offset table, given by the size of the index
+    size_t large_offsets_count;
+    struct packed_git *next;
+};
+
+struct repack_options {
+    int all;
+    int window;
+    int depth;
+};
+
+struct pack_entry {
+    struct packed_git *pack;
+    size_t offset;
+};
+
+int find_pack_entry(unsigned char *checksum, struct pack_entry *entry);
+int has_packed_object(unsigned char *checksum);
+int read_packed_object(unsigned char *checksum, object_t *obj);
+int packed_object_info(unsigned char *checksum, object_t *header);
+int stream_packed_object(unsigned char *checksum, object_chunk_fn callback, void *data);
+int repack_objects(struct repack_options *options, size_t *packed_count);
+
+#endif // PACK_H
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pager.h"
+
+/// @brief Open the pager when stdout is a terminal, the output is written
+/// straight to stdout otherwise or when CGIT_PAGER is empty
+/// @return where to write the output, to be closed with stop_pager
+FILE *start_pager()
+{
+    if (!isatty(STDOUT_FILENO))
+        return stdout;
+
+    char *pager = getenv(PAGER_ENV);
+    if (pager == NULL)
+        pager = getenv("PAGER");
+    if (pager == NULL)
+        pager = DEFAULT_PAGER;
+    if (*pager == '\0')
+        return stdout;
+
+    fflush(stdout);
+    FILE *out = popen(pager, "w");
+    return out == NULL ? stdout : out;
+}
+
+void stop_pager(FILE *out)
+{
+    if (out == stdout)
+        fflush(stdout);
+    else
+        pclose(out);
+}
@@ -0,0 +1,12 @@
+#ifndef PAGER_H
+#define PAGER_H 1
+
+#include <stdio.h>
+
+#define PAGER_ENV "CGIT_PAGER"
+#define DEFAULT_PAGER "less -FRX"
+
+FILE *start_pager();
+void stop_pager(FILE *out);
+
+#endif // PAGER_H
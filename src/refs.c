@@ -0,0 +1,522 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "includes.h"
+#include "refs.h"
+
+static int is_hexa(char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = str[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return 0;
+    }
+    return 1;
+}
+
+/// @brief Map PACKED_REFS_FILE in memory
+/// @return FS_OK, or FILE_NOT_FOUND when there is no packed ref
+static int map_packed_refs(char **map, size_t *size)
+{
+    int fd = open(PACKED_REFS_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno == ENOENT ? FILE_NOT_FOUND : FS_ERROR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return FS_ERROR;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return FILE_NOT_FOUND;
+    }
+
+    *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (*map == MAP_FAILED)
+        return FS_ERROR;
+
+    *size = st.st_size;
+    return FS_OK;
+}
+
+/// @brief Parse the line of map starting at line
+/// @param name set to the name of the ref, not terminated
+/// @return the start of the next line, NULL if the line is not a ref
+static char *parse_packed_line(char *line, char *end, char **name, size_t *name_len)
+{
+    char *line_end = memchr(line, '\n', end - line);
+    if (line_end == NULL)
+        line_end = end;
+
+    if (line_end - line < HEX_LENGTH + 2 || line[HEX_LENGTH] != ' ' || !is_hexa(line, HEX_LENGTH))
+        return NULL;
+
+    *name = line + HEX_LENGTH + 1;
+    *name_len = line_end - *name;
+    return line_end == end ? end : line_end + 1;
+}
+
+/// @brief Binary search of name in the packed refs
+static int find_packed_ref(char *map, size_t size, char *name, char *checksum)
+{
+    char *start = map, *end = map + size;
+    if (size >= strlen(PACKED_REFS_HEADER) && memcmp(map, "#", 1) == 0)
+    {
+        start = memchr(map, '\n', size);
+        start = start == NULL ? end : start + 1;
+    }
+
+    size_t name_len = strlen(name);
+    char *low = start, *high = end;
+    while (low < high)
+    {
+        // Start of the line holding the middle byte
+        char *mid = low + (high - low) / 2;
+        while (mid > low && mid[-1] != '\n')
+            mid--;
+
+        char *ref_name;
+        size_t ref_len;
+        char *next = parse_packed_line(mid, end, &ref_name, &ref_len);
+        if (next == NULL)
+            return INVALID_REF_NAME;
+
+        size_t min_len = ref_len < name_len ? ref_len : name_len;
+        int cmp = memcmp(ref_name, name, min_len);
+        if (cmp == 0)
+            cmp = ref_len < name_len ? -1 : ref_len > name_len;
+
+        if (cmp == 0)
+        {
+            memcpy(checksum, mid, HEX_LENGTH);
+            checksum[HEX_LENGTH] = '\0';
+            return FS_OK;
+        }
+        if (cmp < 0)
+            low = next;
+        else
+            high = mid;
+    }
+
+    return ENTRY_NOT_FOUND;
+}
+
+/// @brief Read the checksum of a loose ref
+static int read_loose_ref(char *path, char *checksum)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return ENTRY_NOT_FOUND;
+
+    char buffer[HEX_LENGTH + 1];
+    ssize_t n = read(fd, buffer, HEX_LENGTH);
+    close(fd);
+    if (n != HEX_LENGTH || !is_hexa(buffer, HEX_LENGTH))
+        return ENTRY_NOT_FOUND;
+
+    memcpy(checksum, buffer, HEX_LENGTH);
+    checksum[HEX_LENGTH] = '\0';
+    return FS_OK;
+}
+
+/// @brief Tell whether name can be used for a ref, it must not escape the
+/// refs directory nor clash with a lock file
+int check_ref_name(char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || name[0] == '/' || name[len - 1] == '/' || name[len - 1] == '.' || strstr(name, "..") != NULL
+        || strstr(name, "//") != NULL || strstr(name, "/.") != NULL || name[0] == '.'
+        || (len >= strlen(REF_LOCK_SUFFIX) && strcmp(name + len - strlen(REF_LOCK_SUFFIX), REF_LOCK_SUFFIX) == 0))
+        return INVALID_REF_NAME;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = name[i];
+        if (c <= ' ' || c == 0x7f || c == '~' || c == '^' || c == ':' || c == '?' || c == '*' || c == '['
+            || c == '\\')
+            return INVALID_REF_NAME;
+    }
+
+    return FS_OK;
+}
+
+/// @brief Read the checksum a ref points to, without loading the other refs
+/// @param name full name of the ref, such as "refs/heads/master"
+/// @param checksum array of size HEX_LENGTH + 1
+/// @return FS_OK, or ENTRY_NOT_FOUND when the ref does not exist
+int read_ref(char *name, char *checksum)
+{
+    char path[strlen(LOCAL_REPO) + strlen(name) + 2];
+    sprintf(path, "%s/%s", LOCAL_REPO, name);
+    if (read_loose_ref(path, checksum) == FS_OK)
+        return FS_OK;
+
+    char *map;
+    size_t size;
+    int res = map_packed_refs(&map, &size);
+    if (res == FILE_NOT_FOUND)
+        return ENTRY_NOT_FOUND;
+    if (res != FS_OK)
+        return res;
+
+    res = find_packed_ref(map, size, name, checksum);
+    munmap(map, size);
+    return res;
+}
+
+/// @brief Create the directories leading to path
+static void create_parent_dirs(char *path)
+{
+    char dir[strlen(path) + 1];
+    strcpy(dir, path);
+    for (char *slash = strchr(dir + strlen(LOCAL_REPO) + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        mkdir(dir, DEFAULT_DIR_MODE);
+        *slash = '/';
+    }
+}
+
+/// @brief Write content to path through its lock file
+static int write_locked_file(char *path, char *content)
+{
+    char lock_path[strlen(path) + strlen(REF_LOCK_SUFFIX) + 1];
+    sprintf(lock_path, "%s%s", path, REF_LOCK_SUFFIX);
+
+    int fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return errno == EEXIST ? REF_LOCKED : FS_ERROR;
+
+    size_t len = strlen(content);
+    int res = write(fd, content, len) == (ssize_t)len ? FS_OK : FS_ERROR;
+    if (close(fd) != 0)
+        res = FS_ERROR;
+
+    if (res != FS_OK || rename(lock_path, path) != 0)
+    {
+        unlink(lock_path);
+        return FS_ERROR;
+    }
+
+    return FS_OK;
+}
+
+/// @brief Make the loose ref name point to checksum
+/// @return FS_OK, or REF_LOCKED when another command is writing it
+int write_ref(char *name, char *checksum)
+{
+    if (check_ref_name(name) != FS_OK)
+        return INVALID_REF_NAME;
+
+    char path[strlen(LOCAL_REPO) + strlen(name) + 2];
+    sprintf(path, "%s/%s", LOCAL_REPO, name);
+    create_parent_dirs(path);
+
+    char content[HEX_LENGTH + 1];
+    memcpy(content, checksum, HEX_LENGTH);
+    content[HEX_LENGTH] = '\0';
+    return write_locked_file(path, content);
+}
+
+/// @brief Read the name of the ref of the current branch
+/// @param name set to the name, such as "refs/heads/master"
+/// @return FS_OK, NO_CURRENT_HEAD when HEAD is empty
+int read_head_ref(char *name, size_t size)
+{
+    int fd = open(HEAD_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return REPO_NOT_INITIALIZED;
+
+    char buffer[REF_NAME_MAX];
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n < 0)
+        return FS_ERROR;
+    buffer[n] = '\0';
+    buffer[strcspn(buffer, "\n")] = '\0';
+    if (buffer[0] == '\0')
+        return NO_CURRENT_HEAD;
+
+    // HEAD holds the path of the loose ref
+    char *ref = buffer;
+    if (strncmp(ref, LOCAL_REPO"/", strlen(LOCAL_REPO) + 1) == 0)
+        ref += strlen(LOCAL_REPO) + 1;
+    if (strlen(ref) >= size)
+        return FS_ERROR;
+
+    strcpy(name, ref);
+    return FS_OK;
+}
+
+/// @brief Make name the current branch
+int write_head_ref(char *name)
+{
+    char content[strlen(LOCAL_REPO) + strlen(name) + 2];
+    sprintf(content, "%s/%s", LOCAL_REPO, name);
+    return write_locked_file(HEAD_FILE, content);
+}
+
+static uint64_t hash_ref_name(char *name)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *name != '\0'; name++)
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static struct ref *ref_slot(struct ref_table *table, char *name)
+{
+    size_t i = hash_ref_name(name) & (table->capacity - 1);
+    while (table->refs[i].name != NULL && strcmp(table->refs[i].name, name) != 0)
+        i = (i + 1) & (table->capacity - 1);
+    return &table->refs[i];
+}
+
+static void set_ref(struct ref_table *table, char *name, size_t name_len, char *checksum, int loose)
+{
+    // Kept at most half full
+    if ((table->count + 1) * 2 > table->capacity)
+    {
+        struct ref_table grown = {
+            .capacity = table->capacity == 0 ? 64 : table->capacity * 2,
+            .count = table->count,
+        };
+        grown.refs = calloc(grown.capacity, sizeof(struct ref));
+        for (size_t i = 0; i < table->capacity; i++)
+        {
+            if (table->refs[i].name != NULL)
+                *ref_slot(&grown, table->refs[i].name) = table->refs[i];
+        }
+        free(table->refs);
+        *table = grown;
+    }
+
+    char key[name_len + 1];
+    memcpy(key, name, name_len);
+    key[name_len] = '\0';
+
+    struct ref *ref = ref_slot(table, key);
+    if (ref->name == NULL)
+    {
+        ref->name = strdup(key);
+        table->count++;
+    }
+    memcpy(ref->checksum, checksum, HEX_LENGTH);
+    ref->checksum[HEX_LENGTH] = '\0';
+    ref->loose = loose;
+}
+
+static void load_loose_refs(struct ref_table *table, char *dir)
+{
+    char dir_path[strlen(LOCAL_REPO) + strlen(dir) + 2];
+    sprintf(dir_path, "%s/%s", LOCAL_REPO, dir);
+    DIR *dp = opendir(dir_path);
+    if (dp == NULL)
+        return;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp)) != NULL)
+    {
+        if (ep->d_name[0] == '.')
+            continue;
+
+        char name[strlen(dir) + strlen(ep->d_name) + 2];
+        sprintf(name, "%s/%s", dir, ep->d_name);
+        size_t len = strlen(name);
+        if (len >= strlen(REF_LOCK_SUFFIX) && strcmp(name + len - strlen(REF_LOCK_SUFFIX), REF_LOCK_SUFFIX) == 0)
+            continue;
+
+        char path[strlen(LOCAL_REPO) + len + 2];
+        sprintf(path, "%s/%s", LOCAL_REPO, name);
+        int is_dir = ep->d_type == DT_DIR;
+        struct stat st;
+        if (ep->d_type == DT_UNKNOWN && stat(path, &st) == 0)
+            is_dir = S_ISDIR(st.st_mode);
+
+        char checksum[HEX_LENGTH + 1];
+        if (is_dir)
+            load_loose_refs(table, name);
+        else if (read_loose_ref(path, checksum) == FS_OK)
+            set_ref(table, name, len, checksum, 1);
+    }
+
+    closedir(dp);
+}
+
+/// @brief Load every ref in table, the packed refs then the loose ones
+int load_refs(struct ref_table *table)
+{
+    memset(table, 0, sizeof(struct ref_table));
+    if (!local_repo_exist())
+        return REPO_NOT_INITIALIZED;
+
+    char *map;
+    size_t size;
+    int res = map_packed_refs(&map, &size);
+    if (res == FS_OK)
+    {
+        char *end = map + size;
+        for (char *line = map; line < end;)
+        {
+            char *name;
+            size_t name_len;
+            char *next = parse_packed_line(line, end, &name, &name_len);
+            if (next == NULL)
+            {
+                // Header or comment
+                next = memchr(line, '\n', end - line);
+                next = next == NULL ? end : next + 1;
+            } else
+            {
+                set_ref(table, name, name_len, line, 0);
+            }
+            line = next;
+        }
+        munmap(map, size);
+    } else if (res != FILE_NOT_FOUND)
+    {
+        return res;
+    }
+
+    load_loose_refs(table, "refs");
+    return FS_OK;
+}
+
+void free_refs(struct ref_table *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+        free(table->refs[i].name);
+    free(table->refs);
+    memset(table, 0, sizeof(struct ref_table));
+}
+
+struct ref *find_ref(struct ref_table *table, char *name)
+{
+    if (table->capacity == 0)
+        return NULL;
+
+    struct ref *ref = ref_slot(table, name);
+    return ref->name == NULL ? NULL : ref;
+}
+
+static int compare_refs(const void *a, const void *b)
+{
+    return strcmp((*(struct ref **)a)->name, (*(struct ref **)b)->name);
+}
+
+/// @brief The refs of table sorted by name
+/// @return array of table->count refs, to be freed by the caller
+struct ref **sorted_refs(struct ref_table *table)
+{
+    struct ref **refs = malloc((table->count == 0 ? 1 : table->count) * sizeof(struct ref *));
+    size_t count = 0;
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (table->refs[i].name != NULL)
+            refs[count++] = &table->refs[i];
+    }
+
+    qsort(refs, count, sizeof(struct ref *), compare_refs);
+    return refs;
+}
+
+/// @brief Remove the directories of path that became empty, up to the refs directory
+static void remove_empty_parents(char *path)
+{
+    char dir[strlen(path) + 1];
+    strcpy(dir, path);
+    char *slash;
+    while ((slash = strrchr(dir, '/')) != NULL)
+    {
+        *slash = '\0';
+        if (strcmp(dir, HEADS_DIR) == 0 || strcmp(dir, REFS_DIR) == 0 || rmdir(dir) != 0)
+            break;
+    }
+}
+
+/// @brief Write every ref to PACKED_REFS_FILE and remove the loose ones
+/// @param count set to the number of packed refs
+int pack_refs(size_t *count)
+{
+    struct ref_table table;
+    int res = load_refs(&table);
+    if (res != FS_OK)
+        return res;
+
+    struct ref **refs = sorted_refs(&table);
+    size_t size = strlen(PACKED_REFS_HEADER);
+    for (size_t i = 0; i < table.count; i++)
+        size += HEX_LENGTH + 1 + strlen(refs[i]->name) + 1;
+
+    char *content = malloc(size + 1);
+    char *ptr = content + sprintf(content, "%s", PACKED_REFS_HEADER);
+    for (size_t i = 0; i < table.count; i++)
+        ptr += sprintf(ptr, "%s %s\n", refs[i]->checksum, refs[i]->name);
+
+    res = write_locked_file(PACKED_REFS_FILE, content);
+    free(content);
+
+    // A loose ref updated since it was read is kept, it overrides the packed one
+    for (size_t i = 0; res == FS_OK && i < table.count; i++)
+    {
+        if (!refs[i]->loose)
+            continue;
+
+        char path[strlen(LOCAL_REPO) + strlen(refs[i]->name) + 2];
+        sprintf(path, "%s/%s", LOCAL_REPO, refs[i]->name);
+        char checksum[HEX_LENGTH + 1];
+        if (read_loose_ref(path, checksum) == FS_OK && strcmp(checksum, refs[i]->checksum) == 0)
+        {
+            unlink(path);
+            remove_empty_parents(path);
+        }
+    }
+
+    *count = table.count;
+    free(refs);
+    free_refs(&table);
+    return res;
+}
+
+/// @brief Print the name of each branch, the current one marked with '*'
+int print_branches(FILE *out)
+{
+    struct ref_table table;
+    int res = load_refs(&table);
+    if (res != FS_OK)
+        return res;
+
+    char head[REF_NAME_MAX] = {0};
+    read_head_ref(head, sizeof(head));
+
+    struct ref **refs = sorted_refs(&table);
+    size_t prefix_len = strlen(HEADS_PREFIX);
+    for (size_t i = 0; i < table.count; i++)
+    {
+        if (strncmp(refs[i]->name, HEADS_PREFIX, prefix_len) != 0)
+            continue;
+        fprintf(out, "%c %s\n", strcmp(refs[i]->name, head) == 0 ? '*' : ' ', refs[i]->name + prefix_len);
+    }
+
+    free(refs);
+    free_refs(&table);
+    return FS_OK;
+}
@@ -0,0 +1,62 @@
+#ifndef REFS_H
+#define REFS_H 1
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "includes.h"
+
+// A ref is named from LOCAL_REPO, as "refs/heads/<branch>". It is either
+// loose, in the file of its name holding the hexadecimal checksum it points
+// to, or packed in PACKED_REFS_FILE, which follows the format
+// "# pack-refs with: sorted\n"
+// checksum1 (hexadecimal) + ' ' + name1 + '\n'
+// checksum2 (hexadecimal) + ' ' + name2 + '\n'
+// ...
+// sorted by name, so that a single ref is found by a binary search. A loose
+// ref takes precedence over the packed one with the same name.
+//
+// HEAD_FILE holds the path of the loose file of the current branch, it is
+// empty before the first commit.
+//
+// Refs and HEAD are written to "<file>.lock", created exclusively, then
+// renamed over the file, so that readers never see a partial write and two
+// writers of the same ref do not interleave.
+
+#define PACKED_REFS_HEADER "# pack-refs with: sorted\n"
+#define HEADS_PREFIX "refs/heads/"
+#define REF_LOCK_SUFFIX ".lock"
+#define HEX_LENGTH (DIGEST_LENGTH * 2)
+#define REF_NAME_MAX 1024
+
+#define REF_LOCKED (-90)
+#define INVALID_REF_NAME (-91)
+
+struct ref {
+    // NULL for an empty slot of the table
+    char *name;
+    char checksum[HEX_LENGTH + 1];
+    int loose;
+};
+
+/// @brief every ref of the repository, in an open addressing table keyed by name
+struct ref_table {
+    struct ref *refs;
+    size_t capacity;
+    size_t count;
+};
+
+int load_refs(struct ref_table *table);
+void free_refs(struct ref_table *table);
+struct ref *find_ref(struct ref_table *table, char *name);
+struct ref **sorted_refs(struct ref_table *table);
+
+int check_ref_name(char *name);
+int read_ref(char *name, char *checksum);
+int write_ref(char *name, char *checksum);
+int read_head_ref(char *name, size_t size);
+int write_head_ref(char *name);
+int pack_refs(size_t *count);
+int print_branches(FILE *out);
+
+#endif // REFS_H
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "commit.h"
+#include "fs.h"
+#include "fsmonitor.h"
+#include "includes.h"
+#include "index.h"
+#include "refs.h"
+#include "status.h"
+#include "tree.h"
+#include "types.h"
+#include "workqueue.h"
+
+// Number of index entries checked by each job of the pool
+#define STATUS_CHUNK_SIZE 512
+
+// State of an index entry in the working tree
+#define WORKTREE_CLEAN ' '
+#define WORKTREE_MODIFIED 'M'
+#define WORKTREE_DELETED 'D'
+// Same content, but the stat data of the index are outdated
+#define WORKTREE_STAT_CHANGED 'S'
+
+struct status_entry {
+    char *path;
+    // Change between HEAD and the index, and between the index and the working tree
+    char staged;
+    char unstaged;
+};
+
+struct status_list {
+    struct status_entry *entries;
+    size_t size;
+    size_t capacity;
+};
+
+struct worktree_check {
+    index_t *index;
+    char *states;
+    struct stat *stats;
+};
+
+static void push_status(struct status_list *list, char *path, char staged, char unstaged)
+{
+    if (list->size == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        list->entries = realloc(list->entries, list->capacity * sizeof(struct status_entry));
+    }
+
+    list->entries[list->size++] = (struct status_entry) { .path = path, .staged = staged, .unstaged = unstaged };
+}
+
+/// @brief Job of the pool, checks the entries of the index from start to start + STATUS_CHUNK_SIZE
+static void check_worktree_chunk(struct workqueue *queue, int worker, void *arg)
+{
+    struct worktree_check *check = queue->data;
+    size_t start = (size_t)arg;
+    size_t end = start + STATUS_CHUNK_SIZE;
+    if (end > check->index->entries.entries_size)
+        end = check->index->entries.entries_size;
+
+    for (size_t i = start; i < end; i++)
+    {
+        entry_t *entry = &check->index->entries.entries[i];
+        if (check->index->fsmonitor_active && entry->fsmonitor_valid)
+        {
+            check->states[i] = WORKTREE_CLEAN;
+            continue;
+        }
+
+        struct stat *st = &check->stats[i];
+        // As add, the stat data are the ones of the file a link points to
+        if (stat(entry->filename, st) != 0)
+        {
+            check->states[i] = WORKTREE_DELETED;
+            continue;
+        }
+
+        if (entry_is_clean(check->index, entry, st))
+        {
+            check->states[i] = WORKTREE_CLEAN;
+            continue;
+        }
+
+        unsigned char checksum[DIGEST_LENGTH];
+        if (hash_blob_from_file(entry->filename, checksum) == FS_OK
+            && memcmp(checksum, entry->checksum, DIGEST_LENGTH) == 0 && entry->mode == mode_from_stat(st))
+            check->states[i] = WORKTREE_STAT_CHANGED;
+        else
+            check->states[i] = WORKTREE_MODIFIED;
+    }
+}
+
+/// @brief Compare the index with the working tree, the entries are checked by
+/// a pool of threads. The stat data of unchanged files are refreshed
+/// @param states filled with the state of each entry of the index
+/// @return whether stat data were refreshed
+static int check_worktree(index_t *index, char *states)
+{
+    size_t count = index->entries.entries_size;
+    struct worktree_check check = {
+        .index = index,
+        .states = states,
+        .stats = malloc((count == 0 ? 1 : count) * sizeof(struct stat)),
+    };
+
+    struct workqueue queue;
+    size_t chunks = (count + STATUS_CHUNK_SIZE - 1) / STATUS_CHUNK_SIZE;
+    int threads = default_thread_count();
+    init_workqueue(&queue, chunks < (size_t)threads ? (int)chunks : threads, &check);
+    for (size_t start = 0; start < count; start += STATUS_CHUNK_SIZE)
+        push_work(&queue, 0, check_worktree_chunk, (void *)start);
+    run_workqueue(&queue);
+    free_workqueue(&queue);
+
+    int refreshed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        entry_t *entry = &index->entries.entries[i];
+        if (states[i] == WORKTREE_STAT_CHANGED)
+        {
+            fill_stat_data(&entry->stat, &check.stats[i]);
+            states[i] = WORKTREE_CLEAN;
+            refreshed = 1;
+        }
+
+        // Clean files are not checked again until the fsmonitor sees them change
+        int fsmonitor_valid = index->fsmonitor_active && states[i] == WORKTREE_CLEAN;
+        if (entry->fsmonitor_valid != fsmonitor_valid)
+        {
+            entry->fsmonitor_valid = fsmonitor_valid;
+            refreshed = 1;
+        }
+    }
+
+    free(check.stats);
+    return refreshed;
+}
+
+/// @brief Compare the files of HEAD with the index
+static void check_staged(index_t *index, struct status_list *staged)
+{
+    char head[DIGEST_LENGTH * 2 + 1];
+    unsigned char head_tree[DIGEST_LENGTH];
+    int has_head = get_head_commit_checksum(head) == FS_OK && get_commit_tree(head, head_tree) == FS_OK;
+
+    // The trees of the index were all written by the last commit
+    if (has_head && index->cache_tree != NULL && index->cache_tree->entry_count >= 0
+        && memcmp(index->cache_tree->checksum, head_tree, DIGEST_LENGTH) == 0)
+        return;
+
+    index_t head_files = {0};
+    if (has_head)
+        load_commit_index(head, &head_files);
+
+    tree_t *a = &head_files.entries, *b = &index->entries;
+    size_t i = 0, j = 0;
+    while (i < a->entries_size || j < b->entries_size)
+    {
+        int cmp;
+        if (i == a->entries_size)
+            cmp = 1;
+        else if (j == b->entries_size)
+            cmp = -1;
+        else
+            cmp = strcmp(a->entries[i].filename, b->entries[j].filename);
+
+        if (cmp < 0)
+        {
+            push_status(staged, strdup(a->entries[i].filename), DIFF_DELETED, ' ');
+        } else if (cmp > 0)
+        {
+            push_status(staged, strdup(b->entries[j].filename), DIFF_ADDED, ' ');
+        } else if (a->entries[i].mode != b->entries[j].mode
+                   || memcmp(a->entries[i].checksum, b->entries[j].checksum, DIGEST_LENGTH) != 0)
+        {
+            push_status(staged, strdup(b->entries[j].filename), DIFF_MODIFIED, ' ');
+        }
+
+        if (cmp <= 0)
+            i++;
+        if (cmp >= 0)
+            j++;
+    }
+
+    free_index(&head_files);
+}
+
+static void push_untracked(char *path, void *data)
+{
+    push_status(data, strdup(path), '?', '?');
+}
+
+static int compare_status_entries(const void *a, const void *b)
+{
+    return strcmp(((struct status_entry *)a)->path, ((struct status_entry *)b)->path);
+}
+
+static char *status_label(char status)
+{
+    switch (status)
+    {
+        case DIFF_ADDED:
+            return "new file:   ";
+        case DIFF_DELETED:
+            return "deleted:    ";
+        default:
+            return "modified:   ";
+    }
+}
+
+static void print_branch(FILE *out)
+{
+    char head[REF_NAME_MAX];
+    if (read_head_ref(head, sizeof(head)) != FS_OK)
+        return;
+
+    char *branch = head;
+    if (strncmp(head, HEADS_PREFIX, strlen(HEADS_PREFIX)) == 0)
+        branch += strlen(HEADS_PREFIX);
+    fprintf(out, "On branch %s\n", branch);
+}
+
+/// @brief Print the changes between HEAD, the index and the working tree
+/// @param format STATUS_LONG or STATUS_SHORT, which prints "XY <path>" lines
+/// as git status --short
+int print_status(int format, FILE *out)
+{
+    // The refreshed data is only saved when no other command holds the lock,
+    // the index is then only read
+    index_t index = {0};
+    int res = load_index_locked(&index);
+    if (res == INDEX_LOCKED)
+        res = load_index(&index);
+    if (res != FS_OK)
+        return res;
+    sort_tree(&index.entries);
+    int token_changed = refresh_fsmonitor(&index) > 0;
+
+    struct status_list staged = {0}, unstaged = {0}, untracked = {0};
+    check_staged(&index, &staged);
+
+    size_t count = index.entries.entries_size;
+    char *states = malloc(count == 0 ? 1 : count);
+    int refreshed = check_worktree(&index, states);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (states[i] != WORKTREE_CLEAN)
+            push_status(&unstaged, strdup(index.entries.entries[i].filename), ' ', states[i]);
+    }
+    free(states);
+
+    list_untracked_files(&index, "", 1, push_untracked, &untracked);
+    if (index.locked && (refreshed || token_changed || index.untracked->changed))
+        save_index(&index);
+    qsort(untracked.entries, untracked.size, sizeof(struct status_entry), compare_status_entries);
+
+    if (format == STATUS_SHORT)
+    {
+        // Both lists are in path order, a path may be in both
+        size_t i = 0, j = 0;
+        while (i < staged.size || j < unstaged.size)
+        {
+            int cmp;
+            if (i == staged.size)
+                cmp = 1;
+            else if (j == unstaged.size)
+                cmp = -1;
+            else
+                cmp = strcmp(staged.entries[i].path, unstaged.entries[j].path);
+
+            char x = cmp <= 0 ? staged.entries[i].staged : ' ';
+            char y = cmp >= 0 ? unstaged.entries[j].unstaged : ' ';
+            fprintf(out, "%c%c %s\n", x, y, cmp <= 0 ? staged.entries[i].path : unstaged.entries[j].path);
+            if (cmp <= 0)
+                i++;
+            if (cmp >= 0)
+                j++;
+        }
+        for (size_t k = 0; k < untracked.size; k++)
+            fprintf(out, "?? %s\n", untracked.entries[k].path);
+    } else
+    {
+        print_branch(out);
+        if (staged.size > 0)
+        {
+            fprintf(out, "\nChanges to be committed:\n");
+            for (size_t k = 0; k < staged.size; k++)
+                fprintf(out, "\t%s%s\n", status_label(staged.entries[k].staged), staged.entries[k].path);
+        }
+        if (unstaged.size > 0)
+        {
+            fprintf(out, "\nChanges not staged for commit:\n");
+            for (size_t k = 0; k < unstaged.size; k++)
+                fprintf(out, "\t%s%s\n", status_label(unstaged.entries[k].unstaged), unstaged.entries[k].path);
+        }
+        if (untracked.size > 0)
+        {
+            fprintf(out, "\nUntracked files:\n");
+            for (size_t k = 0; k < untracked.size; k++)
+                fprintf(out, "\t%s\n", untracked.entries[k].path);
+        }
+        if (staged.size == 0 && unstaged.size == 0)
+            fprintf(out, untracked.size == 0 ? "nothing to commit, working tree clean\n"
+                                             : "\nnothing added to commit but untracked files present\n");
+    }
+
+    struct status_list *lists[] = { &staged, &unstaged, &untracked };
+    for (size_t l = 0; l < 3; l++)
+    {
+        for (size_t k = 0; k < lists[l]->size; k++)
+            free(lists[l]->entries[k].path);
+        free(lists[l]->entries);
+    }
+    free_index(&index);
+    return FS_OK;
+}
@@ -0,0 +1,22 @@
+#ifndef STATUS_H
+#define STATUS_H 1
+
+#include <stdio.h>
+
+// Status compares the tree of HEAD with the index, and the index with the
+// working tree.
+// - The index matches HEAD without reading any tree when the root of its
+//   cache tree holds the tree of HEAD.
+// - Files whose stat data match their index entry are clean, only the other
+//   ones are hashed again. The files are checked by a pool of threads.
+// - Files that are neither in the index nor ignored are untracked, a
+//   directory without any file of the index is shown as a whole.
+// When files only had their stat data change, the index is written back with
+// the new stat data so that they are not hashed again next time.
+
+#define STATUS_LONG 0
+#define STATUS_SHORT 1
+
+int print_status(int format, FILE *out);
+
+#endif // STATUS_H
@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "arena.h"
 #include "tree.h"
 #include "includes.h"
 #include "fs.h"
@@ -11,278 +12,417 @@
 #include "types.h"
 #include "utils.h"
 
-void free_entry(struct entry *entry)
+void free_tree(tree_t *tree)
 {
-    if (entry->checksum != NULL)
-        free(entry->checksum);
-    
-    if (entry->filename != NULL)
-        free(entry->filename);
+    if (!tree->external_arena)
+    {
+        free(tree->entries);
+        if (tree->arena != NULL)
+        {
+            free_arena(tree->arena);
+            free(tree->arena);
+        }
+    }
 
+    memset(tree, 0, sizeof(tree_t));
 }
 
-void free_tree(tree_t *tree)
+/// @brief Copy filename in the arena of tree, names are only freed with the tree
+static char *store_name(tree_t *tree, char *filename)
 {
-    struct entry *current = tree->first_entry;
-    struct entry *next;
-    while(current != NULL)
+    if (tree->arena == NULL)
+        tree->arena = calloc(1, sizeof(struct arena));
+
+    return arena_strndup(tree->arena, filename, strlen(filename));
+}
+
+static entry_t *new_entry(tree_t *tree)
+{
+    if (tree->entries_size == tree->entries_capacity)
     {
-        free_entry(current);
-        next = current->next;
-        free(current);
-        current = next;   
+        size_t capacity = tree->entries_capacity == 0 ? 16 : tree->entries_capacity * 2;
+        if (tree->external_arena)
+            tree->entries = arena_realloc(tree->arena, tree->entries, tree->entries_capacity * sizeof(entry_t), capacity * sizeof(entry_t));
+        else
+            tree->entries = realloc(tree->entries, capacity * sizeof(entry_t));
+        tree->entries_capacity = capacity;
     }
+
+    return &tree->entries[tree->entries_size++];
 }
 
-struct entry *find_entry(tree_t *tree, char* filename)
+static void fill_entry(tree_t *tree, entry_t *entry, unsigned char *checksum, enum object_type type, char *filename, enum file_mode mode)
 {
-    struct entry *current = tree->first_entry;
-    for (int i = 0; i < tree->entries_size; ++i)
+    memset(entry, 0, sizeof(entry_t));
+    entry->type = type;
+    entry->mode = mode;
+    memcpy(entry->checksum, checksum, DIGEST_LENGTH);
+    entry->filename = store_name(tree, filename);
+}
+
+/// @brief Binary search of filename in the sorted part of tree
+/// @return the position of the entry, or where it would be inserted if found is 0
+static size_t entry_position(tree_t *tree, char *filename, int *found)
+{
+    size_t low = 0, high = tree->sorted_size;
+    while (low < high)
     {
-        if (strcmp(filename, current->filename) == 0) {
-            return current;
+        size_t middle = low + (high - low) / 2;
+        int cmp = strcmp(tree->entries[middle].filename, filename);
+        if (cmp == 0)
+        {
+            *found = 1;
+            return middle;
         }
-        current = current->next;
+        if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle;
     }
 
-    return NULL;
+    *found = 0;
+    return low;
 }
 
-int add_to_tree(tree_t *tree, object_t *object, char *filename, enum file_mode mode)
+static void merge_entries(entry_t *entries, entry_t *tmp, size_t size)
 {
+    if (size < 2)
+        return;
 
-    int new = 0;
-    entry_t *entry = find_entry(tree, filename);
-    if (entry == NULL)
+    size_t middle = size / 2;
+    merge_entries(entries, tmp, middle);
+    merge_entries(entries + middle, tmp, size - middle);
+    if (strcmp(entries[middle - 1].filename, entries[middle].filename) <= 0)
+        return;
+
+    size_t i = 0, j = middle, k = 0;
+    while (i < middle && j < size)
     {
-        new = 1;
-        entry = calloc(sizeof(entry_t), 1);
-    } else {
-        free_entry(entry);
+        if (strcmp(entries[j].filename, entries[i].filename) < 0)
+            tmp[k++] = entries[j++];
+        else
+            tmp[k++] = entries[i++];
     }
+    while (i < middle)
+        tmp[k++] = entries[i++];
+    memcpy(entries, tmp, j * sizeof(entry_t));
+}
 
-    entry->type = object->object_type;
-    entry->mode = mode;
-    entry->filename = calloc(sizeof(char), strlen(filename) + 1);
-    strncat(entry->filename, filename, strlen(filename));
-    entry->checksum = calloc(sizeof(char), DIGEST_LENGTH);
-    hash_object(object, entry->checksum);
-    // int res = write_object(object);
-    // if (res != FS_OK && res != OBJECT_ALREADY_EXIST)
-    // {
-    //     return res;
-    // }
-    
-    if(new)
+/// @brief Merge the entries appended since the last sort into the sorted part
+/// When several entries have the same filename the one appended last is kept
+void sort_tree(tree_t *tree)
+{
+    if (tree->sorted_size == tree->entries_size)
+        return;
+
+    size_t appended = tree->entries_size - tree->sorted_size;
+    entry_t *tail = tree->entries + tree->sorted_size;
+    entry_t *tmp = malloc(tree->entries_size * sizeof(entry_t));
+
+    // The sort is stable, so among equal filenames the last one is the newest
+    merge_entries(tail, tmp, appended);
+    size_t unique = 0;
+    for (size_t i = 0; i < appended; i++)
+    {
+        if (unique > 0 && strcmp(tail[unique - 1].filename, tail[i].filename) == 0)
+            unique--;
+        tail[unique++] = tail[i];
+    }
+
+    size_t i = 0, j = 0, k = 0;
+    while (i < tree->sorted_size && j < unique)
     {
-        if (tree->entries_size == 0)
+        int cmp = strcmp(tree->entries[i].filename, tail[j].filename);
+        if (cmp < 0)
         {
-            tree->first_entry = entry;
-            tree->last_entry = entry;
+            tmp[k++] = tree->entries[i++];
         } else
         {
-            struct entry *current = tree->first_entry;
-            while (current != NULL && (strncmp(current->filename, entry->filename, strlen(entry->filename)) < 0))
-            {
-                current = current->next;
-            }
-
-            if (current == NULL)
-            {
-                tree->last_entry->next = entry;
-                entry->previous = tree->last_entry;
-                tree->last_entry = entry;
-            } else {
-                if(current == tree->first_entry)
-                {
-                    tree->first_entry = entry;
-                } else {
-                    current->previous->next = entry;
-                    entry->previous = current->previous;
-                }
-
-                entry->next = current;
-                current->previous = entry;
-            }
+            if (cmp == 0)
+                i++;
+            tmp[k++] = tail[j++];
         }
-        tree->entries_size ++;
     }
+    while (i < tree->sorted_size)
+        tmp[k++] = tree->entries[i++];
+    while (j < unique)
+        tmp[k++] = tail[j++];
+
+    memcpy(tree->entries, tmp, k * sizeof(entry_t));
+    free(tmp);
+    tree->entries_size = k;
+    tree->sorted_size = k;
 }
 
-int add_to_index(tree_t *index, char *filename, enum file_mode mode)
+/// @brief Find the entry of filename, the tree is sorted first if entries were appended
+/// The pointer is valid until the next change of tree
+entry_t *find_entry(tree_t *tree, char* filename)
 {
-    int result = FS_OK;
-    struct object object = {0};
-    if (blob_from_file(filename, &object) != FS_OK)
+    sort_tree(tree);
+
+    int found;
+    size_t position = entry_position(tree, filename, &found);
+    return found ? &tree->entries[position] : NULL;
+}
+
+/// @brief Insert an entry at its place in tree, or replace the entry with the same filename
+/// To add many entries use append_entry_to_tree then sort_tree
+entry_t *add_entry_to_tree(tree_t *tree, unsigned char *checksum, enum object_type type, char *filename, enum file_mode mode)
+{
+    sort_tree(tree);
+
+    int found;
+    size_t position = entry_position(tree, filename, &found);
+    if (!found)
     {
-        return FILE_NOT_FOUND;
+        new_entry(tree);
+        memmove(tree->entries + position + 1, tree->entries + position, (tree->entries_size - 1 - position) * sizeof(entry_t));
+        tree->sorted_size++;
     }
 
-    result = write_object(&object);
-    if (result == FS_OK)
-        add_to_tree(index, &object, filename, mode);
+    entry_t *entry = &tree->entries[position];
+    fill_entry(tree, entry, checksum, type, filename, mode);
+    return entry;
+}
 
-    if (result == OBJECT_ALREADY_EXIST)
-        return FS_OK;
+/// @brief Add an entry at the end of tree without looking for its place
+/// The tree is sorted again by the next sort_tree, find_entry or add_entry_to_tree
+entry_t *append_entry_to_tree(tree_t *tree, unsigned char *checksum, enum object_type type, char *filename, enum file_mode mode)
+{
+    int sorted = tree->sorted_size == tree->entries_size
+        && (tree->entries_size == 0 || strcmp(tree->entries[tree->entries_size - 1].filename, filename) < 0);
 
-defer:
-    free_object(&object);
-    return result;
+    entry_t *entry = new_entry(tree);
+    fill_entry(tree, entry, checksum, type, filename, mode);
+    if (sorted)
+        tree->sorted_size++;
+
+    return entry;
 }
 
-int remove_from_tree(tree_t *index, char *filename, int delete)
+int add_to_tree(tree_t *tree, object_t *object, char *filename, enum file_mode mode)
 {
-    struct entry *entry = find_entry(index, filename);
-    if (entry == NULL)
-    {
-        return ENTRY_NOT_FOUND;
-    }
+    unsigned char checksum[DIGEST_LENGTH];
+    hash_object(object, checksum);
+    add_entry_to_tree(tree, checksum, object->object_type, filename, mode);
+    return 0;
+}
 
-    if(index->first_entry == entry)
-    {
-        index->first_entry = entry->next;
-    } else 
+int remove_from_tree(tree_t *tree, char *filename, int delete)
+{
+    sort_tree(tree);
+
+    int found;
+    size_t position = entry_position(tree, filename, &found);
+    if (!found)
     {
-        entry->previous->next = entry->next;
+        return ENTRY_NOT_FOUND;
     }
 
-    if (index->last_entry == entry)
-    {
-        index->last_entry = entry->previous;
-    } else 
+    if (delete)
     {
-        entry->next->previous = entry->previous;
+        char checksum[DIGEST_LENGTH * 2 + 1];
+        hash_to_hexa(tree->entries[position].checksum, checksum);
+        remove_object(checksum);
     }
 
-    if (delete)
-        remove_object(entry->checksum);
-    index->entries_size = index->entries_size - 1;
-    free_entry(entry);
-    free(entry);
+    memmove(tree->entries + position, tree->entries + position + 1, (tree->entries_size - position - 1) * sizeof(entry_t));
+    tree->entries_size--;
+    tree->sorted_size--;
     return FS_OK;
 }
 
 int tree_to_object(tree_t *tree, object_t *object)
 {
+    sort_tree(tree);
     object->object_type = TREE;
+
+    // Entry will be <mode>(in ASCII) + ' ' + <filename> + '\0' + <checksum>
     object->size = 0;
-    object->content = NULL;
+    for (size_t i = 0; i < tree->entries_size; i++)
+    {
+        int mode_length = tree->entries[i].mode == DIRECTORY ? 5 : 6;
+        object->size += mode_length + 1 + strlen(tree->entries[i].filename) + 1 + DIGEST_LENGTH;
+    }
 
-    struct entry *current = tree->first_entry;
-    for(int i = 0; i < tree->entries_size; i++)
+    object->content = malloc(object->size == 0 ? 1 : object->size);
+    char *ptr = object->content;
+    for (size_t i = 0; i < tree->entries_size; i++)
     {
-        char *type = object_type_to_str(current->type);
-        // Entry will be <mode>(in ASCII) + ' ' + <filename> + '\0' + <checksum>
-        int mode_length = 6;
-        if (current->mode == DIRECTORY)
-            mode_length = 5;
-        size_t entry_size = mode_length + 1 + strlen(current->filename) + 1 + DIGEST_LENGTH;
-        char tmp[entry_size];
-        sprintf(tmp, "%o %s", current->mode, current->filename);
-        memcpy(tmp + entry_size - DIGEST_LENGTH, current->checksum, DIGEST_LENGTH);
-
-        object->size = object->size + entry_size;
-        object->content = realloc(object->content, object->size);
-        memcpy((object->content) + object->size - entry_size, tmp, entry_size);
-        current = current->next;
+        entry_t *current = &tree->entries[i];
+        ptr += sprintf(ptr, "%o %s", current->mode, current->filename) + 1;
+        memcpy(ptr, current->checksum, DIGEST_LENGTH);
+        ptr += DIGEST_LENGTH;
     }
 
     return 0;
 }
 
-int tree_from_object(tree_t *tree, object_t *object)
+/// @brief Parse the entries of a tree object
+/// @param arena where to allocate the tree, it is then released with the arena
+/// instead of free_tree. NULL for the tree to own its memory
+int tree_from_object(tree_t *tree, object_t *object, struct arena *arena)
 {
-    tree->entries_size = 0;
-    tree->first_entry = NULL;
-    tree->last_entry = NULL;
-    
-    int i = 0, j = 0;
+    memset(tree, 0, sizeof(tree_t));
+    tree->arena = arena;
+    tree->external_arena = arena != NULL;
+
+    size_t i = 0, j = 0;
     while (j < object->size)
     {
         i = j;
-        entry_t *entry = malloc(sizeof(entry_t));
+        enum object_type type;
 
         look_for(object->content, ' ', j);
         int pot_mode = strtol(object->content + i, NULL, 8);
         switch (pot_mode)
         {
             case DIRECTORY:
-                entry->type = TREE;
+                type = TREE;
                 break;
             case REG_NONX_FILE:
             case REG_EXE_FILE:
             case SYM_LINK:
-                entry->type = BLOB;
+                type = BLOB;
+                break;
             case GIT_LINK:
+                type = COMMIT;
                 break;
             
             default:
                 return INVALID_TREE;
                 break;
         }
-        entry->mode = (enum file_mode) pot_mode;
 
         i = j + 1;
         look_for(object->content, '\0', j);
-        if (j - i == 0)
+        if (j - i == 0 || j + DIGEST_LENGTH >= object->size)
             return INVALID_TREE;
-        entry->filename = malloc(j - i + 1);
-        memcpy(entry->filename, object->content + i, j - i + 1);
 
-        i = j + 1;
-        entry->checksum = malloc(DIGEST_LENGTH);
-        memcpy(entry->checksum, object->content + i, DIGEST_LENGTH);
+        append_entry_to_tree(tree, (unsigned char *)object->content + j + 1, type, object->content + i, (enum file_mode) pot_mode);
         j += DIGEST_LENGTH + 1;
+    }
 
-        entry->previous = tree->last_entry;
-        entry->next = NULL;
+    sort_tree(tree);
+    return 0;
+}
 
-        if(tree->last_entry == NULL)
-        {
-            tree->first_entry = entry;
-        } else
-        {
-            entry->previous->next = entry;
-        }
-        tree->last_entry = entry;
-        tree->entries_size ++;
+/// @brief Parse the tree object of checksum in arena, a NULL checksum is the empty tree
+static int read_tree_in_arena(unsigned char *checksum, tree_t *tree, struct arena *arena)
+{
+    memset(tree, 0, sizeof(tree_t));
+    if (checksum == NULL)
+        return FS_OK;
+
+    char hexa[DIGEST_LENGTH * 2 + 1];
+    hash_to_hexa(checksum, hexa);
 
+    object_t object = {0};
+    int res = read_object(hexa, &object);
+    if (res != FS_OK)
+        return res;
+
+    if (object.object_type != TREE)
+    {
+        error_print("Object %s is not a tree", hexa);
+        free_object(&object);
+        return WRONG_OBJECT_TYPE;
     }
 
-    return 0;
+    res = tree_from_object(tree, &object, arena);
+    free_object(&object);
+    return res;
+}
+
+static int diff_subtrees(unsigned char *checksum_a, unsigned char *checksum_b, char *prefix,
+                         tree_change_fn callback, void *data, struct arena *arena);
+
+/// @brief Report an entry present on a single side, a directory is reported file by file
+static int report_one_side(entry_t *entry, char status, char *path, tree_change_fn callback, void *data,
+                           struct arena *arena)
+{
+    if (entry->type == TREE)
+    {
+        if (status == DIFF_ADDED)
+            return diff_subtrees(NULL, entry->checksum, path, callback, data, arena);
+        return diff_subtrees(entry->checksum, NULL, path, callback, data, arena);
+    }
+
+    return status == DIFF_ADDED ? callback(status, path, NULL, entry, data) : callback(status, path, entry, NULL, data);
 }
 
-int add_object_to_tree(tree_t *tree, char* filename, enum file_mode mode, object_t *source)
+static int diff_subtrees(unsigned char *checksum_a, unsigned char *checksum_b, char *prefix,
+                         tree_change_fn callback, void *data, struct arena *arena)
 {
-    char top_folder_name[strlen(filename)];
-    char path_left[strlen(filename)];
-    int res = get_top_folder(filename, top_folder_name, path_left); 
-    if (res > 0)
+    tree_t a, b;
+    int res = read_tree_in_arena(checksum_a, &a, arena);
+    if (res == FS_OK)
+        res = read_tree_in_arena(checksum_b, &b, arena);
+    if (res != FS_OK)
+        return res;
+
+    size_t prefix_len = strlen(prefix);
+    size_t i = 0, j = 0;
+    while (res == FS_OK && (i < a.entries_size || j < b.entries_size))
     {
-        tree_t subtree = {0};
-        object_t result = {0};
-        result.object_type = TREE;
-        entry_t *top_folder = find_entry(tree, top_folder_name);
-        if(top_folder != NULL)
+        int cmp;
+        if (i == a.entries_size)
+            cmp = 1;
+        else if (j == b.entries_size)
+            cmp = -1;
+        else
+            cmp = strcmp(a.entries[i].filename, b.entries[j].filename);
+
+        entry_t *entry_a = cmp <= 0 ? &a.entries[i++] : NULL;
+        entry_t *entry_b = cmp >= 0 ? &b.entries[j++] : NULL;
+        char *name = entry_a != NULL ? entry_a->filename : entry_b->filename;
+
+        // Identical entries, including whole directories, are skipped without being read
+        if (entry_a != NULL && entry_b != NULL && entry_a->mode == entry_b->mode
+            && memcmp(entry_a->checksum, entry_b->checksum, DIGEST_LENGTH) == 0)
+            continue;
+
+        char *path = arena_alloc(arena, prefix_len + strlen(name) + 2);
+        if (prefix_len == 0)
+            strcpy(path, name);
+        else
+            sprintf(path, "%s/%s", prefix, name);
+
+        if (entry_a == NULL)
         {
-            char checksum[DIGEST_LENGTH * 2 + 1];
-            hash_to_hexa(top_folder->checksum, checksum);
-            load_tree(checksum, &subtree);
-            remove_from_tree(tree, top_folder->filename, 0);
+            res = report_one_side(entry_b, DIFF_ADDED, path, callback, data, arena);
+        } else if (entry_b == NULL)
+        {
+            res = report_one_side(entry_a, DIFF_DELETED, path, callback, data, arena);
+        } else if (entry_a->type == TREE && entry_b->type == TREE)
+        {
+            res = diff_subtrees(entry_a->checksum, entry_b->checksum, path, callback, data, arena);
+        } else if (entry_a->type == TREE || entry_b->type == TREE)
+        {
+            // A directory replaced by a file or the opposite
+            res = report_one_side(entry_a, DIFF_DELETED, path, callback, data, arena);
+            if (res == FS_OK)
+                res = report_one_side(entry_b, DIFF_ADDED, path, callback, data, arena);
+        } else
+        {
+            res = callback(DIFF_MODIFIED, path, entry_a, entry_b, data);
         }
+    }
 
-        add_to_tree(&subtree, source, path_left, mode);
-
-        add_object_to_tree(&subtree, path_left, mode, source);
+    return res;
+}
 
-        tree_to_object(&subtree, &result);
-        write_object(&result);
-        remove_from_tree(tree, filename, 0);
-        add_to_tree(tree, &result, top_folder_name, DIRECTORY);
-        free_object(&result);
-        free_tree(&subtree);
-    } else {
-        add_to_tree(tree, source, filename, mode);
-        write_object(source);
-    }
+/// @brief Walk two trees in lockstep and report the files that differ
+/// Entries with the same checksum and mode are skipped, so an unchanged
+/// directory is never read. The paths are reported in the order of the trees
+/// @param checksum_a first tree, NULL for the empty tree
+/// @param checksum_b second tree, NULL for the empty tree
+/// @param callback called for each change, with a NULL entry for the missing
+/// side. A non zero return stops the walk and is returned
+int diff_trees(unsigned char *checksum_a, unsigned char *checksum_b, tree_change_fn callback, void *data)
+{
+    struct arena arena = {0};
+    int res = diff_subtrees(checksum_a, checksum_b, "", callback, data, &arena);
+    free_arena(&arena);
+    return res;
 }
@@ -1,24 +1,26 @@
-#ifndef INDEX_H
-#define INDEX_H
+#ifndef TREE_H
+#define TREE_H 1
 
 #include <stddef.h>
 #include "types.h"
 
 #define INVALID_TREE (-1)
 
-// Index file should follow the format
-// number of entries\n
-// entry1\n
-// entry2\n
-// ...
+// Status of a path reported by diff_trees, as printed by diff --name-status
+#define DIFF_ADDED 'A'
+#define DIFF_DELETED 'D'
+#define DIFF_MODIFIED 'M'
+
+typedef int (*tree_change_fn)(char status, char *path, entry_t *a, entry_t *b, void *data);
 
 void free_tree(tree_t *index);
 entry_t *find_entry(tree_t *index, char* filename);
-void index_from_content(char* content, tree_t *tree);
-int add_to_index(tree_t *index, char *filename, enum file_mode mode);
+entry_t *add_entry_to_tree(tree_t *tree, unsigned char *checksum, enum object_type type, char *filename, enum file_mode mode);
+entry_t *append_entry_to_tree(tree_t *tree, unsigned char *checksum, enum object_type type, char *filename, enum file_mode mode);
+void sort_tree(tree_t *tree);
 int remove_from_tree(tree_t *index, char *filename, int delete);
 int tree_to_object(tree_t *tree, object_t *object);
-int tree_from_object(tree_t *tree, object_t *object);
-int add_object_to_tree(tree_t *tree, char* filename, enum file_mode mode, object_t *source);
+int tree_from_object(tree_t *tree, object_t *object, struct arena *arena);
+int diff_trees(unsigned char *checksum_a, unsigned char *checksum_b, tree_change_fn callback, void *data);
 
-#endif // INDEX_H
\ No newline at end of file
+#endif // TREE_H
\ No newline at end of file
@@ -2,6 +2,9 @@
 #define TYPES_H 1
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "includes.h"
 
 enum object_type
 {
@@ -26,24 +29,49 @@ enum file_mode
     GIT_LINK = 0160000,
 };
 
+/// @brief stat information of a file as cached in the index
+struct stat_data {
+    uint32_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t dev;
+    uint32_t ino;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+};
+
 /// @brief entry of a tree
-/// checksum is an array of size DIGEST_LENGTH
-/// filename is a C-string
+/// filename is a C-string stored in the name arena of its tree
+/// stat and fsmonitor_valid are only filled for entries of the index
 typedef struct entry {
     enum file_mode mode;
-    unsigned char *checksum;
-    char *filename;
     enum object_type type;
-    struct entry *previous;
-    struct entry *next;
+    unsigned char checksum[DIGEST_LENGTH];
+    // The file did not change since the fsmonitor token of the index
+    int fsmonitor_valid;
+    char *filename;
+    struct stat_data stat;
 } entry_t;
 
+struct arena;
+
+/// @brief entries of a tree, sorted by filename
+/// Entries appended with append_entry_to_tree past sorted_size are merged
+/// into the sorted part by sort_tree
+/// The names are stored in arena. A tree parsed with an arena given by the
+/// caller also stores its entries there, and is released with the arena
 typedef struct tree {
     size_t entries_size;
-    struct entry *first_entry;
-    struct entry *last_entry;
+    size_t entries_capacity;
+    size_t sorted_size;
+    entry_t *entries;
+    struct arena *arena;
+    int external_arena;
 } tree_t;
 
+/// @brief fields of a commit, allocated in arena when it is not NULL
 typedef struct commit
 {
     char *tree;
@@ -51,6 +79,7 @@ typedef struct commit
     char *author;
     char *committer;
     char *message;
+    struct arena *arena;
 } commit_t;
 
 #endif // TYPES_H
\ No newline at end of file
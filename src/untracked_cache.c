@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "untracked_cache.h"
+#include "utils.h"
+
+#define UNTRACKED_DIR_FIXED_SIZE (4 * 4 + 8 + 3 * 4)
+
+static void free_names(char **names, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        free(names[i]);
+    free(names);
+}
+
+/// @brief Forget what the last scan of dir found, its path is kept
+void clear_untracked_dir(untracked_dir_t *dir)
+{
+    free_names(dir->untracked, dir->untracked_size);
+    free_names(dir->subdirs, dir->subdirs_size);
+    dir->untracked = NULL;
+    dir->untracked_size = 0;
+    dir->subdirs = NULL;
+    dir->subdirs_size = 0;
+    dir->valid = 0;
+}
+
+/// @brief Free the content of cache, but not cache itself
+void free_untracked_cache(untracked_cache_t *cache)
+{
+    for (size_t i = 0; i < cache->dirs_size; i++)
+    {
+        clear_untracked_dir(&cache->dirs[i]);
+        free(cache->dirs[i].path);
+    }
+
+    free(cache->dirs);
+    memset(cache, 0, sizeof(untracked_cache_t));
+}
+
+/// @brief Look a directory up, the ones added since the cache was last
+/// sorted are not found
+untracked_dir_t *find_untracked_dir(untracked_cache_t *cache, char *path)
+{
+    size_t low = 0, high = cache->sorted_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        int cmp = strcmp(cache->dirs[mid].path, path);
+        if (cmp == 0)
+            return &cache->dirs[mid];
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return NULL;
+}
+
+/// @brief Add an empty record for path, which is only found once the cache
+/// is sorted again by sort_untracked_cache
+untracked_dir_t *add_untracked_dir(untracked_cache_t *cache, char *path)
+{
+    if (cache->dirs_size == cache->dirs_capacity)
+    {
+        cache->dirs_capacity = cache->dirs_capacity == 0 ? 64 : cache->dirs_capacity * 2;
+        cache->dirs = realloc(cache->dirs, cache->dirs_capacity * sizeof(untracked_dir_t));
+    }
+
+    untracked_dir_t *dir = &cache->dirs[cache->dirs_size++];
+    memset(dir, 0, sizeof(untracked_dir_t));
+    dir->path = strdup(path);
+    cache->changed = 1;
+    return dir;
+}
+
+static int compare_untracked_dirs(const void *a, const void *b)
+{
+    return strcmp(((untracked_dir_t *)a)->path, ((untracked_dir_t *)b)->path);
+}
+
+/// @brief Sort the directories after a scan
+/// @param drop_unseen remove the directories the scan did not meet, when it
+/// went through the whole working tree
+void sort_untracked_cache(untracked_cache_t *cache, int drop_unseen)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < cache->dirs_size; i++)
+    {
+        untracked_dir_t *dir = &cache->dirs[i];
+        if (drop_unseen && !dir->seen)
+        {
+            clear_untracked_dir(dir);
+            free(dir->path);
+            cache->changed = 1;
+            continue;
+        }
+
+        dir->seen = 0;
+        cache->dirs[kept++] = *dir;
+    }
+
+    cache->dirs_size = kept;
+    qsort(cache->dirs, cache->dirs_size, sizeof(untracked_dir_t), compare_untracked_dirs);
+    cache->sorted_size = cache->dirs_size;
+}
+
+/// @brief Read again the directory holding path, whose file was added to or
+/// removed from the index
+void invalidate_untracked_path(untracked_cache_t *cache, char *path)
+{
+    char *slash = strrchr(path, '/');
+    size_t len = slash == NULL ? 0 : (size_t)(slash - path);
+    char dir_path[len + 1];
+    memcpy(dir_path, path, len);
+    dir_path[len] = '\0';
+
+    untracked_dir_t *dir = find_untracked_dir(cache, dir_path);
+    if (dir != NULL && dir->valid)
+    {
+        dir->valid = 0;
+        cache->changed = 1;
+    }
+}
+
+/// @brief Check again, despite the fsmonitor, the directory holding path and
+/// path itself with everything below it
+void invalidate_untracked_fsmonitor(untracked_cache_t *cache, char *path)
+{
+    char *slash = strrchr(path, '/');
+    size_t len = slash == NULL ? 0 : (size_t)(slash - path);
+    char dir_path[len + 1];
+    memcpy(dir_path, path, len);
+    dir_path[len] = '\0';
+
+    untracked_dir_t *dir = find_untracked_dir(cache, dir_path);
+    if (dir != NULL)
+        dir->fsmonitor_valid = 0;
+
+    // First directory not before path, the ones below it follow
+    size_t path_len = strlen(path);
+    size_t low = 0, high = cache->sorted_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(cache->dirs[mid].path, path) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for (size_t i = low; i < cache->sorted_size; i++)
+    {
+        char *current = cache->dirs[i].path;
+        if (strncmp(current, path, path_len) != 0 || (current[path_len] != '\0' && current[path_len] != '/'))
+        {
+            // "a-b" sorts between "a" and "a/"
+            if (strncmp(current, path, path_len) == 0 && current[path_len] < '/')
+                continue;
+            break;
+        }
+        cache->dirs[i].fsmonitor_valid = 0;
+    }
+    cache->changed = 1;
+}
+
+/// @brief Read count names, size counts the ones read so far
+static int read_names(char ***names, size_t *size, size_t count, unsigned char **ptr, unsigned char *end)
+{
+    if (count > (size_t)(end - *ptr))
+        return -1;
+
+    *names = calloc(count == 0 ? 1 : count, sizeof(char *));
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned char *name_end = memchr(*ptr, '\0', end - *ptr);
+        if (name_end == NULL)
+            return -1;
+        (*names)[i] = strdup((char *)*ptr);
+        (*size)++;
+        *ptr = name_end + 1;
+    }
+
+    return 0;
+}
+
+/// @brief Parse the data of the untracked cache extension of the index
+/// @return 0 on success, -1 if the data is malformed
+int read_untracked_cache(untracked_cache_t *cache, unsigned char *data, size_t size)
+{
+    memset(cache, 0, sizeof(untracked_cache_t));
+    unsigned char *ptr = data, *end = data + size;
+    if (size < 4)
+        return -1;
+    uint32_t count = get_be32(ptr);
+    ptr += 4;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        unsigned char *path_end = memchr(ptr, '\0', end - ptr);
+        if (path_end == NULL || path_end + 1 + UNTRACKED_DIR_FIXED_SIZE > end)
+        {
+            free_untracked_cache(cache);
+            return -1;
+        }
+
+        untracked_dir_t *dir = add_untracked_dir(cache, (char *)ptr);
+        ptr = path_end + 1;
+        dir->mtime_sec = get_be32(ptr);
+        dir->mtime_nsec = get_be32(ptr + 4);
+        dir->ignore_mtime_sec = get_be32(ptr + 8);
+        dir->ignore_mtime_nsec = get_be32(ptr + 12);
+        dir->ignore_size = get_be64(ptr + 16);
+        uint32_t flags = get_be32(ptr + 24);
+        dir->valid = (flags & UNTRACKED_DIR_VALID) != 0;
+        dir->fsmonitor_valid = (flags & UNTRACKED_DIR_FSMONITOR_VALID) != 0;
+        dir->ignore_valid = 1;
+        uint32_t untracked_size = get_be32(ptr + 28);
+        uint32_t subdirs_size = get_be32(ptr + 32);
+        ptr += UNTRACKED_DIR_FIXED_SIZE;
+
+        if (read_names(&dir->untracked, &dir->untracked_size, untracked_size, &ptr, end) != 0
+            || read_names(&dir->subdirs, &dir->subdirs_size, subdirs_size, &ptr, end) != 0)
+        {
+            free_untracked_cache(cache);
+            return -1;
+        }
+    }
+
+    if (ptr != end)
+    {
+        free_untracked_cache(cache);
+        return -1;
+    }
+
+    sort_untracked_cache(cache, 0);
+    cache->changed = 0;
+    return 0;
+}
+
+static void append_data(unsigned char **data, size_t *size, size_t *capacity, void *src, size_t len)
+{
+    if (*size + len > *capacity)
+    {
+        while (*size + len > *capacity)
+            *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        *data = realloc(*data, *capacity);
+    }
+
+    memcpy(*data + *size, src, len);
+    *size += len;
+}
+
+/// @brief Serialize cache as the data of the untracked cache extension,
+/// appended to data
+void write_untracked_cache(untracked_cache_t *cache, unsigned char **data, size_t *size, size_t *capacity)
+{
+    // A directory whose IGNORE_FILE cannot be trusted is scanned again with its subdirectories
+    uint32_t count = 0;
+    for (size_t i = 0; i < cache->dirs_size; i++)
+        count += cache->dirs[i].ignore_valid != 0;
+
+    unsigned char count_data[4];
+    put_be32(count_data, count);
+    append_data(data, size, capacity, count_data, 4);
+
+    for (size_t i = 0; i < cache->dirs_size; i++)
+    {
+        untracked_dir_t *dir = &cache->dirs[i];
+        if (!dir->ignore_valid)
+            continue;
+        size_t untracked_size = dir->valid ? dir->untracked_size : 0;
+        size_t subdirs_size = dir->valid ? dir->subdirs_size : 0;
+
+        unsigned char fixed[UNTRACKED_DIR_FIXED_SIZE];
+        put_be32(fixed, dir->mtime_sec);
+        put_be32(fixed + 4, dir->mtime_nsec);
+        put_be32(fixed + 8, dir->ignore_mtime_sec);
+        put_be32(fixed + 12, dir->ignore_mtime_nsec);
+        put_be64(fixed + 16, dir->ignore_size);
+        uint32_t flags = (dir->valid ? UNTRACKED_DIR_VALID : 0)
+                         | (dir->fsmonitor_valid ? UNTRACKED_DIR_FSMONITOR_VALID : 0);
+        put_be32(fixed + 24, flags);
+        put_be32(fixed + 28, untracked_size);
+        put_be32(fixed + 32, subdirs_size);
+        append_data(data, size, capacity, dir->path, strlen(dir->path) + 1);
+        append_data(data, size, capacity, fixed, UNTRACKED_DIR_FIXED_SIZE);
+
+        for (size_t j = 0; j < untracked_size; j++)
+            append_data(data, size, capacity, dir->untracked[j], strlen(dir->untracked[j]) + 1);
+        for (size_t j = 0; j < subdirs_size; j++)
+            append_data(data, size, capacity, dir->subdirs[j], strlen(dir->subdirs[j]) + 1);
+    }
+}
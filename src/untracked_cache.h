@@ -0,0 +1,78 @@
+#ifndef UNTRACKED_CACHE_H
+#define UNTRACKED_CACHE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// The untracked cache records, for each directory of the working tree that is
+// not ignored, what a scan of it found, so that a directory whose mtime did
+// not change since is not read again.
+//
+// It is stored in the index as the "UNTR" extension
+// number of directories (4 bytes)
+// directory1
+// directory2
+// ...
+// each directory following the format
+// path + '\0' (empty for the root)
+// mtime seconds, mtime nanoseconds of the directory (4 bytes each)
+// mtime seconds, mtime nanoseconds (4 bytes each) and size (8 bytes) of its
+// IGNORE_FILE, all 0 when there is none
+// flags (4 bytes), UNTRACKED_DIR_VALID when the names below can be trusted,
+// UNTRACKED_DIR_FSMONITOR_VALID when the directory did not change since the
+// fsmonitor token of the index
+// number of untracked files (4 bytes), number of subdirectories (4 bytes)
+// names of the untracked files, then of the subdirectories, each + '\0'
+//
+// Directories are sorted by path. A file is untracked when it is neither in
+// the index nor ignored, the subdirectories are the ones that are not ignored.
+// A directory that must be read again is kept without its names, so that its
+// IGNORE_FILE is still known to be unchanged for the scan of its subdirectories.
+
+#define UNTRACKED_CACHE_SIGNATURE "UNTR"
+#define UNTRACKED_DIR_VALID 1
+#define UNTRACKED_DIR_FSMONITOR_VALID 2
+
+typedef struct untracked_dir {
+    char *path;
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ignore_mtime_sec;
+    uint32_t ignore_mtime_nsec;
+    uint64_t ignore_size;
+    // 0 when the directory must be read again
+    int valid;
+    // 0 when the IGNORE_FILE was modified while it was read
+    int ignore_valid;
+    // Neither the directory nor its IGNORE_FILE changed since the fsmonitor token
+    int fsmonitor_valid;
+    // Set on the directories met by the current scan
+    int seen;
+    size_t untracked_size;
+    char **untracked;
+    size_t subdirs_size;
+    char **subdirs;
+} untracked_dir_t;
+
+typedef struct untracked_cache {
+    untracked_dir_t *dirs;
+    size_t dirs_size;
+    size_t dirs_capacity;
+    // Directories before it are sorted, the ones after were added by the current scan
+    size_t sorted_size;
+    // Whether the cache differs from the one that was loaded
+    int changed;
+} untracked_cache_t;
+
+void free_untracked_cache(untracked_cache_t *cache);
+untracked_dir_t *find_untracked_dir(untracked_cache_t *cache, char *path);
+untracked_dir_t *add_untracked_dir(untracked_cache_t *cache, char *path);
+void clear_untracked_dir(untracked_dir_t *dir);
+void sort_untracked_cache(untracked_cache_t *cache, int drop_unseen);
+void invalidate_untracked_path(untracked_cache_t *cache, char *path);
+void invalidate_untracked_fsmonitor(untracked_cache_t *cache, char *path);
+int read_untracked_cache(untracked_cache_t *cache, unsigned char *data, size_t size);
+void write_untracked_cache(untracked_cache_t *cache, unsigned char **data, size_t *size, size_t *capacity);
+
+#endif // UNTRACKED_CACHE_H
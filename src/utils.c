@@ -22,3 +22,48 @@ int get_top_folder(char* path, char* top_folder, char* left)
     path[i] = '/';
     return 1;
 }
+
+uint32_t get_be32(unsigned char *ptr)
+{
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | ptr[3];
+}
+
+uint64_t get_be64(unsigned char *ptr)
+{
+    return ((uint64_t)get_be32(ptr) << 32) | get_be32(ptr + 4);
+}
+
+void put_be32(unsigned char *ptr, uint32_t value)
+{
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+}
+
+void put_be64(unsigned char *ptr, uint64_t value)
+{
+    put_be32(ptr, value >> 32);
+    put_be32(ptr + 4, value);
+}
+
+/// @brief Start a SHA-1 computed in several parts, through the EVP interface
+/// of OpenSSL, SHA1_Init and the like being deprecated
+EVP_MD_CTX *sha1_init()
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+    return ctx;
+}
+
+void sha1_update(EVP_MD_CTX *ctx, const void *data, size_t size)
+{
+    EVP_DigestUpdate(ctx, data, size);
+}
+
+/// @brief Write the SHA-1 to checksum, of size DIGEST_LENGTH, and free ctx
+void sha1_final(EVP_MD_CTX *ctx, unsigned char *checksum)
+{
+    EVP_DigestFinal_ex(ctx, checksum, NULL);
+    EVP_MD_CTX_free(ctx);
+}
@@ -1,9 +1,20 @@
 #ifndef UTILS_H
 #define UTILS_H 1
 
+#include <openssl/evp.h>
 #include <stddef.h>
+#include <stdint.h>
 
 int decimal_len(size_t size);
 int get_top_folder(char* path, char* top_folder, char* left);
 
+uint32_t get_be32(unsigned char *ptr);
+uint64_t get_be64(unsigned char *ptr);
+void put_be32(unsigned char *ptr, uint32_t value);
+void put_be64(unsigned char *ptr, uint64_t value);
+
+EVP_MD_CTX *sha1_init();
+void sha1_update(EVP_MD_CTX *ctx, const void *data, size_t size);
+void sha1_final(EVP_MD_CTX *ctx, unsigned char *checksum);
+
 #endif // UTILS_H
\ No newline at end of file
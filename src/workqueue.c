@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "workqueue.h"
+
+/// @brief Number of threads to use by default, read from CGIT_THREADS or
+/// else the number of online processors
+int default_thread_count()
+{
+    char *env = getenv(THREADS_ENV);
+    if (env != NULL && atoi(env) > 0)
+        return atoi(env);
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+}
+
+void init_workqueue(struct workqueue *queue, int threads, void *data)
+{
+    memset(queue, 0, sizeof(struct workqueue));
+    queue->threads = threads > 0 ? threads : 1;
+    queue->data = data;
+    queue->deques = calloc(queue->threads, sizeof(struct work_deque));
+    for (int i = 0; i < queue->threads; i++)
+        pthread_mutex_init(&queue->deques[i].lock, NULL);
+    pthread_mutex_init(&queue->state_lock, NULL);
+    pthread_cond_init(&queue->state_cond, NULL);
+}
+
+static void deque_push(struct work_deque *deque, struct work_item item)
+{
+    if (deque->count == deque->capacity)
+    {
+        size_t capacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+        struct work_item *items = malloc(capacity * sizeof(struct work_item));
+        for (size_t i = 0; i < deque->count; i++)
+            items[i] = deque->items[(deque->head + i) % deque->capacity];
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+
+    deque->items[(deque->head + deque->count) % deque->capacity] = item;
+    deque->count++;
+}
+
+/// @brief Queue a job on the deque of worker, it may be stolen by any other worker
+void push_work(struct workqueue *queue, int worker, work_fn fn, void *arg)
+{
+    struct work_deque *deque = &queue->deques[worker];
+    struct work_item item = {.fn = fn, .arg = arg};
+
+    pthread_mutex_lock(&deque->lock);
+    deque_push(deque, item);
+    pthread_mutex_unlock(&deque->lock);
+
+    pthread_mutex_lock(&queue->state_lock);
+    queue->queued++;
+    queue->pending++;
+    pthread_cond_signal(&queue->state_cond);
+    pthread_mutex_unlock(&queue->state_lock);
+}
+
+/// @brief Take the newest job of worker, or else steal the oldest job of another one
+static int take_work(struct workqueue *queue, int worker, struct work_item *item)
+{
+    for (int i = 0; i < queue->threads; i++)
+    {
+        int victim = (worker + i) % queue->threads;
+        struct work_deque *deque = &queue->deques[victim];
+
+        pthread_mutex_lock(&deque->lock);
+        if (deque->count == 0)
+        {
+            pthread_mutex_unlock(&deque->lock);
+            continue;
+        }
+
+        if (victim == worker)
+        {
+            *item = deque->items[(deque->head + deque->count - 1) % deque->capacity];
+        } else
+        {
+            *item = deque->items[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+        deque->count--;
+        pthread_mutex_unlock(&deque->lock);
+
+        pthread_mutex_lock(&queue->state_lock);
+        queue->queued--;
+        pthread_mutex_unlock(&queue->state_lock);
+        return 1;
+    }
+
+    return 0;
+}
+
+struct worker_arg {
+    struct workqueue *queue;
+    int worker;
+};
+
+static void *worker_loop(void *data)
+{
+    struct worker_arg *arg = data;
+    struct workqueue *queue = arg->queue;
+    struct work_item item;
+
+    while (1)
+    {
+        if (take_work(queue, arg->worker, &item))
+        {
+            item.fn(queue, arg->worker, item.arg);
+
+            pthread_mutex_lock(&queue->state_lock);
+            queue->pending--;
+            if (queue->pending == 0)
+                pthread_cond_broadcast(&queue->state_cond);
+            pthread_mutex_unlock(&queue->state_lock);
+            continue;
+        }
+
+        // Nothing to steal, wait until a running job pushes more or the last one ends
+        pthread_mutex_lock(&queue->state_lock);
+        while (queue->queued == 0 && queue->pending > 0)
+            pthread_cond_wait(&queue->state_cond, &queue->state_lock);
+        int done = queue->pending == 0;
+        pthread_mutex_unlock(&queue->state_lock);
+
+        if (done)
+            break;
+    }
+
+    return NULL;
+}
+
+/// @brief Run every queued job, and the jobs they push, until none is left
+/// The calling thread is used as the first worker
+void run_workqueue(struct workqueue *queue)
+{
+    pthread_t threads[queue->threads];
+    struct worker_arg args[queue->threads];
+    int started = 1;
+
+    for (int i = 0; i < queue->threads; i++)
+    {
+        args[i].queue = queue;
+        args[i].worker = i;
+    }
+
+    for (int i = 1; i < queue->threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, worker_loop, &args[i]) != 0)
+            break;
+        started++;
+    }
+
+    worker_loop(&args[0]);
+
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+void free_workqueue(struct workqueue *queue)
+{
+    for (int i = 0; i < queue->threads; i++)
+    {
+        pthread_mutex_destroy(&queue->deques[i].lock);
+        free(queue->deques[i].items);
+    }
+    free(queue->deques);
+    pthread_mutex_destroy(&queue->state_lock);
+    pthread_cond_destroy(&queue->state_cond);
+    memset(queue, 0, sizeof(struct workqueue));
+}
@@ -0,0 +1,48 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H 1
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Each worker owns a deque of jobs: it pushes and takes its own jobs at the
+// tail, and when it runs out it steals the oldest job at the head of the
+// deque of another worker. Jobs may push new jobs while they run, the queue
+// is done once every job pushed has run.
+
+#define THREADS_ENV "CGIT_THREADS"
+
+struct workqueue;
+
+typedef void (*work_fn)(struct workqueue *queue, int worker, void *arg);
+
+struct work_item {
+    work_fn fn;
+    void *arg;
+};
+
+struct work_deque {
+    pthread_mutex_t lock;
+    struct work_item *items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+};
+
+struct workqueue {
+    int threads;
+    struct work_deque *deques;
+    pthread_mutex_t state_lock;
+    pthread_cond_t state_cond;
+    // Jobs waiting in a deque, and jobs waiting or running
+    size_t queued;
+    size_t pending;
+    void *data;
+};
+
+int default_thread_count();
+void init_workqueue(struct workqueue *queue, int threads, void *data);
+void push_work(struct workqueue *queue, int worker, work_fn fn, void *arg);
+void run_workqueue(struct workqueue *queue);
+void free_workqueue(struct workqueue *queue);
+
+#endif // WORKQUEUE_H